@@ -0,0 +1,262 @@
+#!/usr/bin/env python3
+
+'''
+Times the interpreter on the programs in bench/, plus two large generated
+sources that mostly exercise the tokenizer and parser, and the same table
+loaded once with read-csv and once as a quoted list in the program. For each benchmark it
+reports the best wall time over a few runs, evals per second, peak RSS and
+the number of allocations, as a table and optionally as JSON. Given the JSON
+from an earlier run, it also shows how each time changed.
+
+Each bench/NAME.scm has a bench/NAME.output, checked the same way tester.py
+checks tests, so a fast wrong answer doesn't pass for a speedup.
+'''
+
+import argparse
+import json
+import os
+import re
+import subprocess
+import sys
+import tempfile
+import time
+
+BENCH_DIR = os.path.dirname(os.path.abspath(__file__))
+
+# A change in time bigger than this is flagged in the comparison.
+THRESHOLD = 0.10
+
+
+def generate_data_source(path, size) -> None:
+    '''Writes about size bytes of quoted data: nested lists of numbers,
+    strings and symbols, bound to a handful of names over and over.'''
+    with open(path, 'w') as out:
+        written = 0
+        i = 0
+        while written < size:
+            line = ('(define item%d (quote (%d %d.5 "text %d" symbol%d '
+                    '(nested (list %d) #t #f) ())))\n'
+                    % (i % 64, i, i, i, i % 100, i))
+            out.write(line)
+            written += len(line)
+            i += 1
+        out.write('item0\n')
+
+
+def generate_code_source(path, size) -> None:
+    '''Writes about size bytes of procedure definitions, each called once,
+    so that most of the work is reading and analysing code.'''
+    with open(path, 'w') as out:
+        written = 0
+        i = 0
+        while written < size:
+            name = 'proc%d' % (i % 64)
+            line = ('(define %s (lambda (a b) (let ((c (+ a %d)) (d (* b 2))) '
+                    '(if (< c d) (cond ((= c 0) a) (else (- d c))) '
+                    '(begin (+ c d %d))))))\n(%s %d 3)\n'
+                    % (name, i, i, name, i % 10))
+            out.write(line)
+            written += len(line)
+            i += 1
+
+
+def table_rows(size):
+    '''Rows of a quantity, a price and a name, about size bytes of them as
+    CSV.'''
+    written = 0
+    i = 0
+    while written < size:
+        row = (i % 1000, i % 997 + 0.25, 'item%d' % (i % 100))
+        written += len('%d,%s,%s\n' % row)
+        yield row
+        i += 1
+
+
+def table_answer(size) -> str:
+    '''What both table benchmarks print: the sums of the two number
+    columns.'''
+    quantities = 0
+    prices = 0.0
+    for row in table_rows(size):
+        quantities += row[0]
+        prices += row[1]
+    return '%d %g' % (quantities, prices)
+
+
+def generate_table_csv(path, size) -> str:
+    '''Writes about size bytes of CSV beside path, and a program there that
+    loads it with read-csv and sums its number columns.'''
+    data = path[:-len('.scm')] + '.csv'
+    with open(data, 'w') as out:
+        out.write('quantity,price,name\n')
+        for row in table_rows(size):
+            out.write('%d,%s,%s\n' % row)
+    with open(path, 'w') as out:
+        out.write('(define table (read-csv "%s"))\n' % data)
+        out.write('(vector-fold + 0 (cdr (assoc "quantity" table)))\n')
+        out.write('(vector-fold + 0 (cdr (assoc "price" table)))\n')
+    return table_answer(size)
+
+
+def generate_table_source(path, size) -> str:
+    '''Writes the same rows as generate_table_csv as one quoted list in the
+    program, which sums the same columns, so read-csv can be compared with
+    the tokenizer and parser on the same data.'''
+    with open(path, 'w') as out:
+        out.write('(define table (quote (\n')
+        for row in table_rows(size):
+            out.write('(%d %s "%s")\n' % row)
+        out.write(')))\n')
+        out.write('(foldl + 0 (map car table))\n')
+        out.write('(foldl + 0 (map (lambda (row) (car (cdr row))) table))\n')
+    return table_answer(size)
+
+
+def clean_output(output: str) -> str:
+    '''The parts of tester.py's cleanup that apply to benchmark results.'''
+    result = re.sub('^Evaluation error.*$', 'Evaluation error', output,
+                    flags=re.MULTILINE)
+    return re.sub('\\s+', ' ', result).strip()
+
+
+def run_once(interpreter, program):
+    '''Runs the interpreter on a program, returning its output, exit status,
+    wall time in seconds, peak RSS in kilobytes and the --stats counts.'''
+    with open(program, 'rb') as source, tempfile.TemporaryFile() as output, \
+            tempfile.TemporaryFile() as errors:
+        start = time.perf_counter()
+        process = subprocess.Popen([interpreter, '--stats'], stdin=source,
+                                   stdout=output, stderr=errors)
+        _, status, usage = os.wait4(process.pid, 0)
+        elapsed = time.perf_counter() - start
+        output.seek(0)
+        errors.seek(0)
+        printed = output.read().decode('utf-8', 'replace')
+        reported = errors.read().decode('utf-8', 'replace')
+    stats = re.search(r'stats: (\d+) evals, (\d+) allocations', reported)
+    return {
+        'output': printed,
+        'status': os.waitstatus_to_exitcode(status),
+        'time': elapsed,
+        'rss': usage.ru_maxrss,
+        'evals': int(stats.group(1)) if stats else None,
+        'allocations': int(stats.group(2)) if stats else None,
+    }
+
+
+def run_benchmark(interpreter, name, program, expected, repeat):
+    best = None
+    peak = 0
+    for _ in range(repeat):
+        result = run_once(interpreter, program)
+        if result['status'] != 0:
+            return {'name': name, 'error': 'exit status %d' % result['status']}
+        if expected is not None and clean_output(result['output']) != expected:
+            return {'name': name, 'error': 'wrong output'}
+        peak = max(peak, result['rss'])
+        if best is None or result['time'] < best['time']:
+            best = result
+    evals = best['evals']
+    return {
+        'name': name,
+        'time': round(best['time'], 4),
+        'evals': evals,
+        'evals_per_sec': round(evals / best['time']) if evals else None,
+        'peak_rss_kb': peak,
+        'allocations': best['allocations'],
+    }
+
+
+def benchmarks(workdir, names):
+    '''(name, program path, expected output or None) for each benchmark,
+    limited to the given names if there are any.'''
+    found = []
+    for file_name in sorted(os.listdir(BENCH_DIR)):
+        if file_name.endswith('.scm'):
+            name = file_name[:-len('.scm')]
+            with open(os.path.join(BENCH_DIR, name + '.output')) as output:
+                expected = clean_output(output.read())
+            found.append((name, os.path.join(BENCH_DIR, file_name), expected))
+
+    generated = [('source-data', generate_data_source),
+                 ('source-code', generate_code_source),
+                 ('table-csv', generate_table_csv),
+                 ('table-source', generate_table_source)]
+    for name, generate in generated:
+        if not names or name in names:
+            path = os.path.join(workdir, name + '.scm')
+            expected = generate(path, 4 * 1024 * 1024)
+            found.append((name, path, expected))
+    return [bench for bench in found if not names or bench[0] in names]
+
+
+def format_count(count) -> str:
+    if count is None:
+        return '-'
+    for limit, suffix in ((1e9, 'G'), (1e6, 'M'), (1e3, 'k')):
+        if count >= limit:
+            return '%.1f%s' % (count / limit, suffix)
+    return str(count)
+
+
+def print_table(results, baseline) -> None:
+    header = '%-14s %9s %10s %10s %10s %10s' % (
+        'benchmark', 'time(s)', 'evals', 'evals/s', 'peak RSS', 'allocs')
+    if baseline:
+        header += '  %8s' % 'vs base'
+    print(header)
+    for result in results:
+        if 'error' in result:
+            print('%-14s %s' % (result['name'], result['error'].upper()))
+            continue
+        line = '%-14s %9.3f %10s %10s %9.1fM %10s' % (
+            result['name'], result['time'], format_count(result['evals']),
+            format_count(result['evals_per_sec']),
+            result['peak_rss_kb'] / 1024.0,
+            format_count(result['allocations']))
+        old = baseline.get(result['name'])
+        if old and 'time' in old:
+            change = result['time'] / old['time'] - 1
+            flag = ' !' if abs(change) > THRESHOLD else ''
+            line += '  %+7.1f%%%s' % (change * 100, flag)
+        print(line)
+
+
+def main() -> None:
+    parser = argparse.ArgumentParser(description='Benchmark the interpreter.')
+    parser.add_argument('names', nargs='*',
+                        help='benchmarks to run (default: all)')
+    parser.add_argument('--interpreter', default='./interpreter')
+    parser.add_argument('--repeat', type=int, default=3,
+                        help='runs per benchmark; the fastest counts')
+    parser.add_argument('--json', help='also write the results to this file')
+    parser.add_argument('--baseline',
+                        help='JSON from an earlier run to compare times with')
+    args = parser.parse_args()
+
+    baseline = {}
+    if args.baseline:
+        with open(args.baseline) as old:
+            baseline = {result['name']: result
+                        for result in json.load(old)['results']}
+
+    with tempfile.TemporaryDirectory() as workdir:
+        results = [run_benchmark(args.interpreter, name, program, expected,
+                                 args.repeat)
+                   for name, program, expected in benchmarks(workdir,
+                                                             args.names)]
+
+    print_table(results, baseline)
+    if args.json:
+        with open(args.json, 'w') as out:
+            json.dump({'interpreter': args.interpreter,
+                       'repeat': args.repeat,
+                       'results': results}, out, indent=2)
+            out.write('\n')
+
+    if any('error' in result for result in results):
+        sys.exit(1)
+
+
+if __name__ == '__main__':
+    main()
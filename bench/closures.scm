@@ -0,0 +1,46 @@
+;; Deep chains of closures: each adder captures the one before it, so a call
+;; walks the whole chain through nested frames.
+(define make-chain
+  (lambda (n f)
+    (if (= n 0)
+        f
+        (make-chain (- n 1) (lambda (x) (+ (f x) 1))))))
+
+(define compose-all
+  (lambda (n)
+    (let ((chain (make-chain n (lambda (x) x))))
+      (chain 0))))
+
+(define repeat
+  (lambda (i total)
+    (if (= i 0)
+        total
+        (repeat (- i 1) (+ total (compose-all 1000))))))
+
+(repeat 300 0)
+
+(define counter
+  (lambda ()
+    (let ((count 0))
+      (lambda ()
+        (begin
+          (set! count (+ count 1))
+          count)))))
+
+(define tick
+  (lambda (c n)
+    (if (= n 0)
+        (c)
+        (begin
+          (c)
+          (tick c (- n 1))))))
+
+(define ticks
+  (lambda (c i)
+    (if (= i 0)
+        (c)
+        (begin
+          (tick c 2000)
+          (ticks c (- i 1))))))
+
+(ticks (counter) 100)
@@ -0,0 +1,44 @@
+;; Definitions at run time: defines inside procedure bodies on every call,
+;; and top-level names redefined over and over.
+(define poly
+  (lambda (x)
+    (begin
+      (define square (* x x))
+      (define cube (* square x))
+      (define twice (lambda (y) (+ y y)))
+      (+ (twice cube) square x 1))))
+
+(define loop
+  (lambda (i total)
+    (if (= i 0)
+        total
+        (loop (- i 1) (+ total (poly (modulo i 7)))))))
+
+(define outer
+  (lambda (i total)
+    (if (= i 0)
+        total
+        (outer (- i 1) (+ total (loop 2000 0))))))
+
+(outer 50 0)
+
+(define step 0)
+(define value 0)
+(define redefine
+  (lambda (i)
+    (if (= i 0)
+        value
+        (begin
+          (define step (+ step 1))
+          (set! value (+ value step))
+          (redefine (- i 1))))))
+
+(define redefine-all
+  (lambda (i)
+    (if (= i 0)
+        value
+        (begin
+          (redefine 2000)
+          (redefine-all (- i 1))))))
+
+(redefine-all 50)
@@ -0,0 +1,8 @@
+;; Doubly recursive Fibonacci: procedure calls and integer arithmetic.
+(define fib
+  (lambda (n)
+    (if (< n 2)
+        n
+        (+ (fib (- n 1)) (fib (- n 2))))))
+
+(fib 27)
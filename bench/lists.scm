@@ -0,0 +1,24 @@
+;; Building lists, then reversing, mapping and folding over them. Lists are
+;; kept to 2000 elements so that the recursion fits on the C stack.
+(define build
+  (lambda (n acc)
+    (if (= n 0)
+        acc
+        (build (- n 1) (cons n acc)))))
+
+(define sum
+  (lambda (lst acc)
+    (if (null? lst)
+        acc
+        (sum (cdr lst) (+ acc (car lst))))))
+
+(define round
+  (lambda (i total)
+    (if (= i 0)
+        total
+        (round (- i 1)
+               (+ total
+                  (sum (reverse (build 2000 (quote ()))) 0)
+                  (foldl + 0 (map (lambda (x) (* x 2)) (append (build 1000 (quote ())) (build 1000 (quote ()))))))))))
+
+(round 100 0)
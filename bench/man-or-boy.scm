@@ -0,0 +1,28 @@
+;; Knuth's man or boy test (tests/test61.scm), scaled up: closures that
+;; capture and set! variables of their enclosing calls, nested deeply. k
+;; stays at 13, as the recursion for 14 is deeper than the C stack.
+(define less-than-or-equal
+  (lambda (x y)
+    (if (> x y) #f #t)))
+
+(define a
+  (lambda (k x1 x2 x3 x4 x5)
+    (letrec ((b
+              (lambda ()
+                (begin
+                  (set! k (- k 1))
+                  (a k b x1 x2 x3 x4)))))
+      (if (less-than-or-equal k 0)
+          (+ (x4) (x5))
+          (b)))))
+
+(define run
+  (lambda (i result)
+    (if (= i 0)
+        result
+        (run (- i 1)
+             (a 13 (lambda () 1) (lambda () -1)
+                (lambda () -1) (lambda () 1)
+                (lambda () 0))))))
+
+(run 30 0)
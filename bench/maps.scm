@@ -0,0 +1,24 @@
+;; Building persistent maps and updating every key, keeping each version
+;; alive alongside the one it was made from. Loops are kept to 2000 steps
+;; so that the recursion fits on the C stack.
+(define fill
+  (lambda (m i n)
+    (if (= i n)
+        m
+        (fill (pmap-set m i i) (+ i 1) n))))
+
+(define bump
+  (lambda (m i n)
+    (if (= i n)
+        m
+        (bump (pmap-set m i (+ (pmap-ref m i) 1)) (+ i 1) n))))
+
+(define round
+  (lambda (i m total)
+    (if (= i 0)
+        total
+        (round (- i 1)
+               (bump m 0 2000)
+               (+ total (pmap-fold (lambda (k v acc) (+ acc v)) 0 m))))))
+
+(round 50 (fill (pmap-empty) 0 2000) 0)
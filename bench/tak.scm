@@ -0,0 +1,14 @@
+;; Takeuchi function: deep non-tail recursion with three arguments.
+(define tak
+  (lambda (x y z)
+    (if (not-less-than y x)
+        z
+        (tak (tak (- x 1) y z)
+             (tak (- y 1) z x)
+             (tak (- z 1) x y)))))
+
+(define not-less-than
+  (lambda (a b)
+    (if (< a b) #f #t)))
+
+(tak 21 14 7)
@@ -0,0 +1,140 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <setjmp.h>
+#include <limits.h>
+#include <time.h>
+#include "value.h"
+#include "talloc.h"
+#include "tokenizer.h"
+#include "parser.h"
+#include "interpreter.h"
+#include "optimizer.h"
+#include "expand.h"
+#include "future.h"
+#include "coroutine.h"
+#include "port.h"
+#include "profile.h"
+#include "context.h"
+
+_Thread_local Context *currentContext = NULL;
+
+Context *newContext(FILE *input, FILE *output) {
+  Context *context = malloc(sizeof(Context));
+  context->heap = newHeap();
+  context->input = input;
+  context->output = output;
+  context->bindingEpoch = 1;
+  context->requestCount = 0;
+  context->evaluations = 0;
+  context->allocations = 0;
+  context->stepLimit = 0;
+  context->timeLimit = 0;
+  context->stepsLeft = LONG_MAX;
+  context->deadline = 0;
+  context->futures = NULL;
+  context->coroutines = NULL;
+  context->ports = NULL;
+
+  Context *previous = currentContext;
+  useContext(context);
+  makeGlobalEnvironment(context);
+  context->macros = makeNull();
+  context->changedBindings = makeNull();
+  useContext(previous);
+  return context;
+}
+
+double monotonicSeconds() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+void useContext(Context *context) {
+  currentContext = context;
+  useHeap(context == NULL ? NULL : context->heap);
+}
+
+// Errors in the program end up here rather than ending the process: texit
+// jumps back with the status, and the frame region is popped back to where
+// it was. The futures it started are always waited for before returning.
+int runProgram(Context *context, bool optimizing, bool reporting) {
+  Context *previous = currentContext;
+  useContext(context);
+
+  jmp_buf handler;
+  RegionMark mark = regionMark();
+  int profileDepth = profileMark();
+  context->stepsLeft = context->stepLimit > 0 ? context->stepLimit : LONG_MAX;
+  context->deadline = context->timeLimit > 0 ? monotonicSeconds() + context->timeLimit : 0;
+  int status = setjmp(handler);
+  if (status == 0) {
+    tallocSetExitHandler(&handler);
+    Value *tree = expand(parse(tokenize(context->input)));
+    if (optimizing) {
+      tree = optimize(tree, reporting);
+    }
+    interpret(tree);
+    stopCoroutines();
+  }
+  else {
+    stopCoroutines();
+    regionRelease(mark);
+    profileRelease(profileDepth);
+    tallocSetSite(SITE_OTHER);
+  }
+  tallocSetExitHandler(NULL);
+  stopFutures();
+  closePorts();
+  flushEvalCount();
+  context->allocations = tallocCount();
+
+  fflush(context->output);
+  useContext(previous);
+  return status;
+}
+
+int runRequest(Context *context, FILE *input, FILE *output, bool optimizing) {
+  Heap *heap = context->heap;
+  FILE *savedInput = context->input;
+  FILE *savedOutput = context->output;
+  Heap *requestHeap = newHeap();
+  context->heap = requestHeap;
+  context->input = input;
+  context->output = output;
+  context->requestCount++;
+
+  Context *previous = currentContext;
+  useContext(context);
+  Frame *frame = talloc(sizeof(Frame));
+  frame->parent = context->globalFrame;
+  frame->bindings = makeNull();
+  context->topFrame = frame;
+  Value *macros = context->macros;
+  Value *noChanges = context->changedBindings;
+
+  int status = runProgram(context, optimizing, false);
+
+  //oldest last, so each binding ends up with what it held before the request
+  for (Value *change = context->changedBindings; change != noChanges; change = cdr(change)) {
+    setCdr(car(car(change)), cdr(car(change)));
+  }
+  context->changedBindings = noChanges;
+  context->topFrame = context->globalFrame;
+  context->macros = macros;
+  context->heap = heap;
+  context->input = savedInput;
+  context->output = savedOutput;
+  useContext(previous);
+  freeHeap(requestHeap);
+  return status;
+}
+
+void freeContext(Context *context) {
+  if (currentContext == context) {
+    currentContext = NULL;
+  }
+  freeHeap(context->heap);
+  free(context);
+}
@@ -0,0 +1,88 @@
+#include <stdio.h>
+#include <stdbool.h>
+#include "value.h"
+#include "talloc.h"
+
+#ifndef _CONTEXT
+#define _CONTEXT
+
+// One interpreter instance: its heap, its I/O streams and its global
+// environment, with everything the evaluator would otherwise keep in
+// globals. Separate contexts share nothing, so a host can run one per
+// thread. Each thread works in one context at a time, its current context.
+typedef struct Context {
+  Heap *heap;
+  FILE *input;
+  FILE *output;
+  Frame *globalFrame;
+  // where a program's top-level forms are evaluated: the global frame, or in
+  // server mode a fresh child of it for each request
+  Frame *topFrame;
+  // how many server requests have started, so that caches the prelude made
+  // can tell when what they hold has been freed
+  int requestCount;
+  // the two booleans, shared by every primitive that returns one
+  Value *trueValue;
+  Value *falseValue;
+  // the empty binding list every new frame starts with
+  Value *noBindings;
+  // bumped whenever a define adds a binding to a frame other than the global
+  // one, since that can hide a global binding that references have cached
+  int bindingEpoch;
+  // work done by the programs run so far: calls to eval, and allocations
+  // from the heap, as of the end of the last one
+  long evaluations;
+  long allocations;
+  // the most steps (calls to eval) and seconds of wall-clock time a program
+  // may take, or 0 for no limit; in server mode, each request gets both
+  long stepLimit;
+  double timeLimit;
+  // what the running program has left: steps not yet handed out to a
+  // thread, and the monotonic time it must be done by, or 0 if it needn't
+  long stepsLeft;
+  double deadline;
+  // the worker pool, once the program has made a future
+  struct FuturePool *futures;
+  // the coroutines the program has spawned, once it has
+  struct Scheduler *coroutines;
+  // every file port the program has opened
+  struct Port *ports;
+  // the macros define-syntax has made, as (name . (syntax-rules ...))
+  // pairs, newest first
+  Value *macros;
+  // during a server request, the bindings from outside its heap that its
+  // set!s have changed, as (binding . old value) pairs, newest first, so
+  // that they can be put back
+  Value *changedBindings;
+} Context;
+
+extern _Thread_local Context *currentContext;
+
+// Make a context that reads programs from input and writes their results
+// to output, with the primitives already bound.
+Context *newContext(FILE *input, FILE *output);
+
+// Make context (or none, given NULL) the calling thread's current one. Its
+// heap becomes the one the thread allocates from.
+void useContext(Context *context);
+
+// The time on the monotonic clock, in seconds.
+double monotonicSeconds();
+
+// Read a program from the context's input and run it, leaving its
+// definitions in the context. Returns 0, or the nonzero status it would
+// have exited with after an error. Running out of steps or time is an
+// error like any other.
+int runProgram(Context *context, bool optimizing, bool reporting);
+
+// Run one program from input the way server mode does, writing its output
+// to output. It is evaluated in a fresh child frame of the global
+// environment and allocates from a heap of its own that is freed afterwards,
+// so nothing it defines outlives it, and the prelude variables it set!s
+// get their values back. Returns the status as runProgram does.
+int runRequest(Context *context, FILE *input, FILE *output, bool optimizing);
+
+// Free a context and everything allocated in it.
+void freeContext(Context *context);
+
+#endif
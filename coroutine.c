@@ -0,0 +1,447 @@
+#include <stdbool.h>
+#include <stdlib.h>
+#include <ucontext.h>
+#include <sys/mman.h>
+#include "value.h"
+#include "linkedlist.h"
+#include "talloc.h"
+#include "interpreter.h"
+#include "context.h"
+#include "future.h"
+#include "coroutine.h"
+
+// (spawn expr) makes a coroutine that will evaluate expr, and carries on
+// with the one that spawned it. Coroutines take turns on the thread running
+// the program: one runs until it calls (yield), or waits in (send ch v) for
+// room in a channel or in (receive ch) for a value, and then the scheduler
+// switches to the oldest ready one. The program itself counts as a coroutine
+// too, and once its last top-level form is done the others run until none
+// of them is ready.
+//
+// eval is recursive, so a suspended coroutine is in the middle of C calls,
+// and each one gets a C stack of its own to keep them on. The stack is
+// mapped without reserving memory behind it, so a coroutine only costs the
+// pages it actually touches, and it can recurse as deeply as the program's
+// own stack allows. A guard page at the bottom catches overflows. Stacks are
+// kept for reuse, trimmed back to their top few pages.
+//
+// An error in a coroutine, and a deadlock (the running coroutine has to
+// wait, and none is ready), end the program, which reports them as soon as
+// it gets control back. Futures run on other threads, so they can't spawn,
+// yield or use channels.
+
+#define STACK_RESERVE (8 * 1024 * 1024)
+#define STACK_KEPT (64 * 1024)
+#define SPARE_STACKS 16
+#define DEFAULT_CHANNEL_SIZE 1
+
+typedef struct Queue {
+  struct Coroutine *head;
+  struct Coroutine *tail;
+} Queue;
+
+typedef struct Coroutine {
+  ucontext_t context;
+  // its stack, guard page included; NULL for the program itself
+  char *stack;
+  Value *expr;
+  Frame *frame;
+  // the evaluator's state for it while it isn't running
+  EvalState state;
+  // the run queue or channel it is waiting in, if any, and the next one there
+  Queue *queue;
+  struct Coroutine *next;
+  // the unfinished coroutines, so stopCoroutines can find them all
+  struct Coroutine *previousLive;
+  struct Coroutine *nextLive;
+} Coroutine;
+
+typedef struct Channel {
+  Value **buffer;
+  int capacity;
+  int count;
+  int head;
+  Queue senders;
+  Queue receivers;
+  // the server request the values in it were sent in; see channelOf
+  int requestCount;
+} Channel;
+
+typedef struct Scheduler {
+  Coroutine program;
+  Coroutine *running;
+  Queue ready;
+  Coroutine *live;
+  // a coroutine that has just finished; its stack is still in use until
+  // the switch away from it is done
+  Coroutine *finished;
+  // an error that ended a coroutine, for the program to report
+  char *error;
+  char *spares[SPARE_STACKS];
+  int spareCount;
+} Scheduler;
+
+void enqueue(Queue *queue, Coroutine *coroutine) {
+  coroutine->queue = queue;
+  coroutine->next = NULL;
+  if (queue->tail == NULL) {
+    queue->head = coroutine;
+  }
+  else {
+    queue->tail->next = coroutine;
+  }
+  queue->tail = coroutine;
+}
+
+Coroutine *dequeue(Queue *queue) {
+  Coroutine *coroutine = queue->head;
+  if (coroutine != NULL) {
+    queue->head = coroutine->next;
+    if (queue->head == NULL) {
+      queue->tail = NULL;
+    }
+    coroutine->queue = NULL;
+  }
+  return coroutine;
+}
+
+// Takes a coroutine out of whatever queue it is waiting in.
+void unqueue(Coroutine *coroutine) {
+  Queue *queue = coroutine->queue;
+  if (queue == NULL) {
+    return;
+  }
+  Coroutine *previous = NULL;
+  Coroutine *cur = queue->head;
+  while (cur != coroutine) {
+    previous = cur;
+    cur = cur->next;
+  }
+  if (previous == NULL) {
+    queue->head = coroutine->next;
+  }
+  else {
+    previous->next = coroutine->next;
+  }
+  if (queue->tail == coroutine) {
+    queue->tail = previous;
+  }
+  coroutine->queue = NULL;
+}
+
+// The current context's scheduler, made the first time it's needed.
+Scheduler *currentScheduler() {
+  if (isWorkerThread()) {
+    evaluationError("coroutines and channels can't be used in a future");
+  }
+  Scheduler *scheduler = currentContext->coroutines;
+  if (scheduler == NULL) {
+    scheduler = calloc(1, sizeof(Scheduler));
+    scheduler->running = &scheduler->program;
+    currentContext->coroutines = scheduler;
+  }
+  return scheduler;
+}
+
+char *newStack(Scheduler *scheduler) {
+  if (scheduler->spareCount > 0) {
+    scheduler->spareCount--;
+    return scheduler->spares[scheduler->spareCount];
+  }
+  char *stack = mmap(NULL, STACK_RESERVE, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_STACK, -1, 0);
+  if (stack == MAP_FAILED) {
+    evaluationError("no memory for another coroutine");
+  }
+  mprotect(stack, PAGE_SIZE, PROT_NONE);
+  return stack;
+}
+
+void freeStack(Scheduler *scheduler, char *stack) {
+  if (scheduler->spareCount == SPARE_STACKS) {
+    munmap(stack, STACK_RESERVE);
+    return;
+  }
+  madvise(stack + PAGE_SIZE, STACK_RESERVE - PAGE_SIZE - STACK_KEPT, MADV_DONTNEED);
+  scheduler->spares[scheduler->spareCount] = stack;
+  scheduler->spareCount++;
+}
+
+void freeCoroutine(Scheduler *scheduler, Coroutine *coroutine) {
+  //a channel from a server's prelude outlives the program that waited in it
+  unqueue(coroutine);
+  freeEvalState(&coroutine->state);
+  freeStack(scheduler, coroutine->stack);
+  free(coroutine);
+}
+
+// Ends the program with an error, from wherever it was waiting.
+void raiseInProgram(Scheduler *scheduler, char *error) {
+  unqueue(&scheduler->program);
+  evaluationError(error);
+}
+
+// What a coroutine does each time it gets control back: free whatever
+// finished just before, and if it is the program, report any error that
+// ended a coroutine meanwhile.
+void resumed(Scheduler *scheduler) {
+  if (scheduler->finished != NULL) {
+    freeCoroutine(scheduler, scheduler->finished);
+    scheduler->finished = NULL;
+  }
+  if (scheduler->running == &scheduler->program && scheduler->error != NULL) {
+    char *error = scheduler->error;
+    scheduler->error = NULL;
+    raiseInProgram(scheduler, error);
+  }
+}
+
+// Switches the thread, and the evaluator's state, from the running
+// coroutine to another. Returns once something switches back.
+void switchTo(Scheduler *scheduler, Coroutine *to) {
+  Coroutine *from = scheduler->running;
+  if (to == from) {
+    return;
+  }
+  scheduler->running = to;
+  swapEvalState(&to->state);
+  from->state = to->state;
+  swapcontext(&from->context, &to->context);
+  resumed(scheduler);
+}
+
+// Gives the thread to the next ready coroutine, or to the program if there
+// is an error for it to report. With nothing ready, the running coroutine
+// (which has already queued itself somewhere, if it will ever run again) is
+// waiting for something that can't happen.
+void suspend(Scheduler *scheduler) {
+  Coroutine *next;
+  if (scheduler->error != NULL) {
+    next = &scheduler->program;
+  }
+  else {
+    next = dequeue(&scheduler->ready);
+  }
+  if (next == NULL) {
+    char *deadlock = "deadlock: every coroutine is waiting on a channel";
+    if (scheduler->running == &scheduler->program) {
+      raiseInProgram(scheduler, deadlock);
+    }
+    scheduler->error = deadlock;
+    next = &scheduler->program;
+  }
+  switchTo(scheduler, next);
+}
+
+// Where each coroutine starts, on its own stack. It never returns: when
+// it's done, it switches away for good and the next one to run frees it.
+void coroutineMain() {
+  Scheduler *scheduler = currentContext->coroutines;
+  resumed(scheduler);
+  Coroutine *self = scheduler->running;
+
+  char *error;
+  evalCatchingErrors(self->expr, self->frame, &error);
+  if (error != NULL && scheduler->error == NULL) {
+    scheduler->error = error;
+  }
+
+  if (self->previousLive == NULL) {
+    scheduler->live = self->nextLive;
+  }
+  else {
+    self->previousLive->nextLive = self->nextLive;
+  }
+  if (self->nextLive != NULL) {
+    self->nextLive->previousLive = self->previousLive;
+  }
+  scheduler->finished = self;
+  suspend(scheduler);
+}
+
+//(spawn expr)
+Value *evalSpawn(Value *args, Frame *frame) {
+  if (typeOf(args) != CONS_TYPE || typeOf(cdr(args)) != NULL_TYPE) {
+    evaluationError("spawn takes exactly one expression");
+  }
+  Scheduler *scheduler = currentScheduler();
+
+  Coroutine *coroutine = malloc(sizeof(Coroutine));
+  coroutine->stack = newStack(scheduler);
+  coroutine->expr = car(args);
+  coroutine->frame = frame;
+  coroutine->state = newEvalState();
+  getcontext(&coroutine->context);
+  coroutine->context.uc_stack.ss_sp = coroutine->stack + PAGE_SIZE;
+  coroutine->context.uc_stack.ss_size = STACK_RESERVE - PAGE_SIZE;
+  coroutine->context.uc_link = NULL;
+  makecontext(&coroutine->context, coroutineMain, 0);
+
+  coroutine->previousLive = NULL;
+  coroutine->nextLive = scheduler->live;
+  if (scheduler->live != NULL) {
+    scheduler->live->previousLive = coroutine;
+  }
+  scheduler->live = coroutine;
+  enqueue(&scheduler->ready, coroutine);
+  return makeValue(VOID_TYPE);
+}
+
+Value *primitiveYield(int argc, Value **argv) {
+  (void) argv;
+  if (argc != 0) {
+    evaluationError("yield takes no args");
+  }
+  Scheduler *scheduler = currentScheduler();
+  enqueue(&scheduler->ready, scheduler->running);
+  suspend(scheduler);
+  return makeValue(VOID_TYPE);
+}
+
+size_t walkChannel(void *queue, HeapWalk *walk) {
+  Channel *channel = queue;
+  //values from an earlier server request have been freed with it
+  int count = channel->requestCount == currentContext->requestCount ? channel->count : 0;
+  for (int i = 0; i < count; i++) {
+    heapReach(walk, channel->buffer[(channel->head + i) % channel->capacity], "channel");
+  }
+  return sizeof(Channel) + sizeof(Value *) * channel->capacity;
+}
+
+//(make-channel) or (make-channel size): a channel that holds up to size
+//values (1 by default) sent but not yet received
+Value *primitiveMakeChannel(int argc, Value **argv) {
+  if (argc > 1) {
+    evaluationError("wrong number of args in make-channel");
+  }
+  int capacity = DEFAULT_CHANNEL_SIZE;
+  if (argc == 1) {
+    if (typeOf(argv[0]) != INT_TYPE || argv[0]->i < 1) {
+      evaluationError("channel size in make-channel must be a positive integer");
+    }
+    capacity = argv[0]->i;
+  }
+
+  Channel *channel = talloc(sizeof(Channel));
+  channel->buffer = talloc(sizeof(Value *) * capacity);
+  channel->capacity = capacity;
+  channel->count = 0;
+  channel->head = 0;
+  channel->senders.head = channel->senders.tail = NULL;
+  channel->receivers.head = channel->receivers.tail = NULL;
+  channel->requestCount = currentContext->requestCount;
+
+  Value *result = makeValue(CHANNEL_TYPE);
+  result->p = channel;
+  return result;
+}
+
+// Lets the first coroutine waiting in queue, if any, run again.
+void wake(Scheduler *scheduler, Queue *queue) {
+  Coroutine *waiting = dequeue(queue);
+  if (waiting != NULL) {
+    enqueue(&scheduler->ready, waiting);
+  }
+}
+
+// The channel a value holds. One from a server's prelude outlives each
+// request, but the values sent during one are freed with it, so the next
+// request finds the channel empty.
+Channel *channelOf(Value *value) {
+  Channel *channel = value->p;
+  if (channel->requestCount != currentContext->requestCount) {
+    channel->count = 0;
+    channel->head = 0;
+    channel->requestCount = currentContext->requestCount;
+  }
+  return channel;
+}
+
+//(send channel value) waits until the channel has room
+Value *primitiveSend(int argc, Value **argv) {
+  if (argc != 2) {
+    evaluationError("wrong number of args in send");
+  }
+  if (typeOf(argv[0]) != CHANNEL_TYPE) {
+    evaluationError("wrong type arg in send");
+  }
+  Scheduler *scheduler = currentScheduler();
+  Channel *channel = channelOf(argv[0]);
+  while (channel->count == channel->capacity) {
+    enqueue(&channel->senders, scheduler->running);
+    suspend(scheduler);
+  }
+  channel->buffer[(channel->head + channel->count) % channel->capacity] = argv[1];
+  channel->count++;
+  wake(scheduler, &channel->receivers);
+  return makeValue(VOID_TYPE);
+}
+
+//(receive channel) waits until the channel has a value, and takes the
+//oldest
+Value *primitiveReceive(int argc, Value **argv) {
+  if (argc != 1) {
+    evaluationError("wrong number of args in receive");
+  }
+  if (typeOf(argv[0]) != CHANNEL_TYPE) {
+    evaluationError("wrong type arg in receive");
+  }
+  Scheduler *scheduler = currentScheduler();
+  Channel *channel = channelOf(argv[0]);
+  while (channel->count == 0) {
+    enqueue(&channel->receivers, scheduler->running);
+    suspend(scheduler);
+  }
+  Value *value = channel->buffer[channel->head];
+  channel->head = (channel->head + 1) % channel->capacity;
+  channel->count--;
+  wake(scheduler, &channel->senders);
+  return value;
+}
+
+void runCoroutines() {
+  Scheduler *scheduler = currentContext->coroutines;
+  if (scheduler == NULL) {
+    return;
+  }
+  while (scheduler->ready.head != NULL) {
+    enqueue(&scheduler->ready, &scheduler->program);
+    suspend(scheduler);
+  }
+}
+
+// If an error jumped straight out of a coroutine (texit does, when memory
+// runs out), the thread still has that coroutine's state, and the program
+// has to have its own back first.
+void stopCoroutines() {
+  Scheduler *scheduler = currentContext->coroutines;
+  if (scheduler == NULL) {
+    return;
+  }
+  if (scheduler->running != &scheduler->program) {
+    swapEvalState(&scheduler->program.state);
+    scheduler->running->state = scheduler->program.state;
+    scheduler->running = &scheduler->program;
+  }
+  if (scheduler->finished != NULL) {
+    freeCoroutine(scheduler, scheduler->finished);
+  }
+  unqueue(&scheduler->program);
+  while (scheduler->live != NULL) {
+    Coroutine *next = scheduler->live->nextLive;
+    freeCoroutine(scheduler, scheduler->live);
+    scheduler->live = next;
+  }
+  for (int i = 0; i < scheduler->spareCount; i++) {
+    munmap(scheduler->spares[i], STACK_RESERVE);
+  }
+  free(scheduler);
+  currentContext->coroutines = NULL;
+}
+
+void bindCoroutinePrimitives(Frame *frame) {
+  bind("yield", primitiveYield, frame);
+  bind("make-channel", primitiveMakeChannel, frame);
+  bind("send", primitiveSend, frame);
+  bind("receive", primitiveReceive, frame);
+}
@@ -0,0 +1,26 @@
+#include <stddef.h>
+#include "value.h"
+#include "heapdump.h"
+
+#ifndef _COROUTINE
+#define _COROUTINE
+
+// (spawn expr): start a coroutine that evaluates expr in frame, to run
+// whenever the running one yields or waits on a channel.
+Value *evalSpawn(Value *args, Frame *frame);
+
+// Bind yield, make-channel, send and receive in the given frame.
+void bindCoroutinePrimitives(Frame *frame);
+
+// Add the values waiting in a channel's buffer to a heap dump's walk, and
+// return the bytes the channel takes up.
+size_t walkChannel(void *channel, HeapWalk *walk);
+
+// Let the current context's coroutines run until none of them is ready,
+// each having finished or waiting on a channel.
+void runCoroutines();
+
+// Free the current context's coroutines, finished or not.
+void stopCoroutines();
+
+#endif
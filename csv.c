@@ -0,0 +1,261 @@
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "value.h"
+#include "linkedlist.h"
+#include "talloc.h"
+#include "interpreter.h"
+#include "vector.h"
+#include "port.h"
+#include "csv.h"
+
+// (read-csv name) or (read-csv name delimiter) reads a delimited file whose
+// first line names its columns, and returns an association list from each
+// name to a vector holding that column, so (cdr (assoc "price" table)) is
+// the price column. The delimiter is a one-character string; without one,
+// it's a tab for a file whose name ends in .tsv and a comma otherwise.
+//
+// The file is mapped into memory rather than read, and stays mapped as
+// long as the heap, since the columns of strings are slices of it. Lines
+// and fields are found with memchr. A first pass over the rows counts them
+// and settles each column's type: ints if every field is one, else doubles
+// if every field is a number, else strings. The second pass fills in
+// columns of exactly the right size, with the numbers unboxed. Nothing is
+// allocated per field, and a string only becomes a Value when it's used.
+//
+// A field may be wrapped in double quotes, which are left off its text and
+// let it contain the delimiter, though not a line break. A doubled quote
+// inside one doesn't end it, and is kept as it's written. Blank lines are
+// skipped, a carriage return before a newline is ignored, a short row's
+// missing fields are empty, and fields past the last column are dropped.
+
+typedef enum {
+  FIELD_INT, FIELD_DOUBLE, FIELD_STRING
+} FieldKind;
+
+// Longer than this, a field is taken to be a string.
+#define NUMBER_LENGTH 63
+
+typedef struct Scanner {
+  const char *next;
+  const char *end;
+  char delimiter;
+} Scanner;
+
+// Splits the next non-blank line into fields, storing up to capacity of
+// them and filling any of those the line is short of with empty ones.
+// Returns how many fields the line has, or -1 at the end of the file.
+int scanRow(Scanner *scanner, Slice *fields, int capacity) {
+  const char *line;
+  const char *lineEnd;
+  do {
+    if (scanner->next >= scanner->end) {
+      return -1;
+    }
+    line = scanner->next;
+    lineEnd = memchr(line, '\n', scanner->end - line);
+    if (lineEnd == NULL) {
+      lineEnd = scanner->end;
+    }
+    scanner->next = lineEnd + 1;
+    if (lineEnd > line && lineEnd[-1] == '\r') {
+      lineEnd--;
+    }
+  } while (lineEnd == line);
+
+  int count = 0;
+  const char *field = line;
+  while (field <= lineEnd) {
+    const char *text = field;
+    const char *textEnd;
+    if (field < lineEnd && *field == '"') {
+      text = field + 1;
+      textEnd = text;
+      while ((textEnd = memchr(textEnd, '"', lineEnd - textEnd)) != NULL
+             && textEnd + 1 < lineEnd && textEnd[1] == '"') {
+        textEnd += 2;
+      }
+      if (textEnd == NULL) {
+        textEnd = lineEnd;
+      }
+      field = textEnd;
+    }
+    const char *delimiter = memchr(field, scanner->delimiter, lineEnd - field);
+    if (text == field) {
+      textEnd = delimiter != NULL ? delimiter : lineEnd;
+    }
+    if (count < capacity) {
+      fields[count].text = text;
+      fields[count].length = textEnd - text;
+    }
+    count++;
+    field = delimiter != NULL ? delimiter + 1 : lineEnd + 1;
+  }
+  for (int i = count; i < capacity; i++) {
+    fields[i].text = line;
+    fields[i].length = 0;
+  }
+  return count;
+}
+
+bool isDigit(char c) {
+  return c >= '0' && c <= '9';
+}
+
+// The narrowest type that can hold a field: an int if it's all digits
+// after an optional sign, and few enough of them to fit; a double if
+// strtod takes all of it (and it's written out in decimal).
+FieldKind fieldKind(Slice field) {
+  if (field.length == 0 || field.length > NUMBER_LENGTH) {
+    return FIELD_STRING;
+  }
+  const char *c = field.text;
+  const char *end = field.text + field.length;
+  if (*c == '-' || *c == '+') {
+    c++;
+  }
+  int digits = 0;
+  while (c < end && isDigit(*c)) {
+    c++;
+    digits++;
+  }
+  if (c == end && digits > 0 && digits < 10) {
+    return FIELD_INT;
+  }
+
+  for (c = field.text; c < end; c++) {
+    if (!isDigit(*c) && !strchr("+-.eE", *c)) {
+      return FIELD_STRING;
+    }
+  }
+  char number[NUMBER_LENGTH + 1];
+  memcpy(number, field.text, field.length);
+  number[field.length] = '\0';
+  char *parsed;
+  strtod(number, &parsed);
+  return parsed == number + field.length ? FIELD_DOUBLE : FIELD_STRING;
+}
+
+int parseInt(Slice field) {
+  const char *c = field.text;
+  const char *end = field.text + field.length;
+  bool negative = *c == '-';
+  if (*c == '-' || *c == '+') {
+    c++;
+  }
+  int n = 0;
+  while (c < end) {
+    n = n * 10 + (*c - '0');
+    c++;
+  }
+  return negative ? -n : n;
+}
+
+double parseDouble(Slice field) {
+  char number[NUMBER_LENGTH + 1];
+  memcpy(number, field.text, field.length);
+  number[field.length] = '\0';
+  return strtod(number, NULL);
+}
+
+Value *primitiveReadCsv(int argc, Value **argv) {
+  if (argc < 1 || argc > 2) {
+    evaluationError("wrong number of args in read-csv");
+  }
+  if (typeOf(argv[0]) != STR_TYPE) {
+    evaluationError("wrong type arg in read-csv");
+  }
+  long nameLength;
+  char *name = stringText(argv[0], &nameLength);
+  char *path = talloc(nameLength + 1);
+  memcpy(path, name, nameLength);
+  path[nameLength] = '\0';
+
+  char delimiter = ',';
+  if (nameLength >= 4 && !strcmp(path + nameLength - 4, ".tsv")) {
+    delimiter = '\t';
+  }
+  if (argc == 2) {
+    if (typeOf(argv[1]) != STR_TYPE || strlen(argv[1]->s) != 3) {
+      evaluationError("delimiter in read-csv must be a one-character string");
+    }
+    delimiter = argv[1]->s[1];
+  }
+
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    evaluationError("can't open file in read-csv");
+  }
+  struct stat status;
+  fstat(fd, &status);
+  const char *text = NULL;
+  if (status.st_size > 0) {
+    text = tallocMap(fd, status.st_size);
+  }
+  close(fd);
+  if (status.st_size > 0 && text == NULL) {
+    evaluationError("can't map file in read-csv");
+  }
+
+  Scanner scanner = {text, text + status.st_size, delimiter};
+  Scanner header = scanner;
+  int columns = scanRow(&scanner, NULL, 0);
+  if (columns < 0) {
+    return makeNull();
+  }
+  Slice *names = talloc(sizeof(Slice) * columns);
+  scanRow(&header, names, columns);
+
+  Slice fields[columns];
+  FieldKind kinds[columns];
+  for (int j = 0; j < columns; j++) {
+    kinds[j] = FIELD_INT;
+  }
+  Scanner rows = scanner;
+  int rowCount = 0;
+  while (scanRow(&scanner, fields, columns) >= 0) {
+    for (int j = 0; j < columns; j++) {
+      if (kinds[j] != FIELD_STRING) {
+        FieldKind kind = fieldKind(fields[j]);
+        if (kind > kinds[j]) {
+          kinds[j] = kind;
+        }
+      }
+    }
+    rowCount++;
+  }
+
+  Vector *vectors[columns];
+  Value *table = makeNull();
+  for (int j = columns - 1; j >= 0; j--) {
+    VectorKind kind = kinds[j] == FIELD_INT ? VECTOR_INTS
+      : kinds[j] == FIELD_DOUBLE ? VECTOR_DOUBLES : VECTOR_SLICES;
+    Value *column = makeVector(kind, rowCount);
+    vectors[j] = column->p;
+    table = cons(cons(makeString(names[j].text, names[j].length), column), table);
+  }
+  for (int i = 0; i < rowCount; i++) {
+    scanRow(&rows, fields, columns);
+    for (int j = 0; j < columns; j++) {
+      switch (vectors[j]->kind) {
+        case VECTOR_INTS:
+          vectors[j]->ints[i] = parseInt(fields[j]);
+          break;
+        case VECTOR_DOUBLES:
+          vectors[j]->doubles[i] = parseDouble(fields[j]);
+          break;
+        default:
+          vectors[j]->slices[i] = fields[j];
+          break;
+      }
+    }
+  }
+  return table;
+}
+
+void bindCsvPrimitives(Frame *frame) {
+  bind("read-csv", primitiveReadCsv, frame);
+}
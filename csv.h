@@ -0,0 +1,9 @@
+#include "value.h"
+
+#ifndef _CSV
+#define _CSV
+
+// Bind read-csv in the given frame.
+void bindCsvPrimitives(Frame *frame);
+
+#endif
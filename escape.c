@@ -0,0 +1,69 @@
+#include <stdbool.h>
+#include <string.h>
+#include "value.h"
+#include "linkedlist.h"
+#include "escape.h"
+
+// A frame can only outlive the let or call that created it if something
+// keeps a pointer to it, and the only thing that does is a closure made by a
+// lambda evaluated somewhere inside (a nested frame's parent pointer doesn't
+// count, since a nested frame that escapes has a lambda in it too). So a
+// let, let*, letrec or lambda whose body contains no lambda at all gets
+// NO_ESCAPE on its head symbol, and its frame goes in the frame region. A
+// future or spawn keeps its frame to evaluate in later, so it counts as
+// capturing too.
+
+bool isForm(Value *expr, char *name) {
+  return typeOf(expr) == CONS_TYPE && typeOf(car(expr)) == SYMBOL_TYPE
+    && !strcmp(car(expr)->s, name);
+}
+
+// Walks expr, marking the forms inside it, and returns whether it contains
+// anything that captures the frame it is evaluated in.
+bool markEscapes(Value *expr) {
+  if (typeOf(expr) != CONS_TYPE) {
+    return false;
+  }
+  if (isForm(expr, "quote")) {
+    return false;
+  }
+
+  bool captures = false;
+  Value *curVal = expr;
+  while (typeOf(curVal) == CONS_TYPE) {
+    if (markEscapes(car(curVal))) {
+      captures = true;
+    }
+    curVal = cdr(curVal);
+  }
+
+  if (isForm(expr, "lambda")) {
+    //the closure captures the enclosing frame no matter what; the frame for
+    //its own body is safe if nothing inside captured anything
+    if (!captures) {
+      car(expr)->flags |= NO_ESCAPE;
+    }
+    return true;
+  }
+  if (isForm(expr, "future") || isForm(expr, "spawn")) {
+    return true;
+  }
+
+  //let* and letrec evaluate their initializers inside the new frames; let
+  //evaluates them outside, so a lambda there couldn't see the let frame, but
+  //one conservative rule for all three keeps this simple
+  if (!captures && (isForm(expr, "let") || isForm(expr, "let*") || isForm(expr, "letrec"))) {
+    car(expr)->flags |= NO_ESCAPE;
+  }
+  return captures;
+}
+
+// Marks every let, let*, letrec and lambda in the program whose frame can't
+// escape.
+void analyzeEscapes(Value *tree) {
+  Value *curExpr = tree;
+  while (typeOf(curExpr) != NULL_TYPE) {
+    markEscapes(car(curExpr));
+    curExpr = cdr(curExpr);
+  }
+}
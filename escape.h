@@ -0,0 +1,14 @@
+#include <stdbool.h>
+#include "value.h"
+
+#ifndef _ESCAPE
+#define _ESCAPE
+
+// Marks every let, let*, letrec and lambda in the parse tree whose frame
+// can't outlive it, by setting NO_ESCAPE on its head symbol.
+void analyzeEscapes(Value *tree);
+
+// Whether expr is a list whose first element is the symbol name.
+bool isForm(Value *expr, char *name);
+
+#endif
@@ -0,0 +1,573 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include "value.h"
+#include "linkedlist.h"
+#include "talloc.h"
+#include "interpreter.h"
+#include "escape.h"
+#include "context.h"
+#include "port.h"
+#include "expand.h"
+
+// The expansion phase, run once over each top-level form in turn before the
+// optimizer and the analyses see the program.
+//
+// A top-level (define-syntax name (syntax-rules (literal ...) (pattern
+// template) ...)) adds a macro to the context, for the forms after it; in
+// server mode, a request's macros last only as long as the request. A form
+// whose head is a macro's name, and isn't a local variable there, is
+// rewritten by the first rule whose pattern matches it, and the result is
+// expanded again. Patterns and templates follow syntax-rules: _ matches
+// anything, a literal matches itself, any other symbol is a pattern
+// variable, and x ... matches or repeats x zero or more times. Macros
+// aren't hygienic: a template's symbols mean whatever they mean where the
+// macro is used. A use no rule matches becomes (syntax-error "message"),
+// so the error is reported when, and only if, it would have been evaluated.
+//
+// let* becomes nested lets. let, letrec and lambda are checked here, once,
+// for the syntax errors and repeated names the evaluator would otherwise
+// look for each time it evaluates them, and the ones that pass are marked
+// CHECKED. A malformed form is left as it is, for the evaluator to report
+// when it reaches it. cond, and and or stay as they are, since their tests
+// may be any value, where if needs a boolean.
+
+// How many expansions a macro use may go through before it's taken to be
+// expanding forever.
+#define EXPANSION_LIMIT 1000
+
+typedef struct Scope {
+  char *name;
+  struct Scope *next;
+} Scope;
+
+// What a pattern variable matched. At depth 0 that's a form; at depth n
+// it's a list of what it matched each time round the ellipsis it's
+// innermost in, each of depth n - 1.
+typedef struct Match {
+  char *name;
+  int depth;
+  Value *value;
+  struct Match *next;
+} Match;
+
+Value *expandForm(Value *expr, Scope *scope, int depth);
+
+bool isEllipsis(Value *value) {
+  return typeOf(value) == SYMBOL_TYPE && !strcmp(value->s, "...");
+}
+
+Value *symbolNamed(char *name) {
+  Value *symbol = makeValue(SYMBOL_TYPE);
+  symbol->s = name;
+  return symbol;
+}
+
+// (syntax-error "message"), where the message names the macro.
+Value *macroError(char *format, char *name) {
+  int size = strlen(format) + strlen(name) + 3;
+  char *message = talloc(size);
+  message[0] = '"';
+  snprintf(message + 1, size - 1, format, name);
+  strcat(message, "\"");
+  Value *text = makeValue(STR_TYPE);
+  text->s = message;
+  return cons(symbolNamed("syntax-error"), cons(text, makeNull()));
+}
+
+// A fresh copy of a form, so that no two places in the program share
+// structure, or the annotations later passes leave on it.
+Value *copyForm(Value *expr) {
+  if (typeOf(expr) == CONS_TYPE) {
+    return cons(copyForm(car(expr)), copyForm(cdr(expr)));
+  }
+  if (typeOf(expr) == NULL_TYPE) {
+    return makeNull();
+  }
+  Value *copy = makeValue(typeOf(expr));
+  *copy = *expr;
+  return copy;
+}
+
+Scope *pushName(Scope *scope, char *name) {
+  Scope *inner = talloc(sizeof(Scope));
+  inner->name = name;
+  inner->next = scope;
+  return inner;
+}
+
+bool isBound(Scope *scope, char *name) {
+  for (; scope != NULL; scope = scope->next) {
+    if (!strcmp(scope->name, name)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// The (syntax-rules ...) form of the macro a form's head names, if any.
+Value *findMacro(Value *head, Scope *scope) {
+  if (typeOf(head) != SYMBOL_TYPE || isBound(scope, head->s)) {
+    return NULL;
+  }
+  for (Value *macro = currentContext->macros; typeOf(macro) != NULL_TYPE; macro = cdr(macro)) {
+    if (!strcmp(car(car(macro))->s, head->s)) {
+      return cdr(car(macro));
+    }
+  }
+  return NULL;
+}
+
+// A list in reverse order, sharing its elements; reverse() copies them,
+// and can't copy a pair.
+Value *reverseForms(Value *list) {
+  Value *result = makeNull();
+  for (; typeOf(list) == CONS_TYPE; list = cdr(list)) {
+    result = cons(car(list), result);
+  }
+  return result;
+}
+
+int countPairs(Value *list) {
+  int count = 0;
+  for (; typeOf(list) == CONS_TYPE; list = cdr(list)) {
+    count++;
+  }
+  return count;
+}
+
+bool isLiteral(Value *literals, char *name) {
+  for (; typeOf(literals) == CONS_TYPE; literals = cdr(literals)) {
+    if (!strcmp(car(literals)->s, name)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool sameDatum(Value *a, Value *b) {
+  if (typeOf(a) != typeOf(b)) {
+    return false;
+  }
+  switch (typeOf(a)) {
+    case INT_TYPE:
+    case BOOL_TYPE: {
+      return a->i == b->i;
+    }
+    case DOUBLE_TYPE: {
+      return a->d == b->d;
+    }
+    case STR_TYPE:
+    case SYMBOL_TYPE: {
+      return !strcmp(a->s, b->s);
+    }
+    default: {
+      return typeOf(a) == NULL_TYPE;
+    }
+  }
+}
+
+Match *addMatch(Match *matches, char *name, int depth, Value *value) {
+  Match *match = talloc(sizeof(Match));
+  match->name = name;
+  match->depth = depth;
+  match->value = value;
+  match->next = matches;
+  return match;
+}
+
+Match *findMatch(Match *matches, char *name) {
+  for (; matches != NULL; matches = matches->next) {
+    if (!strcmp(matches->name, name)) {
+      return matches;
+    }
+  }
+  return NULL;
+}
+
+// Adds the pattern variables in pattern to *variables, each with how many
+// ellipses inside pattern it is under.
+void patternVariables(Value *pattern, Value *literals, int depth, Match **variables) {
+  if (typeOf(pattern) == SYMBOL_TYPE) {
+    if (strcmp(pattern->s, "_") && !isEllipsis(pattern) && !isLiteral(literals, pattern->s)) {
+      *variables = addMatch(*variables, pattern->s, depth, makeNull());
+    }
+    return;
+  }
+  while (typeOf(pattern) == CONS_TYPE) {
+    bool repeated = typeOf(cdr(pattern)) == CONS_TYPE && isEllipsis(car(cdr(pattern)));
+    patternVariables(car(pattern), literals, depth + repeated, variables);
+    pattern = cdr(pattern);
+  }
+  if (typeOf(pattern) == SYMBOL_TYPE) {
+    patternVariables(pattern, literals, depth, variables);
+  }
+}
+
+// Matches form against pattern, adding what its variables matched to
+// *matches.
+bool match(Value *pattern, Value *form, Value *literals, Match **matches) {
+  switch (typeOf(pattern)) {
+    case SYMBOL_TYPE: {
+      if (!strcmp(pattern->s, "_")) {
+        return true;
+      }
+      if (isLiteral(literals, pattern->s)) {
+        return typeOf(form) == SYMBOL_TYPE && !strcmp(form->s, pattern->s);
+      }
+      *matches = addMatch(*matches, pattern->s, 0, form);
+      return true;
+    }
+    case CONS_TYPE: {
+      if (typeOf(cdr(pattern)) == CONS_TYPE && isEllipsis(car(cdr(pattern)))) {
+        //the repeated pattern takes as many forms as the patterns after it
+        //leave it
+        Value *item = car(pattern);
+        Value *after = cdr(cdr(pattern));
+        int repeats = countPairs(form) - countPairs(after);
+        if (repeats < 0) {
+          return false;
+        }
+        Match *variables = NULL;
+        patternVariables(item, literals, 0, &variables);
+        for (int i = 0; i < repeats; i++) {
+          Match *one = NULL;
+          if (!match(item, car(form), literals, &one)) {
+            return false;
+          }
+          for (Match *variable = variables; variable != NULL; variable = variable->next) {
+            variable->value = cons(findMatch(one, variable->name)->value, variable->value);
+          }
+          form = cdr(form);
+        }
+        for (Match *variable = variables; variable != NULL; variable = variable->next) {
+          *matches = addMatch(*matches, variable->name, variable->depth + 1,
+                              reverseForms(variable->value));
+        }
+        return match(after, form, literals, matches);
+      }
+      return typeOf(form) == CONS_TYPE && match(car(pattern), car(form), literals, matches)
+        && match(cdr(pattern), cdr(form), literals, matches);
+    }
+    default: {
+      return sameDatum(pattern, form);
+    }
+  }
+}
+
+// Adds to *repeated a copy of each variable in template that matched under
+// an ellipsis, once each.
+void repeatedVariables(Value *template, Match *matches, Match **repeated) {
+  if (typeOf(template) == SYMBOL_TYPE) {
+    Match *found = findMatch(matches, template->s);
+    if (found != NULL && found->depth > 0 && findMatch(*repeated, template->s) == NULL) {
+      *repeated = addMatch(*repeated, found->name, found->depth, found->value);
+    }
+    return;
+  }
+  for (; typeOf(template) == CONS_TYPE; template = cdr(template)) {
+    repeatedVariables(car(template), matches, repeated);
+  }
+}
+
+// Fills in a template with what the pattern variables matched. Sets *error
+// (a format for the macro's name) if the template doesn't fit the matches.
+Value *instantiate(Value *template, Match *matches, char **error) {
+  if (typeOf(template) == SYMBOL_TYPE) {
+    Match *found = findMatch(matches, template->s);
+    if (found == NULL) {
+      return copyForm(template);
+    }
+    if (found->depth > 0) {
+      *error = "a pattern variable of %s is used without its ellipsis";
+      return template;
+    }
+    return copyForm(found->value);
+  }
+  if (typeOf(template) != CONS_TYPE) {
+    return copyForm(template);
+  }
+  if (typeOf(cdr(template)) != CONS_TYPE || !isEllipsis(car(cdr(template)))) {
+    Value *first = instantiate(car(template), matches, error);
+    return cons(first, instantiate(cdr(template), matches, error));
+  }
+
+  //item ... repeats item once for each form its variables matched
+  Value *item = car(template);
+  Match *repeated = NULL;
+  repeatedVariables(item, matches, &repeated);
+  if (repeated == NULL) {
+    *error = "an ellipsis in a template of %s follows nothing that repeats";
+    return template;
+  }
+  int count = countPairs(repeated->value);
+  for (Match *variable = repeated; variable != NULL; variable = variable->next) {
+    if (countPairs(variable->value) != count) {
+      *error = "variables under one ellipsis in %s matched different numbers of forms";
+      return template;
+    }
+  }
+
+  Value *items = makeNull();
+  for (int i = 0; i < count; i++) {
+    Match *inner = matches;
+    for (Match *variable = repeated; variable != NULL; variable = variable->next) {
+      inner = addMatch(inner, variable->name, variable->depth - 1, car(variable->value));
+      variable->value = cdr(variable->value);
+    }
+    items = cons(instantiate(item, inner, error), items);
+  }
+  Value *result = instantiate(cdr(cdr(template)), matches, error);
+  for (Value *curVal = items; typeOf(curVal) != NULL_TYPE; curVal = cdr(curVal)) {
+    result = cons(car(curVal), result);
+  }
+  return result;
+}
+
+// Rewrites a use of a macro by the first rule whose pattern matches it. The
+// keyword in each pattern is ignored.
+Value *expandMacro(Value *form, Value *rules) {
+  char *name = car(form)->s;
+  Value *literals = car(cdr(rules));
+  for (Value *rule = cdr(cdr(rules)); typeOf(rule) != NULL_TYPE; rule = cdr(rule)) {
+    Match *matches = NULL;
+    if (match(cdr(car(car(rule))), cdr(form), literals, &matches)) {
+      char *error = NULL;
+      Value *result = instantiate(car(cdr(car(rule))), matches, &error);
+      return error != NULL ? macroError(error, name) : result;
+    }
+  }
+  return macroError("no syntax-rules pattern matches this use of %s", name);
+}
+
+// Whether spec is (syntax-rules (literal ...) (pattern template) ...), with
+// every pattern a list.
+bool wellFormedRules(Value *spec) {
+  if (!isForm(spec, "syntax-rules") || typeOf(cdr(spec)) != CONS_TYPE) {
+    return false;
+  }
+  Value *literals = car(cdr(spec));
+  for (; typeOf(literals) == CONS_TYPE; literals = cdr(literals)) {
+    if (typeOf(car(literals)) != SYMBOL_TYPE) {
+      return false;
+    }
+  }
+  if (typeOf(literals) != NULL_TYPE) {
+    return false;
+  }
+  Value *rule = cdr(cdr(spec));
+  for (; typeOf(rule) == CONS_TYPE; rule = cdr(rule)) {
+    if (countPairs(car(rule)) != 2 || typeOf(cdr(cdr(car(rule)))) != NULL_TYPE
+        || typeOf(car(car(rule))) != CONS_TYPE) {
+      return false;
+    }
+  }
+  return typeOf(rule) == NULL_TYPE;
+}
+
+// Adds a top-level define-syntax's macro to the context. Returns NULL, or
+// the form to put in its place if it's malformed.
+Value *defineSyntax(Value *form) {
+  Value *args = cdr(form);
+  if (countPairs(args) != 2 || typeOf(cdr(cdr(args))) != NULL_TYPE
+      || typeOf(car(args)) != SYMBOL_TYPE) {
+    return macroError("bad define-syntax%s", "");
+  }
+  if (!wellFormedRules(car(cdr(args)))) {
+    return macroError("bad syntax-rules for %s", car(args)->s);
+  }
+  currentContext->macros = cons(cons(car(args), car(cdr(args))), currentContext->macros);
+  return NULL;
+}
+
+void expandEach(Value *list, Scope *scope, int depth) {
+  for (; typeOf(list) == CONS_TYPE; list = cdr(list)) {
+    setCar(list, expandForm(car(list), scope, depth));
+  }
+}
+
+// Whether name is one of the names pushed onto outer to make inner.
+bool boundSince(Scope *inner, Scope *outer, char *name) {
+  for (; inner != outer; inner = inner->next) {
+    if (!strcmp(inner->name, name)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Checks a lambda's parameters (symbols, none repeated, possibly ending in
+// a rest symbol) and that it has a single body, and expands the body.
+Value *expandLambda(Value *expr, Scope *scope, int depth) {
+  Value *args = cdr(expr);
+  if (countPairs(args) != 2 || typeOf(cdr(cdr(args))) != NULL_TYPE) {
+    return expr;
+  }
+  Scope *inner = scope;
+  Value *param = car(args);
+  for (; typeOf(param) == CONS_TYPE; param = cdr(param)) {
+    if (typeOf(car(param)) != SYMBOL_TYPE || boundSince(inner, scope, car(param)->s)) {
+      return expr;
+    }
+    inner = pushName(inner, car(param)->s);
+  }
+  if (typeOf(param) == SYMBOL_TYPE) {
+    if (boundSince(inner, scope, param->s)) {
+      return expr;
+    }
+    inner = pushName(inner, param->s);
+  }
+  else if (typeOf(param) != NULL_TYPE) {
+    return expr;
+  }
+  expandEach(cdr(args), inner, depth);
+  car(expr)->flags |= CHECKED;
+  return expr;
+}
+
+// Whether a let's bindings are a proper list of (symbol init), with no
+// name repeated unless repeats are allowed, and its body isn't empty.
+bool wellFormedBindings(Value *args, bool repeatsAllowed) {
+  if (typeOf(args) != CONS_TYPE || typeOf(cdr(args)) != CONS_TYPE) {
+    return false;
+  }
+  Value *body = cdr(args);
+  while (typeOf(body) == CONS_TYPE) {
+    body = cdr(body);
+  }
+  if (typeOf(body) != NULL_TYPE) {
+    return false;
+  }
+  Value *binding = car(args);
+  for (; typeOf(binding) == CONS_TYPE; binding = cdr(binding)) {
+    Value *pair = car(binding);
+    if (countPairs(pair) != 2 || typeOf(cdr(cdr(pair))) != NULL_TYPE
+        || typeOf(car(pair)) != SYMBOL_TYPE) {
+      return false;
+    }
+    for (Value *later = cdr(binding); !repeatsAllowed && typeOf(later) == CONS_TYPE;
+         later = cdr(later)) {
+      if (typeOf(car(later)) == CONS_TYPE && typeOf(car(car(later))) == SYMBOL_TYPE
+          && !strcmp(car(car(later))->s, car(pair)->s)) {
+        return false;
+      }
+    }
+  }
+  return typeOf(binding) == NULL_TYPE;
+}
+
+// Checks and expands a let or letrec, whose initializers see its own names
+// if it's a letrec.
+Value *expandLet(Value *expr, Scope *scope, int depth, bool recursive) {
+  Value *args = cdr(expr);
+  if (!wellFormedBindings(args, false)) {
+    return expr;
+  }
+  Scope *inner = scope;
+  for (Value *binding = car(args); typeOf(binding) != NULL_TYPE; binding = cdr(binding)) {
+    inner = pushName(inner, car(car(binding))->s);
+  }
+  for (Value *binding = car(args); typeOf(binding) != NULL_TYPE; binding = cdr(binding)) {
+    expandEach(cdr(car(binding)), recursive ? inner : scope, depth);
+  }
+  expandEach(cdr(args), inner, depth);
+  car(expr)->flags |= CHECKED;
+  return expr;
+}
+
+// (let* (b1 b2 ...) body ...) is (let (b1) (let (b2) ... body ...)), and
+// with no bindings, (let () body ...).
+Value *expandLetStar(Value *expr, Scope *scope, int depth) {
+  Value *args = cdr(expr);
+  if (!wellFormedBindings(args, true)) {
+    return expr;
+  }
+  Value *bindings = reverseForms(car(args));
+  Value *result = cons(symbolNamed("let"), cons(makeNull(), cdr(args)));
+  if (typeOf(bindings) != NULL_TYPE) {
+    setCar(cdr(result), cons(car(bindings), makeNull()));
+    bindings = cdr(bindings);
+  }
+  for (; typeOf(bindings) != NULL_TYPE; bindings = cdr(bindings)) {
+    Value *body = cons(result, makeNull());
+    result = cons(symbolNamed("let"), cons(cons(car(bindings), makeNull()), body));
+  }
+  return expandForm(result, scope, depth);
+}
+
+Value *expandForm(Value *expr, Scope *scope, int depth) {
+  if (typeOf(expr) != CONS_TYPE) {
+    return expr;
+  }
+  Value *rules = findMacro(car(expr), scope);
+  if (rules != NULL) {
+    if (depth >= EXPANSION_LIMIT) {
+      return macroError("%s expands without end", car(expr)->s);
+    }
+    return expandForm(expandMacro(expr, rules), scope, depth + 1);
+  }
+
+  if (isForm(expr, "quote")) {
+    return expr;
+  }
+  if (isForm(expr, "define-syntax")) {
+    return macroError("define-syntax%s is only allowed at top level", "");
+  }
+  if (isForm(expr, "lambda")) {
+    return expandLambda(expr, scope, depth);
+  }
+  if (isForm(expr, "let") || isForm(expr, "letrec")) {
+    return expandLet(expr, scope, depth, isForm(expr, "letrec"));
+  }
+  if (isForm(expr, "let*")) {
+    return expandLetStar(expr, scope, depth);
+  }
+  if (isForm(expr, "cond")) {
+    for (Value *clause = cdr(expr); typeOf(clause) == CONS_TYPE; clause = cdr(clause)) {
+      expandEach(car(clause), scope, depth);
+    }
+    return expr;
+  }
+  if (isForm(expr, "define") || isForm(expr, "set!")) {
+    expandEach(cdr(cdr(expr)), scope, depth);
+    return expr;
+  }
+  expandEach(expr, scope, depth);
+  return expr;
+}
+
+Value *expand(Value *tree) {
+  Value *result = makeNull();
+  for (Value *curExpr = tree; typeOf(curExpr) != NULL_TYPE; curExpr = cdr(curExpr)) {
+    Value *form = car(curExpr);
+    if (isForm(form, "define-syntax")) {
+      form = defineSyntax(form);
+      if (form == NULL) {
+        continue;
+      }
+    }
+    else {
+      form = expandForm(form, NULL, 0);
+    }
+    result = cons(form, result);
+  }
+  return reverseForms(result);
+}
+
+//(syntax-error message) reports a macro that couldn't be expanded
+Value *primitiveSyntaxError(int argc, Value **argv) {
+  if (argc != 1 || typeOf(argv[0]) != STR_TYPE) {
+    evaluationError("syntax error");
+  }
+  long length;
+  char *text = stringText(argv[0], &length);
+  char *message = talloc(length + 1);
+  memcpy(message, text, length);
+  message[length] = '\0';
+  evaluationError(message);
+  return NULL;
+}
+
+void bindExpandPrimitives(Frame *frame) {
+  bind("syntax-error", primitiveSyntaxError, frame);
+}
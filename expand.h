@@ -0,0 +1,17 @@
+#include "value.h"
+
+#ifndef _EXPAND
+#define _EXPAND
+
+// Expands a parsed program one top-level form at a time, before anything
+// else sees it: define-syntax records a syntax-rules macro for the forms
+// after it, uses of macros are rewritten, let* becomes nested lets, and the
+// let, letrec and lambda forms whose syntax checks out are marked CHECKED
+// so the evaluator doesn't check them again.
+Value *expand(Value *tree);
+
+// Bind syntax-error, which a use of a macro that couldn't be expanded is
+// replaced with, in the given frame.
+void bindExpandPrimitives(Frame *frame);
+
+#endif
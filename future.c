@@ -0,0 +1,330 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "value.h"
+#include "linkedlist.h"
+#include "talloc.h"
+#include "interpreter.h"
+#include "context.h"
+#include "future.h"
+#include "profile.h"
+#include "metrics.h"
+
+// (future expr) hands expr to a pool of worker threads and returns a
+// placeholder straight away; (touch f) waits for the placeholder's value.
+// Touching a future nobody has started yet just evaluates it right there, so
+// a thread never waits on work that is sitting in a queue, and touching
+// anything that isn't a future returns it unchanged.
+//
+// Each thread (the main one included) has its own deque of futures waiting
+// to run. A thread pushes the futures it makes onto the bottom of its own
+// deque and takes work back from the bottom, newest first, so it stays close
+// to what it was just doing; an idle worker steals from the top of someone
+// else's, where the oldest and usually biggest pieces of work are.
+//
+// An error while evaluating a future is kept with it and reported by touch,
+// as if the expression had been evaluated there. As with memoize, it's up to
+// the program that futures running at the same time don't define or set! the
+// same variables.
+
+typedef enum {
+  PENDING, RUNNING, DONE
+} FutureState;
+
+typedef struct Future {
+  Value *expr;
+  Frame *frame;
+  FutureState state;
+  Value *result;
+  char *error;
+  pthread_mutex_t lock;
+  pthread_cond_t finished;
+} Future;
+
+typedef struct Deque {
+  pthread_mutex_t lock;
+  Future **items;
+  int capacity;
+  // the oldest item, and one past the newest
+  int top;
+  int bottom;
+} Deque;
+
+typedef struct Worker {
+  pthread_t thread;
+  Context *context;
+  int deque;
+} Worker;
+
+// Each context has a pool of its own, so futures in one interpreter never
+// wait on another's.
+typedef struct FuturePool {
+  // deques[0] is the thread running the program's, and deques[i] worker i's
+  Deque *deques;
+  int dequeCount;
+  Worker *workers;
+  // Idle workers sleep on workAvailable until something is queued or the
+  // pool is stopping.
+  pthread_mutex_t idleLock;
+  pthread_cond_t workAvailable;
+  int queued;
+  bool stopping;
+} FuturePool;
+
+_Thread_local int ownDeque = 0;
+
+void pushBottom(Deque *deque, Future *future) {
+  pthread_mutex_lock(&deque->lock);
+  if (deque->bottom == deque->capacity) {
+    if (deque->top > 0) {
+      for (int i = deque->top; i < deque->bottom; i++) {
+        deque->items[i - deque->top] = deque->items[i];
+      }
+      deque->bottom -= deque->top;
+      deque->top = 0;
+    }
+    else {
+      deque->capacity *= 2;
+      deque->items = realloc(deque->items, sizeof(Future *) * deque->capacity);
+    }
+  }
+  deque->items[deque->bottom] = future;
+  deque->bottom++;
+  pthread_mutex_unlock(&deque->lock);
+}
+
+Future *popBottom(Deque *deque) {
+  Future *future = NULL;
+  pthread_mutex_lock(&deque->lock);
+  if (deque->bottom > deque->top) {
+    deque->bottom--;
+    future = deque->items[deque->bottom];
+  }
+  pthread_mutex_unlock(&deque->lock);
+  return future;
+}
+
+Future *stealTop(Deque *deque) {
+  Future *future = NULL;
+  pthread_mutex_lock(&deque->lock);
+  if (deque->bottom > deque->top) {
+    future = deque->items[deque->top];
+    deque->top++;
+  }
+  pthread_mutex_unlock(&deque->lock);
+  return future;
+}
+
+// The next future for this thread to run: its own newest, or else the oldest
+// from the first other deque that has any.
+Future *findWork(FuturePool *pool) {
+  Future *future = popBottom(&pool->deques[ownDeque]);
+  for (int i = 1; future == NULL && i < pool->dequeCount; i++) {
+    future = stealTop(&pool->deques[(ownDeque + i) % pool->dequeCount]);
+  }
+  if (future != NULL) {
+    pthread_mutex_lock(&pool->idleLock);
+    pool->queued--;
+    pthread_mutex_unlock(&pool->idleLock);
+  }
+  return future;
+}
+
+// Evaluates a future the caller has claimed, and wakes whoever is waiting.
+void runFuture(Future *future) {
+  char *error;
+  Value *result = evalCatchingErrors(future->expr, future->frame, &error);
+
+  pthread_mutex_lock(&future->lock);
+  future->result = result;
+  future->error = error;
+  future->state = DONE;
+  pthread_cond_broadcast(&future->finished);
+  pthread_mutex_unlock(&future->lock);
+}
+
+size_t walkFuture(void *placeholder, HeapWalk *walk) {
+  Future *future = placeholder;
+  heapReach(walk, future->expr, "code");
+  heapReachFrame(walk, future->frame, NULL);
+  pthread_mutex_lock(&future->lock);
+  if (future->state == DONE) {
+    heapReach(walk, future->result, "future");
+  }
+  pthread_mutex_unlock(&future->lock);
+  return sizeof(Future);
+}
+
+// Takes a pending future for the calling thread to run; false if another
+// thread already has.
+bool claimFuture(Future *future) {
+  pthread_mutex_lock(&future->lock);
+  bool claimed = future->state == PENDING;
+  if (claimed) {
+    future->state = RUNNING;
+  }
+  pthread_mutex_unlock(&future->lock);
+  return claimed;
+}
+
+void *workerMain(void *start) {
+  Worker *worker = start;
+  useContext(worker->context);
+  ownDeque = worker->deque;
+  FuturePool *pool = worker->context->futures;
+  tallocSetSite(SITE_EVAL);
+  while (true) {
+    Future *future = findWork(pool);
+    if (future != NULL) {
+      //it may have been touched, and so run, while it was queued
+      if (claimFuture(future)) {
+        runFuture(future);
+      }
+      continue;
+    }
+
+    pthread_mutex_lock(&pool->idleLock);
+    while (pool->queued == 0 && !pool->stopping) {
+      pthread_cond_wait(&pool->workAvailable, &pool->idleLock);
+    }
+    bool stop = pool->stopping;
+    pthread_mutex_unlock(&pool->idleLock);
+    if (stop) {
+      break;
+    }
+  }
+  flushEvalCount();
+  if (profiling) {
+    profileThreadExit();
+  }
+  if (metering) {
+    flushMetrics();
+  }
+  tallocThreadExit();
+  return NULL;
+}
+
+// Starts the current context's pool, with one worker per core besides the
+// one the program runs on, the first time a future is made.
+void startFutures() {
+  long cores = sysconf(_SC_NPROCESSORS_ONLN);
+  int workerCount = cores > 1 ? (int) cores - 1 : 1;
+  FuturePool *pool = malloc(sizeof(FuturePool));
+  pool->dequeCount = workerCount + 1;
+  pool->deques = malloc(sizeof(Deque) * pool->dequeCount);
+  for (int i = 0; i < pool->dequeCount; i++) {
+    pthread_mutex_init(&pool->deques[i].lock, NULL);
+    pool->deques[i].capacity = 64;
+    pool->deques[i].items = malloc(sizeof(Future *) * pool->deques[i].capacity);
+    pool->deques[i].top = 0;
+    pool->deques[i].bottom = 0;
+  }
+  pthread_mutex_init(&pool->idleLock, NULL);
+  pthread_cond_init(&pool->workAvailable, NULL);
+  pool->queued = 0;
+  pool->stopping = false;
+  currentContext->futures = pool;
+
+  tallocSetThreaded(true);
+  pool->workers = malloc(sizeof(Worker) * workerCount);
+  for (int i = 0; i < workerCount; i++) {
+    pool->workers[i].context = currentContext;
+    pool->workers[i].deque = i + 1;
+    pthread_create(&pool->workers[i].thread, NULL, workerMain, &pool->workers[i]);
+  }
+}
+
+void stopFutures() {
+  FuturePool *pool = currentContext->futures;
+  if (pool == NULL) {
+    return;
+  }
+  pthread_mutex_lock(&pool->idleLock);
+  pool->stopping = true;
+  pthread_cond_broadcast(&pool->workAvailable);
+  pthread_mutex_unlock(&pool->idleLock);
+
+  for (int i = 0; i < pool->dequeCount - 1; i++) {
+    pthread_join(pool->workers[i].thread, NULL);
+  }
+  tallocSetThreaded(false);
+
+  for (int i = 0; i < pool->dequeCount; i++) {
+    pthread_mutex_destroy(&pool->deques[i].lock);
+    free(pool->deques[i].items);
+  }
+  pthread_mutex_destroy(&pool->idleLock);
+  pthread_cond_destroy(&pool->workAvailable);
+  free(pool->deques);
+  free(pool->workers);
+  free(pool);
+  currentContext->futures = NULL;
+}
+
+bool isWorkerThread() {
+  return ownDeque != 0;
+}
+
+//(future expr)
+Value *evalFuture(Value *args, Frame *frame) {
+  if (typeOf(args) != CONS_TYPE || typeOf(cdr(args)) != NULL_TYPE) {
+    evaluationError("future takes exactly one expression");
+  }
+  if (currentContext->futures == NULL) {
+    startFutures();
+  }
+  FuturePool *pool = currentContext->futures;
+
+  Future *future = talloc(sizeof(Future));
+  future->expr = car(args);
+  future->frame = frame;
+  future->state = PENDING;
+  future->result = NULL;
+  future->error = NULL;
+  pthread_mutex_init(&future->lock, NULL);
+  pthread_cond_init(&future->finished, NULL);
+
+  pushBottom(&pool->deques[ownDeque], future);
+  pthread_mutex_lock(&pool->idleLock);
+  pool->queued++;
+  pthread_cond_signal(&pool->workAvailable);
+  pthread_mutex_unlock(&pool->idleLock);
+
+  Value *placeholder = makeValue(FUTURE_TYPE);
+  placeholder->p = future;
+  return placeholder;
+}
+
+//(touch f) returns the value of future f, waiting for it if it's running
+//elsewhere and evaluating it here if it hasn't started
+Value *primitiveTouch(int argc, Value **argv) {
+  if (argc != 1) {
+    evaluationError("wrong number of args in touch");
+  }
+  if (typeOf(argv[0]) != FUTURE_TYPE) {
+    return argv[0];
+  }
+
+  Future *future = argv[0]->p;
+  if (claimFuture(future)) {
+    runFuture(future);
+  }
+  else {
+    pthread_mutex_lock(&future->lock);
+    while (future->state != DONE) {
+      pthread_cond_wait(&future->finished, &future->lock);
+    }
+    pthread_mutex_unlock(&future->lock);
+  }
+
+  if (future->error != NULL) {
+    evaluationError(future->error);
+  }
+  return future->result;
+}
+
+void bindFuturePrimitives(Frame *frame) {
+  bind("touch", primitiveTouch, frame);
+}
@@ -0,0 +1,28 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include "value.h"
+#include "heapdump.h"
+
+#ifndef _FUTURE
+#define _FUTURE
+
+// (future expr): queue expr to be evaluated on the worker pool in frame, and
+// return a placeholder for its value.
+Value *evalFuture(Value *args, Frame *frame);
+
+// Bind touch in the given frame.
+void bindFuturePrimitives(Frame *frame);
+
+// Add a future's expression and frame, and its value once it has one, to
+// a heap dump's walk, and return the bytes it takes up.
+size_t walkFuture(void *future, HeapWalk *walk);
+
+// Whether the calling thread is one of the worker pool's, rather than the
+// one running the program.
+bool isWorkerThread();
+
+// Wait for the current context's workers to finish whatever is queued, and
+// stop them.
+void stopFutures();
+
+#endif
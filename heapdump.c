@@ -0,0 +1,418 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include "value.h"
+#include "talloc.h"
+#include "interpreter.h"
+#include "context.h"
+#include "memo.h"
+#include "future.h"
+#include "coroutine.h"
+#include "port.h"
+#include "vector.h"
+#include "pmap.h"
+#include "heapdump.h"
+
+// A heap dump walks breadth first from every global binding (a primitive's
+// excepted) through everything a value can reach: the elements of lists,
+// vectors and maps, a closure's code and the frames it closes over, with
+// the bindings in each, and so on. Each object is counted once, for the
+// first binding it's reached from, so an object several bindings share is
+// charged to the one nearest it, or the newest of those. What only the
+// call in progress can reach, such as its arguments, isn't counted.
+//
+// Each object also has a path: the binding it was reached from, then the
+// name of each frame binding and the kind of each container passed through
+// on the way to it, with repeats run together, so every element and cell
+// of a list in a closure's variable xs is on counter;xs;list. The paths
+// that hold the most bytes are the top retention paths.
+//
+// The walk's own tables are malloced, so dumping doesn't change the heap
+// it's looking at. The report is plain text, one record per line, sorted,
+// and without addresses, so dumps of two runs of a program can be diffed.
+// Sizes are what the values, pairs and frames take up, plus the strings,
+// arrays and nodes hanging off them; a vector read by read-csv doesn't
+// count the file it's mapped from.
+
+// The longest a path gets; anything reached beyond that shares the path
+// of what it was reached from.
+#define MAX_PATH_DEPTH 8
+#define TOP_COUNT 20
+
+// Frames are counted as one more type after the value types.
+#define FRAME_KIND VALUE_TYPE_COUNT
+
+typedef struct Reached {
+  void *object;
+  bool isFrame;
+  int path;
+  int root;
+} Reached;
+
+typedef struct Path {
+  int parent;
+  char *label;
+  int depth;
+  long count;
+  long bytes;
+} Path;
+
+typedef struct Root {
+  char *name;
+  long count;
+  long bytes;
+} Root;
+
+struct HeapWalk {
+  Context *context;
+  // every object reached so far, open addressed
+  void **seen;
+  long seenCapacity;
+  long seenCount;
+  // reached objects, the first next of them already walked
+  Reached *queue;
+  long queueLength;
+  long queueCapacity;
+  long next;
+  Path *paths;
+  int pathCount;
+  int pathCapacity;
+  // indices into paths plus one, open addressed by parent and label
+  int *pathIndex;
+  int pathIndexCapacity;
+  Root *roots;
+  int rootCount;
+  int rootCapacity;
+  long counts[FRAME_KIND + 1];
+  long bytes[FRAME_KIND + 1];
+  // the object being walked, which what heapReach adds is reached from
+  Reached current;
+};
+
+unsigned long pointerHash(void *pointer) {
+  return ((unsigned long) pointer >> 4) * 0x9E3779B97F4A7C15UL;
+}
+
+// Whether object has been reached before; if not, it is now.
+bool alreadySeen(HeapWalk *walk, void *object) {
+  if (walk->seenCount * 2 >= walk->seenCapacity) {
+    void **old = walk->seen;
+    long oldCapacity = walk->seenCapacity;
+    walk->seenCapacity = oldCapacity == 0 ? 4096 : oldCapacity * 2;
+    walk->seen = calloc(walk->seenCapacity, sizeof(void *));
+    for (long i = 0; i < oldCapacity; i++) {
+      if (old[i] != NULL) {
+        long j = pointerHash(old[i]) & (walk->seenCapacity - 1);
+        while (walk->seen[j] != NULL) {
+          j = (j + 1) & (walk->seenCapacity - 1);
+        }
+        walk->seen[j] = old[i];
+      }
+    }
+    free(old);
+  }
+  long i = pointerHash(object) & (walk->seenCapacity - 1);
+  while (walk->seen[i] != NULL) {
+    if (walk->seen[i] == object) {
+      return true;
+    }
+    i = (i + 1) & (walk->seenCapacity - 1);
+  }
+  walk->seen[i] = object;
+  walk->seenCount++;
+  return false;
+}
+
+unsigned long pathHash(int parent, char *label) {
+  unsigned long hash = 14695981039346656037UL ^ (unsigned long) (parent + 1);
+  for (char *c = label; *c != '\0'; c++) {
+    hash = (hash ^ (unsigned char) *c) * 1099511628211UL;
+  }
+  return hash;
+}
+
+int newPath(HeapWalk *walk, int parent, char *label) {
+  if (walk->pathCount == walk->pathCapacity) {
+    walk->pathCapacity = walk->pathCapacity == 0 ? 256 : walk->pathCapacity * 2;
+    walk->paths = realloc(walk->paths, sizeof(Path) * walk->pathCapacity);
+  }
+  Path *path = &walk->paths[walk->pathCount];
+  path->parent = parent;
+  path->label = label;
+  path->depth = parent < 0 ? 1 : walk->paths[parent].depth + 1;
+  path->count = 0;
+  path->bytes = 0;
+  return walk->pathCount++;
+}
+
+// The path of something reached by an edge called label from something on
+// path parent (-1 for a binding's own).
+int extendPath(HeapWalk *walk, int parent, char *label) {
+  if (label == NULL) {
+    return parent;
+  }
+  if (parent >= 0 && (walk->paths[parent].depth >= MAX_PATH_DEPTH
+                      || !strcmp(walk->paths[parent].label, label))) {
+    return parent;
+  }
+  if (walk->pathCount * 2 >= walk->pathIndexCapacity) {
+    free(walk->pathIndex);
+    walk->pathIndexCapacity = walk->pathIndexCapacity == 0 ? 512 : walk->pathIndexCapacity * 2;
+    walk->pathIndex = calloc(walk->pathIndexCapacity, sizeof(int));
+    for (int p = 0; p < walk->pathCount; p++) {
+      long i = pathHash(walk->paths[p].parent, walk->paths[p].label) & (walk->pathIndexCapacity - 1);
+      while (walk->pathIndex[i] != 0) {
+        i = (i + 1) & (walk->pathIndexCapacity - 1);
+      }
+      walk->pathIndex[i] = p + 1;
+    }
+  }
+  long i = pathHash(parent, label) & (walk->pathIndexCapacity - 1);
+  while (walk->pathIndex[i] != 0) {
+    Path *path = &walk->paths[walk->pathIndex[i] - 1];
+    if (path->parent == parent && !strcmp(path->label, label)) {
+      return walk->pathIndex[i] - 1;
+    }
+    i = (i + 1) & (walk->pathIndexCapacity - 1);
+  }
+  walk->pathIndex[i] = newPath(walk, parent, label) + 1;
+  return walk->pathIndex[i] - 1;
+}
+
+void addReached(HeapWalk *walk, void *object, bool isFrame, int path, int root) {
+  if (walk->queueLength == walk->queueCapacity) {
+    walk->queueCapacity = walk->queueCapacity == 0 ? 4096 : walk->queueCapacity * 2;
+    walk->queue = realloc(walk->queue, sizeof(Reached) * walk->queueCapacity);
+  }
+  Reached reached = {object, isFrame, path, root};
+  walk->queue[walk->queueLength++] = reached;
+}
+
+void heapReach(HeapWalk *walk, Value *value, char *label) {
+  if (value == NULL || alreadySeen(walk, value)) {
+    return;
+  }
+  int path = extendPath(walk, walk->current.path, label);
+  //a list's first pair is on the same path as the rest of it
+  if (typeOf(value) == CONS_TYPE) {
+    path = extendPath(walk, path, "list");
+  }
+  addReached(walk, value, false, path, walk->current.root);
+}
+
+void heapReachFrame(HeapWalk *walk, Frame *frame, char *label) {
+  //the frames the bindings are in are where the walk starts
+  if (frame == NULL || frame == walk->context->globalFrame || frame == walk->context->topFrame
+      || alreadySeen(walk, frame)) {
+    return;
+  }
+  addReached(walk, frame, true, extendPath(walk, walk->current.path, label), walk->current.root);
+}
+
+// Charges bytes, for one object of the given kind, to what's being walked.
+void charge(HeapWalk *walk, int kind, long bytes) {
+  walk->counts[kind]++;
+  walk->bytes[kind] += bytes;
+  walk->paths[walk->current.path].count++;
+  walk->paths[walk->current.path].bytes += bytes;
+  walk->roots[walk->current.root].count++;
+  walk->roots[walk->current.root].bytes += bytes;
+}
+
+// Adds what a value refers to to the walk, and returns how many bytes it
+// takes up.
+long walkValue(HeapWalk *walk, Value *value) {
+  switch (typeOf(value)) {
+    case CONS_TYPE: {
+      heapReach(walk, car(value), NULL);
+      heapReach(walk, cdr(value), NULL);
+      return sizeof(Pair);
+    }
+    case STR_TYPE:
+    case SYMBOL_TYPE: {
+      return sizeof(Value) + strlen(value->s) + 1;
+    }
+    case CLOSURE_TYPE: {
+      heapReach(walk, value->cl.paramNames, "code");
+      heapReach(walk, value->cl.functionCode, "code");
+      heapReachFrame(walk, value->cl.frame, NULL);
+      return sizeof(Value);
+    }
+    case MEMO_TYPE: {
+      return sizeof(Value) + walkMemo(value->p, walk);
+    }
+    case FUTURE_TYPE: {
+      return sizeof(Value) + walkFuture(value->p, walk);
+    }
+    case CHANNEL_TYPE: {
+      return sizeof(Value) + walkChannel(value->p, walk);
+    }
+    case PORT_TYPE: {
+      return sizeof(Value) + walkPort(value->p, walk);
+    }
+    case VECTOR_TYPE: {
+      return sizeof(Value) + walkVector(value->p, walk);
+    }
+    case PMAP_TYPE: {
+      return sizeof(Value) + walkPmap(value->p, walk);
+    }
+    default: {
+      return sizeof(Value);
+    }
+  }
+}
+
+// Adds the values bound in a frame, each reached by its name, and the
+// frame's parent, and returns the bytes of the frame and its bindings.
+long walkFrame(HeapWalk *walk, Frame *frame) {
+  long bytes = sizeof(Frame);
+  for (Value *binding = frame->bindings; typeOf(binding) == CONS_TYPE; binding = cdr(binding)) {
+    heapReach(walk, cdr(car(binding)), car(car(binding))->s);
+    bytes += 2 * sizeof(Pair);
+  }
+  heapReachFrame(walk, frame->parent, NULL);
+  return bytes;
+}
+
+void addRoots(HeapWalk *walk, Frame *frame) {
+  for (Value *binding = frame->bindings; typeOf(binding) == CONS_TYPE; binding = cdr(binding)) {
+    Value *value = cdr(car(binding));
+    if (typeOf(value) == PRIMITIVE_TYPE) {
+      continue;
+    }
+    if (walk->rootCount == walk->rootCapacity) {
+      walk->rootCapacity = walk->rootCapacity == 0 ? 64 : walk->rootCapacity * 2;
+      walk->roots = realloc(walk->roots, sizeof(Root) * walk->rootCapacity);
+    }
+    Root *root = &walk->roots[walk->rootCount];
+    root->name = car(car(binding))->s;
+    root->count = 0;
+    root->bytes = 0;
+    walk->current.path = extendPath(walk, -1, root->name);
+    walk->current.root = walk->rootCount++;
+    //the binding's own cells
+    charge(walk, FRAME_KIND, 2 * sizeof(Pair));
+    heapReach(walk, value, NULL);
+  }
+}
+
+void fprintPath(FILE *stream, Path *paths, int path) {
+  if (paths[path].parent >= 0) {
+    fprintPath(stream, paths, paths[path].parent);
+    fprintf(stream, ";");
+  }
+  fprintf(stream, "%s", paths[path].label);
+}
+
+// Most bytes first, then by name, so the order doesn't depend on where
+// anything is in memory.
+int compareRoots(const void *a, const void *b) {
+  const Root *x = a;
+  const Root *y = b;
+  if (x->bytes != y->bytes) {
+    return x->bytes < y->bytes ? 1 : -1;
+  }
+  return strcmp(x->name, y->name);
+}
+
+// Most bytes first, then in the order they were first reached.
+int comparePaths(const void *a, const void *b) {
+  const Path *x = *(Path * const *) a;
+  const Path *y = *(Path * const *) b;
+  if (x->bytes != y->bytes) {
+    return x->bytes < y->bytes ? 1 : -1;
+  }
+  return x < y ? -1 : x > y;
+}
+
+long heapDump(Context *context, FILE *stream) {
+  HeapWalk *walk = calloc(1, sizeof(HeapWalk));
+  walk->context = context;
+  Context *previous = currentContext;
+  useContext(context);
+
+  addRoots(walk, context->globalFrame);
+  if (context->topFrame != context->globalFrame) {
+    addRoots(walk, context->topFrame);
+  }
+  for (walk->next = 0; walk->next < walk->queueLength; walk->next++) {
+    walk->current = walk->queue[walk->next];
+    if (walk->current.isFrame) {
+      charge(walk, FRAME_KIND, walkFrame(walk, walk->current.object));
+    }
+    else {
+      Value *value = walk->current.object;
+      long bytes = walkValue(walk, value);
+      charge(walk, typeOf(value), bytes);
+    }
+  }
+
+  long objects = 0;
+  long total = 0;
+  for (int kind = 0; kind <= FRAME_KIND; kind++) {
+    objects += walk->counts[kind];
+    total += walk->bytes[kind];
+  }
+  fprintf(stream, "total %ld %ld\n", objects, total);
+  for (int kind = 0; kind <= FRAME_KIND; kind++) {
+    if (walk->counts[kind] > 0) {
+      fprintf(stream, "type %s %ld %ld\n", kind == FRAME_KIND ? "FRAME" : typeName(kind),
+              walk->counts[kind], walk->bytes[kind]);
+    }
+  }
+  qsort(walk->roots, walk->rootCount, sizeof(Root), compareRoots);
+  for (int i = 0; i < walk->rootCount; i++) {
+    fprintf(stream, "root %s %ld %ld\n", walk->roots[i].name, walk->roots[i].count,
+            walk->roots[i].bytes);
+  }
+  Path **sorted = malloc(sizeof(Path *) * (walk->pathCount + 1));
+  for (int p = 0; p < walk->pathCount; p++) {
+    sorted[p] = &walk->paths[p];
+  }
+  qsort(sorted, walk->pathCount, sizeof(Path *), comparePaths);
+  for (int i = 0; i < walk->pathCount && i < TOP_COUNT && sorted[i]->bytes > 0; i++) {
+    fprintf(stream, "path ");
+    fprintPath(stream, walk->paths, sorted[i] - walk->paths);
+    fprintf(stream, " %ld %ld\n", sorted[i]->count, sorted[i]->bytes);
+  }
+
+  useContext(previous);
+  free(sorted);
+  free(walk->seen);
+  free(walk->queue);
+  free(walk->paths);
+  free(walk->pathIndex);
+  free(walk->roots);
+  free(walk);
+  return total;
+}
+
+//(heap-dump "file") writes a heap dump to file, and returns the total bytes
+Value *primitiveHeapDump(int argc, Value **argv) {
+  if (argc != 1) {
+    evaluationError("wrong number of args in heap-dump");
+  }
+  if (typeOf(argv[0]) != STR_TYPE) {
+    evaluationError("wrong type arg in heap-dump");
+  }
+  long nameLength;
+  char *name = stringText(argv[0], &nameLength);
+  char *path = talloc(nameLength + 1);
+  memcpy(path, name, nameLength);
+  path[nameLength] = '\0';
+
+  FILE *stream = fopen(path, "w");
+  if (stream == NULL) {
+    evaluationError("can't open file in heap-dump");
+  }
+  long total = heapDump(currentContext, stream);
+  fclose(stream);
+  Value *result = makeValue(INT_TYPE);
+  result->i = total;
+  return result;
+}
+
+void bindHeapDumpPrimitives(Frame *frame) {
+  bind("heap-dump", primitiveHeapDump, frame);
+}
@@ -0,0 +1,31 @@
+#include <stdio.h>
+#include <stddef.h>
+#include "value.h"
+
+#ifndef _HEAPDUMP
+#define _HEAPDUMP
+
+struct Context;
+
+// A walk over everything reachable from a context's global bindings, in
+// progress.
+typedef struct HeapWalk HeapWalk;
+
+// Walk everything reachable from the context's global bindings (and, during
+// a server request, the request's own), and write what it found to stream:
+// how many objects and bytes there are of each type, how much each
+// binding holds on to, and the paths that hold on to the most. Returns the
+// total number of bytes.
+long heapDump(struct Context *context, FILE *stream);
+
+// For the walkers of the types whose contents are private to their own
+// files: add value, or frame, to the walk, as reached from the object
+// being walked by an edge called label. A NULL label leaves it on the same
+// path as that object.
+void heapReach(HeapWalk *walk, Value *value, char *label);
+void heapReachFrame(HeapWalk *walk, Frame *frame, char *label);
+
+// Bind heap-dump in the given frame.
+void bindHeapDumpPrimitives(Frame *frame);
+
+#endif
@@ -2,54 +2,160 @@
 #include <stdio.h>
 #include <stdbool.h>
 #include <string.h>
+#include <setjmp.h>
 #include "interpreter.h"
 #include "value.h"
 #include "linkedlist.h"
 #include "talloc.h"
 #include "parser.h"
 #include "tokenizer.h"
+#include "listlib.h"
+#include "escape.h"
+#include "types.h"
+#include "expand.h"
+#include "memo.h"
+#include "future.h"
+#include "coroutine.h"
+#include "port.h"
+#include "vector.h"
+#include "pmap.h"
+#include "heapdump.h"
+#include "csv.h"
+#include "profile.h"
+#include "metrics.h"
 
 void printEvaluatedExpr(Value *evaluatedExpr);
 Value *eval(Value *tree, Frame *frame);
 Value *evalDefine(Value *args, Frame *frame);
-Value *evalEach(Value *args, Frame *frame);
-Value *apply(Value *fcn, Value *args);
-Value *evalIf(Value *args, Frame *frame);
-Value *evalLet(Value *args, Frame *frame);
-Value *evalLetStar(Value *args, Frame *frame);
-Value *evalLetrec(Value *args, Frame *frame);
+void evalEach(Value *args, Frame *frame, Value **argv);
+Value *evalApplication(Value *first, Value *args, Frame *frame);
+Value *evalInlinedApplication(Value *operator, Value *args, Frame *frame);
+Value *evalLongApplication(Value *operator, int argc, Value *args, Frame *frame);
+bool isInlinedPrimitive(Value *(*function)(int, struct Value **));
+Value *inlineArithmetic(Value *(*function)(int, struct Value **), Value *left, Value *right);
+Value *evalArithmetic(Value *tree, Frame *frame);
+Value *evalOperand(Value *expr, Frame *frame, Value *scratch);
+Value *boxNumber(Value *number);
+bool isNumber(Value *operand, Value *scratch);
+Value *unshare(Value *value);
+Value *apply(Value *fcn, int argc, Value **argv);
+void bindArguments(Frame *newFrame, Value *formals, int argc, Value **argv, bool inRegion);
+Value *selectIfBranch(Value *args, Frame *frame);
+Value *evalLet(Value *args, Frame *frame, bool inRegion, bool checked);
+Value *evalLetStar(Value *args, Frame *frame, bool inRegion);
+Value *evalLetrec(Value *args, Frame *frame, bool inRegion, bool checked);
 Value *evalCond(Value *args, Frame *frame);
 Value *evalBegin(Value *args, Frame *frame);
 Value *evalSetBang(Value *args, Frame *frame);
-Value *evalLambda(Value *args, Frame *frame);
+Value *evalLambda(Value *args, Frame *frame, bool checked);
 Value *handleQuote(Value *args);
 Value *lookUpSymbol(Value *tree, Frame *frame);
-void bind(char *name, Value *(*function)(struct Value *), Frame *frame);
+Value *findBinding(Value *symbol, Frame *frame);
+void bind(char *name, Value *(*function)(int, struct Value **), Frame *frame);
 Value *or(Value *args, Frame *frame);
 Value *and(Value *args, Frame *frame);
-Value *primitiveMultiply(Value *args);
-Value *primitiveDivide(Value *args);
-Value *primitiveModulo(Value *args);
+Value *primitiveMultiply(int argc, Value **argv);
+Value *primitiveDivide(int argc, Value **argv);
+Value *primitiveModulo(int argc, Value **argv);
 bool isInteger(double num);
-Value *primitiveAdd(Value *args);
-Value *primitiveMinus(Value *args);
-Value *primitiveLessThan(Value *args);
-Value *primitiveGreaterThan(Value *args);
-Value *primitiveEquals(Value *args);
-Value *primitiveNull(Value *args);
-Value *primitiveCar(Value *args);
-Value *primitiveCdr(Value *args);
-Value *primitiveCons(Value *args);
+Value *primitiveAdd(int argc, Value **argv);
+Value *primitiveMinus(int argc, Value **argv);
+Value *primitiveLessThan(int argc, Value **argv);
+Value *primitiveGreaterThan(int argc, Value **argv);
+Value *primitiveEquals(int argc, Value **argv);
+Value *primitiveNull(int argc, Value **argv);
+Value *primitiveCar(int argc, Value **argv);
+Value *primitiveCdr(int argc, Value **argv);
+Value *primitiveCons(int argc, Value **argv);
 void printType(Value *v);
-void evaluationError();
+void evaluationError(char *errorMessage);
+Value *makeBool(bool b);
+Value *makeNumber(valueType type);
+Frame *makeFrame(Frame *parent, bool inRegion);
+void addBinding(Frame *frame, Value *name, Value *value, bool inRegion);
+
+Value *makeBool(bool b) {
+  return b ? currentContext->trueValue : currentContext->falseValue;
+}
 
-// Thin wrapper that calls eval for each top-level S-expression in the program. 
-void interpret(Value *tree) {
+//allocates the Value for an arithmetic result, which --alloc-stats counts
+//as a number. Its type may still change before it is returned
+Value *makeNumber(valueType type) {
+  if (!allocStats) {
+    return makeValue(type);
+  }
+  AllocSite outerSite = tallocSetSite(SITE_NUMBER);
+  Value *result = makeValue(type);
+  tallocSetSite(outerSite);
+  return result;
+}
 
-  Value *curExpr = tree;
+// Where evaluationError jumps to instead of exiting, while this thread is
+// inside evalCatchingErrors, and the message it leaves behind.
+_Thread_local jmp_buf *errorHandler = NULL;
+_Thread_local char *caughtError;
+
+// Steps (calls to eval) this thread may still take before it has to ask
+// the current context for more, and how many it was given then, so slice -
+// fuel is how many it has taken since. Taking one costs a decrement and a
+// branch; the step budget and the deadline are only looked at when a slice
+// runs out, by refuel.
+#define FUEL_SLICE 65536
+_Thread_local long fuel = 0;
+_Thread_local long slice = 0;
+
+_Static_assert(sizeof(Frame) <= sizeof(Pair), "frames are allocated as pairs in the frame region");
+
+//makes an empty frame for a let or a call. If the escape analysis proved the
+//frame can't outlive the form that creates it, it goes in the frame region,
+//and the caller releases it on the way out
+Frame *makeFrame(Frame *parent, bool inRegion) {
+  Frame *frame;
+  if (inRegion) {
+    frame = (Frame *) regionPair();
+  }
+  else {
+    AllocSite outerSite = tallocSetSite(SITE_FRAME);
+    frame = talloc(sizeof(Frame));
+    tallocSetSite(outerSite);
+  }
+  frame->parent = parent;
+  frame->bindings = currentContext->noBindings;
+  return frame;
+}
+
+//adds a binding to the front of a frame; a region frame's bindings live in
+//the region along with it
+void addBinding(Frame *frame, Value *name, Value *value, bool inRegion) {
+  if (inRegion) {
+    Pair *binding = regionPair();
+    binding->car = name;
+    binding->cdr = value;
+    Pair *link = regionPair();
+    link->car = (Value *) binding;
+    link->cdr = frame->bindings;
+    frame->bindings = (Value *) link;
+  }
+  else {
+    AllocSite outerSite = tallocSetSite(SITE_FRAME);
+    frame->bindings = cons(cons(name, value), frame->bindings);
+    tallocSetSite(outerSite);
+  }
+}
+
+// Sets up a new context's global frame, with the primitives bound in it.
+void makeGlobalEnvironment(Context *context) {
   Frame *frame = talloc(sizeof(Frame));
   frame->parent = NULL;
   frame->bindings = makeNull();
+  context->globalFrame = frame;
+  context->topFrame = frame;
+
+  context->noBindings = makeNull();
+  context->trueValue = makeValue(BOOL_TYPE);
+  context->trueValue->i = 1;
+  context->falseValue = makeValue(BOOL_TYPE);
+  context->falseValue->i = 0;
 
   bind("+", primitiveAdd, frame);
   bind("-", primitiveMinus, frame);
@@ -63,129 +169,406 @@ void interpret(Value *tree) {
   bind("car", primitiveCar, frame);
   bind("cdr", primitiveCdr, frame);
   bind("cons", primitiveCons, frame);
+  bindListPrimitives(frame);
+  bindMemoPrimitives(frame);
+  bindFuturePrimitives(frame);
+  bindCoroutinePrimitives(frame);
+  bindPortPrimitives(frame);
+  bindVectorPrimitives(frame);
+  bindPmapPrimitives(frame);
+  bindCsvPrimitives(frame);
+  bindExpandPrimitives(frame);
+  bindHeapDumpPrimitives(frame);
+}
+
+// Thin wrapper that calls eval for each top-level S-expression in the
+// program, in the current context's top-level frame.
+void interpret(Value *tree) {
 
-  while (curExpr->type != NULL_TYPE) {
+  Value *curExpr = tree;
+  Frame *frame = currentContext->topFrame;
+
+  analyzeEscapes(tree);
+  inferTypes(tree);
+
+  AllocSite outerSite = tallocSetSite(SITE_EVAL);
+  while (typeOf(curExpr) != NULL_TYPE) {
     Value *evaluatedExpr = eval(car(curExpr), frame);
     printEvaluatedExpr(evaluatedExpr);
     curExpr = cdr(curExpr);
   }
+  runCoroutines();
+  tallocSetSite(outerSite);
 }
 
 // Given an expression tree and a frame in which to evaluate that expression, eval returns the value of the expression.
 Value *eval(Value *tree, Frame *frame) {
-
-  switch (tree->type)  {
-    case INT_TYPE: {
-      return tree;
-    }
-    case DOUBLE_TYPE: {
-      return tree;
-    }
-    case STR_TYPE: {
-      return tree;
-    }
-    case BOOL_TYPE: {
-      return tree;
+  //an if goes round again with the branch it picked instead of calling
+  //eval on it, so a call in either branch is no deeper on the C stack
+  //than the if itself
+  while (true) {
+    if (--fuel < 0) {
+      refuel();
     }
-    case SYMBOL_TYPE: {
-      return lookUpSymbol(tree, frame);
-    }  
-    case CONS_TYPE: {
-      Value *first = car(tree);
-      Value *args = cdr(tree);
-
-      // Sanity and error checking on first...
 
-      if (first->type == SYMBOL_TYPE) {
-        if (!strcmp(first->s,"if")) {
-          return evalIf(args, frame);
+    switch (typeOf(tree))  {
+      case INT_TYPE: {
+        return tree;
+      }
+      case DOUBLE_TYPE: {
+        return tree;
+      }
+      case STR_TYPE: {
+        return tree;
+      }
+      case BOOL_TYPE: {
+        return tree;
+      }
+      case SYMBOL_TYPE: {
+        if (tree->flags & OWN_BOX) {
+          return unshare(lookUpSymbol(tree, frame));
         }
-
-        if (!strcmp(first->s,"let")) {
-          return evalLet(args,frame);
+        return lookUpSymbol(tree, frame);
+      }  
+      case CONS_TYPE: {
+        Value *first = car(tree);
+        Value *args = cdr(tree);
+        if (metering) {
+          meterForm(typeOf(first) == SYMBOL_TYPE ? first->s : NULL);
         }
 
-        if (!strcmp(first->s,"let*")) {
-          return evalLetStar(args,frame);
-        }
+        // Sanity and error checking on first...
 
-        if (!strcmp(first->s,"letrec")) {
-          return evalLetrec(args,frame);
-        }
+        if (typeOf(first) == SYMBOL_TYPE) {
+          if (first->flags & UNBOXED) {
+            return evalArithmetic(tree, frame);
+          }
 
-        if (!strcmp(first->s,"cond")) {
-          return evalCond(args,frame);
-        }
+          if (!strcmp(first->s,"if")) {
+            tree = selectIfBranch(args, frame);
+            continue;
+          }
 
-        if (!strcmp(first->s,"set!")) {
-          return evalSetBang(args,frame);
-        }
+          if (!strcmp(first->s,"let")) {
+            return evalLet(args,frame, first->flags & NO_ESCAPE, first->flags & CHECKED);
+          }
 
-        if (!strcmp(first->s,"begin")) {
-          return evalBegin(args,frame);
-        }
-        
-        if (!strcmp(first->s,"quote")) {
-          return handleQuote(args);
-        }
+          if (!strcmp(first->s,"let*")) {
+            return evalLetStar(args,frame, first->flags & NO_ESCAPE);
+          }
 
-        if (!strcmp(first->s,"define")) {
-          return evalDefine(args, frame);
-        }
+          if (!strcmp(first->s,"letrec")) {
+            return evalLetrec(args,frame, first->flags & NO_ESCAPE, first->flags & CHECKED);
+          }
 
-        if (!strcmp(first->s,"lambda")) {
-          return evalLambda(args, frame);
-        }
+          if (!strcmp(first->s,"cond")) {
+            return evalCond(args,frame);
+          }
 
-        if (!strcmp(first->s,"or")) {
-          return or(args, frame);
-        }
+          if (!strcmp(first->s,"set!")) {
+            return evalSetBang(args,frame);
+          }
 
-        if (!strcmp(first->s,"and")) {
-          return and(args, frame);
+          if (!strcmp(first->s,"begin")) {
+            return evalBegin(args,frame);
+          }
+        
+          if (!strcmp(first->s,"quote")) {
+            return handleQuote(args);
+          }
+
+          if (!strcmp(first->s,"define")) {
+            return evalDefine(args, frame);
+          }
+
+          if (!strcmp(first->s,"lambda")) {
+            Value *closure = evalLambda(args, frame, first->flags & CHECKED);
+            //whether calls to it can put their frame in the frame region
+            closure->flags = first->flags & NO_ESCAPE;
+            return closure;
+          }
+
+          if (!strcmp(first->s,"or")) {
+            return or(args, frame);
+          }
+
+          if (!strcmp(first->s,"and")) {
+            return and(args, frame);
+          }
+
+          if (!strcmp(first->s,"future")) {
+            return evalFuture(args, frame);
+          }
+
+          if (!strcmp(first->s,"spawn")) {
+            return evalSpawn(args, frame);
+          }
+
+          else {
+            return evalApplication(first, args, frame);
+          }
         }
 
         else {
-          Value *evaledOperator = eval(first, frame);
-          Value *evaledArgs = evalEach(args, frame);
-          return apply(evaledOperator,evaledArgs);
+          return evalApplication(first, args, frame);
         }
-      }
 
-      else {
-        Value *evaledOperator = eval(first, frame);
-        Value *evaledArgs = evalEach(args, frame);
-        return apply(evaledOperator,evaledArgs);
+        break;
+      }
+      default: {
+        evaluationError("unrecognized type");
+        break;
       }
+      //....
+    }
+    return makeNull(); //unreachable. just because the compiler complains if we don't return something here.
+  }
+}
 
-      break;
+//how many arguments evalApplication has room for in its own frame
+#define SMALL_ARGC 4
+
+//evaluates a procedure call. The arguments are evaluated into a buffer on
+//the C stack, so passing them allocates nothing. Every Scheme call goes
+//through here and apply, so their frames are what limits how deep a
+//program can recurse: the buffer holds SMALL_ARGC arguments, and the rarer
+//cases, longer calls and inlined arithmetic, get frames of their own
+Value *evalApplication(Value *first, Value *args, Frame *frame) {
+  Value *evaledOperator = eval(first, frame);
+  int argc = length(args);
+
+  if (argc == 2 && typeOf(evaledOperator) == PRIMITIVE_TYPE
+      && isInlinedPrimitive(evaledOperator->pf)) {
+    return evalInlinedApplication(evaledOperator, args, frame);
+  }
+  if (argc > SMALL_ARGC) {
+    return evalLongApplication(evaledOperator, argc, args, frame);
+  }
+
+  Value *argv[SMALL_ARGC];
+  evalEach(args, frame, argv);
+  return apply(evaledOperator, argc, argv);
+}
+
+//a call to +, -, *, <, > or = itself with exactly two operands: the result
+//is computed right here instead. If any of those names has been rebound to
+//something else, the operator won't match and the call goes through apply
+//as usual
+__attribute__((noinline))
+Value *evalInlinedApplication(Value *operator, Value *args, Frame *frame) {
+  Value *operands[2];
+  evalEach(args, frame, operands);
+  Value *result = inlineArithmetic(operator->pf, operands[0], operands[1]);
+  if (result != NULL) {
+    if (metering) {
+      meterInlined();
     }
-    default: {
-      evaluationError("unrecognized type");
-      break;
+    return result;
+  }
+  //non-numerical operand; let the primitive report it
+  return apply(operator, 2, operands);
+}
+
+//a call with more than SMALL_ARGC arguments, whose buffer is sized to fit
+__attribute__((noinline))
+Value *evalLongApplication(Value *operator, int argc, Value *args, Frame *frame) {
+  Value *argv[argc];
+  evalEach(args, frame, argv);
+  return apply(operator, argc, argv);
+}
+
+bool isInlinedPrimitive(Value *(*function)(int, struct Value **)) {
+  return function == primitiveAdd || function == primitiveMinus
+    || function == primitiveMultiply || function == primitiveLessThan
+    || function == primitiveGreaterThan || function == primitiveEquals;
+}
+
+//the character binaryArithmetic knows an inlined primitive by
+char arithmeticOp(Value *(*function)(int, struct Value **)) {
+  if (function == primitiveAdd) {
+    return '+';
+  }
+  if (function == primitiveMinus) {
+    return '-';
+  }
+  if (function == primitiveMultiply) {
+    return '*';
+  }
+  if (function == primitiveLessThan) {
+    return '<';
+  }
+  if (function == primitiveGreaterThan) {
+    return '>';
+  }
+  return '=';
+}
+
+//a heap Value for a number or boolean the arithmetic left on the stack
+Value *boxNumber(Value *number) {
+  if (number->type == BOOL_TYPE) {
+    return makeBool(number->i);
+  }
+  Value *result = makeNumber(number->type);
+  if (number->type == DOUBLE_TYPE) {
+    result->d = number->d;
+  }
+  else {
+    result->i = number->i;
+  }
+  return result;
+}
+
+//two-operand versions of the arithmetic and comparison primitives. Returns
+//NULL if either operand isn't a number
+Value *inlineArithmetic(Value *(*function)(int, struct Value **), Value *left, Value *right) {
+  Value number;
+  if (!binaryArithmetic(arithmeticOp(function), left, right, &number)) {
+    return NULL;
+  }
+  return boxNumber(&number);
+}
+
+//the arithmetic itself, on two numbers whose types can be read directly
+//(so either may be on the stack). Two ints skip the conversions, but an
+//int result is still computed in a double and cast back, as it always has
+//been, so that the primitives and every fast path agree even on overflow
+void numberArithmetic(char op, Value *left, Value *right, Value *result) {
+  if (left->type == INT_TYPE && right->type == INT_TYPE) {
+    int l = left->i;
+    int r = right->i;
+    if (op == '<' || op == '>' || op == '=') {
+      result->type = BOOL_TYPE;
+      result->i = op == '<' ? l < r : op == '>' ? l > r : l == r;
+      return;
+    }
+    result->type = INT_TYPE;
+    result->i = (int) (op == '+' ? (double) l + r : op == '-' ? (double) l - r : (double) l * r);
+    return;
+  }
+
+  double l = left->type == INT_TYPE ? left->i : left->d;
+  double r = right->type == INT_TYPE ? right->i : right->d;
+  if (op == '<' || op == '>' || op == '=') {
+    result->type = BOOL_TYPE;
+    result->i = op == '<' ? l < r : op == '>' ? l > r : l == r;
+    return;
+  }
+  result->type = DOUBLE_TYPE;
+  result->d = op == '+' ? l + r : op == '-' ? l - r : l * r;
+}
+
+//the arithmetic behind +, -, *, <, > and = on two operands, with the same
+//int/double rules as the primitives, shared by the inline fast path and the
+//optimizer's constant folding. Only the type and i or d of *result are set,
+//so it can live on the caller's stack; read its type directly, since typeOf
+//only works on allocated Values. Returns false if either operand isn't a
+//number
+bool binaryArithmetic(char op, Value *left, Value *right, Value *result) {
+  valueType leftType = typeOf(left);
+  valueType rightType = typeOf(right);
+  if ((leftType != INT_TYPE && leftType != DOUBLE_TYPE)
+      || (rightType != INT_TYPE && rightType != DOUBLE_TYPE)) {
+    return false;
+  }
+  numberArithmetic(op, left, right, result);
+  return true;
+}
+
+//whether an operand evalOperand returned is a number; scratch is the stack
+//Value it may have left one in
+bool isNumber(Value *operand, Value *scratch) {
+  valueType type = operand == scratch ? scratch->type : typeOf(operand);
+  return type == INT_TYPE || type == DOUBLE_TYPE;
+}
+
+//a fresh copy of a number, for a variable whose box is its own (see
+//OWN_BOX), so that set! can change the box without anything else seeing it;
+//anything else is returned as it is
+Value *unshare(Value *value) {
+  valueType type = typeOf(value);
+  if (type != INT_TYPE && type != DOUBLE_TYPE) {
+    return value;
+  }
+  return boxNumber(value);
+}
+
+Value *evalNumber(Value *expr, Frame *frame, Value *scratch);
+
+//evaluates an operand of arithmetic marked UNBOXED. Nested arithmetic
+//leaves its result in *scratch and returns scratch; a variable comes back
+//as the Value it's bound to, even one with a box of its own, which the
+//caller must unshare before it goes anywhere else
+Value *evalOperand(Value *expr, Frame *frame, Value *scratch) {
+  if (typeOf(expr) == SYMBOL_TYPE) {
+    fuel--;
+    return lookUpSymbol(expr, frame);
+  }
+  if (typeOf(expr) == CONS_TYPE && typeOf(car(expr)) == SYMBOL_TYPE
+      && (car(expr)->flags & UNBOXED)) {
+    fuel--;
+    if (metering) {
+      meterForm(car(expr)->s);
     }
-    //....
+    return evalNumber(expr, frame, scratch);
   }
-  return makeNull(); //unreachable. just because the compiler complains if we don't return something here.
+  return eval(expr, frame);
+}
+
+//evaluates a call the type inference marked UNBOXED. If the operator is
+//still the primitive and the operands are numbers, the result is left in
+//*scratch, and scratch is returned; otherwise the call goes through apply,
+//and whatever that returns is
+Value *evalNumber(Value *expr, Frame *frame, Value *scratch) {
+  Value *operator = eval(car(expr), frame);
+  Value leftNumber;
+  Value rightNumber;
+  Value *left = evalOperand(car(cdr(expr)), frame, &leftNumber);
+  Value *right = evalOperand(car(cdr(cdr(expr))), frame, &rightNumber);
+  if (metering) {
+    meterArguments(2);
+  }
+
+  if (typeOf(operator) == PRIMITIVE_TYPE && isInlinedPrimitive(operator->pf)
+      && isNumber(left, &leftNumber) && isNumber(right, &rightNumber)) {
+    numberArithmetic(arithmeticOp(operator->pf), left, right, scratch);
+    if (metering) {
+      meterInlined();
+    }
+    return scratch;
+  }
+  //a rebound operator, or an operand that isn't a number for the primitive
+  //to report
+  Value *operands[2];
+  operands[0] = left == &leftNumber ? boxNumber(left) : unshare(left);
+  operands[1] = right == &rightNumber ? boxNumber(right) : unshare(right);
+  return apply(operator, 2, operands);
+}
+
+//evaluates arithmetic marked UNBOXED, boxing only its final result
+Value *evalArithmetic(Value *tree, Frame *frame) {
+  Value number;
+  Value *result = evalNumber(tree, frame, &number);
+  return result == &number ? boxNumber(&number) : result;
 }
 
-void bind(char *name, Value *(*function)(struct Value *), Frame *frame) {
+void bind(char *name, Value *(*function)(int, struct Value **), Frame *frame) {
 
-  Value *funcName = talloc(sizeof(Value));
-  funcName->type = SYMBOL_TYPE;
+  Value *funcName = makeValue(SYMBOL_TYPE);
   funcName->s = name;
-  Value *v = talloc(sizeof(Value));
-  v->type = PRIMITIVE_TYPE;
+  Value *v = makeValue(PRIMITIVE_TYPE);
   v->pf = function;
   frame->bindings = cons(cons(funcName, v), frame->bindings);
+  if (profiling) {
+    profileName(v, name);
+  }
 }
 
 Value *evalCond(Value *args, Frame *frame) {
   
   Value *curArg = args;
 
-  while (curArg->type != NULL_TYPE) {
-    if (car(car(curArg))->type == SYMBOL_TYPE && !strcmp(car(car(curArg))->s, "else")) {
+  while (typeOf(curArg) != NULL_TYPE) {
+    if (typeOf(car(car(curArg))) == SYMBOL_TYPE && !strcmp(car(car(curArg))->s, "else")) {
       return eval(car(cdr(car(curArg))), frame);
     }
     if (eval(car(car(curArg)), frame)->i) {
@@ -194,38 +577,38 @@ Value *evalCond(Value *args, Frame *frame) {
     curArg = cdr(curArg);
   }
 
-  return makeNull();
+  //no clause matched; the result is unspecified rather than an empty list
+  return makeValue(VOID_TYPE);
 }
 
 //assumes args are ints
-Value *primitiveModulo(Value *args) {
+Value *primitiveModulo(int argc, Value **argv) {
 
-  Value *result = talloc(sizeof(Value));
-  result->type = INT_TYPE;
+  Value *result = makeNumber(INT_TYPE);
 
-  if (args->type == NULL_TYPE) {
-    evaluationError("no args given in /");
+  if (argc < 2) {
+    evaluationError("not enough args given in /");
   }
-  if (cdr(cdr(args))->type != NULL_TYPE) {
+  if (argc > 2) {
     evaluationError("too many args in /");
   }
 
-  int dividend = car(args)->i;
-  int divisor = car(cdr(args))->i;
+  int dividend = argv[0]->i;
+  int divisor = argv[1]->i;
 
   result->i = dividend % divisor;
 
   return result;
 }
 
-Value *primitiveDivide(Value *args) {
+Value *primitiveDivide(int argc, Value **argv) {
   
-  Value *result = talloc(sizeof(Value));
+  Value *result = makeNumber(INT_TYPE);
 
-  if (args->type == NULL_TYPE) {
-    evaluationError("no args given in /");
+  if (argc < 2) {
+    evaluationError("not enough args given in /");
   }
-  if (cdr(cdr(args))->type != NULL_TYPE) {
+  if (argc > 2) {
     evaluationError("too many args in /");
   }
 
@@ -233,21 +616,21 @@ Value *primitiveDivide(Value *args) {
   double dividend;
   double divisor;
 
-  if (car(args)->type == INT_TYPE) {
-    dividend = (double) car(args)->i;
+  if (typeOf(argv[0]) == INT_TYPE) {
+    dividend = (double) argv[0]->i;
   }
-  else if (car(args)->type == DOUBLE_TYPE) {
-    dividend = car(args)->d;
+  else if (typeOf(argv[0]) == DOUBLE_TYPE) {
+    dividend = argv[0]->d;
   }
   else {
     evaluationError("nonnumerical arg in /");
   }
   
-  if (car(cdr(args))->type == INT_TYPE) {
-    divisor = (double) car(cdr(args))->i;
+  if (typeOf(argv[1]) == INT_TYPE) {
+    divisor = (double) argv[1]->i;
   }
-  else if (car(cdr(args))->type == DOUBLE_TYPE) {
-    divisor = car(cdr(args))->d;
+  else if (typeOf(argv[1]) == DOUBLE_TYPE) {
+    divisor = argv[1]->d;
   }
   else {
     evaluationError("nonnumerical arg in /");
@@ -272,33 +655,30 @@ bool isInteger(double num) {
   return (num == truncated);
 }
 
-Value *primitiveMultiply(Value *args) {
+Value *primitiveMultiply(int argc, Value **argv) {
   
-  Value *result = talloc(sizeof(Value));
+  Value *result = makeNumber(INT_TYPE);
   
-  if (args->type == NULL_TYPE) {
+  if (argc == 0) {
     result->type = INT_TYPE;
     result->i = 1;
     return result;
   }
 
   bool containsReal = false;
-  Value *curArg = args;
-
   double product = 1;
   
-  while (curArg->type != NULL_TYPE) {
-    if (car(curArg)->type == DOUBLE_TYPE) {
+  for (int i = 0; i < argc; i++) {
+    if (typeOf(argv[i]) == DOUBLE_TYPE) {
       containsReal = true;
-      product *= car(curArg)->d;
+      product *= argv[i]->d;
     }
-    else if (car(curArg)->type == INT_TYPE) {
-      product *= car(curArg)->i;
+    else if (typeOf(argv[i]) == INT_TYPE) {
+      product *= argv[i]->i;
     }
     else {
       evaluationError("nonnumerical argument in *");
     }
-    curArg = cdr(curArg);
   }
 
   if (containsReal) {
@@ -318,14 +698,13 @@ Value *evalBegin(Value *args, Frame *frame) {
   Value *curArg = args;
   Value *evaledCurArg;
 
-  if (curArg->type == NULL_TYPE) {
-    Value *returnVoid = talloc(sizeof(Value));
-    returnVoid->type = VOID_TYPE;
+  if (typeOf(curArg) == NULL_TYPE) {
+    Value *returnVoid = makeValue(VOID_TYPE);
     return returnVoid;
   }
 
-  while (curArg->type != NULL_TYPE) {
-    if (curArg->type != CONS_TYPE) {
+  while (typeOf(curArg) != NULL_TYPE) {
+    if (typeOf(curArg) != CONS_TYPE) {
     evaluationError("wrong type arg in begin");
     }
     evaledCurArg = eval(car(curArg), frame);
@@ -337,80 +716,106 @@ Value *evalBegin(Value *args, Frame *frame) {
 
 Value *evalSetBang(Value *args, Frame *frame) {
 
-  if (args->type != CONS_TYPE || cdr(args)->type != CONS_TYPE) {
+  if (typeOf(args) != CONS_TYPE || typeOf(cdr(args)) != CONS_TYPE) {
     evaluationError("not enough arguments in define");
   }
-  if (cdr(cdr(args))->type != NULL_TYPE) {
+  if (typeOf(cdr(cdr(args))) != NULL_TYPE) {
     evaluationError("too many arguments in define");
   }
 
-  if (car(args)->type != SYMBOL_TYPE) {
+  if (typeOf(car(args)) != SYMBOL_TYPE) {
    evaluationError("wrong type argument in define");
   } 
   
   Value *var = car(args);
   Value *expr = car(cdr(args));
-  Value *evalExpr = eval(expr, frame);
+  Value number;
+  Value *evalExpr;
+  if (var->flags & OWN_BOX) {
+    evalExpr = evalOperand(expr, frame, &number);
+  }
+  else {
+    evalExpr = eval(expr, frame);
+  }
 
-  Value *toReturn = talloc(sizeof(Value));
-  toReturn->type = UNSPECIFIED_TYPE;
+  Value *binding = findBinding(var, frame);
+  if (binding == NULL) {
+    evaluationError("in evalSetBang: symbol not found");
+  }
 
-  Frame *curFrame = frame;
-  while (curFrame != NULL) {
-    Value *curVal = curFrame->bindings;
-    while (curVal->type != NULL_TYPE) {
-      if (!strcmp(car(car(curVal))->s, var->s)) {
-        car(curVal)->c.cdr = evalExpr;
-        return toReturn;
+  //a server request's heap is freed when it ends, so a binding from outside
+  //it (a prelude global, or a variable a prelude closure captured) is
+  //changed where it is, for the prelude's procedures to see, and what it
+  //held is noted for runRequest to put back afterwards
+  bool outlivesRequest = currentContext->topFrame != currentContext->globalFrame
+    && !heapOwns(currentContext->heap, binding);
+  if (outlivesRequest) {
+    currentContext->changedBindings = cons(cons(binding, cdr(binding)), currentContext->changedBindings);
+  }
+
+  if (var->flags & OWN_BOX) {
+    //nothing else shares the variable's box, so a number of the type it
+    //holds goes straight into it, unless the box has to be put back
+    Value *box = cdr(binding);
+    valueType type = evalExpr == &number ? number.type : typeOf(evalExpr);
+    if (!outlivesRequest && isNumber(evalExpr, &number) && typeOf(box) == type) {
+      if (type == INT_TYPE) {
+        box->i = evalExpr->i;
+      }
+      else {
+        box->d = evalExpr->d;
       }
-      curVal = cdr(curVal);
     }
-    curFrame = curFrame->parent;
+    else {
+      setCdr(binding, evalExpr == &number ? boxNumber(&number) : unshare(evalExpr));
+    }
+    return makeValue(UNSPECIFIED_TYPE);
   }
 
-  evaluationError("in evalSetBang: symbol not found");
-  return toReturn;
+  setCdr(binding, evalExpr);
+
+  return makeValue(UNSPECIFIED_TYPE);
 }
 
-Value *evalLetrec(Value *args, Frame *frame) {
+//checked is whether the expander has already made sure of the syntax
+Value *evalLetrec(Value *args, Frame *frame, bool inRegion, bool checked) {
 
-  Frame *newFrame = talloc(sizeof(Frame));
-  newFrame->parent = frame;
-  newFrame->bindings = makeNull();
+  RegionMark mark = regionMark();
+  Frame *newFrame = makeFrame(frame, inRegion);
   
-  if (args->type != CONS_TYPE || cdr(args)->type != CONS_TYPE) {
+  if (!checked && (typeOf(args) != CONS_TYPE || typeOf(cdr(args)) != CONS_TYPE)) {
     evaluationError("not enough arguments in letrec");
   }
 
   Value *curExpr = car(args);
 
   //create bindings
-  while (curExpr->type != NULL_TYPE) {
-    if (curExpr->type != CONS_TYPE || car(curExpr)->type != CONS_TYPE || cdr(car(curExpr))->type != CONS_TYPE) {
-      evaluationError("not enough arguments in letrec variable assignment");
-    }
-    if (cdr(car(curExpr))->type == CONS_TYPE && cdr(cdr(car(curExpr)))->type != NULL_TYPE) {
-      evaluationError("too many arguments in letrec variable assignment");
-    }
-
-    Value *curVar = car(car(curExpr));
+  while (typeOf(curExpr) != NULL_TYPE) {
+    if (!checked) {
+      if (typeOf(curExpr) != CONS_TYPE || typeOf(car(curExpr)) != CONS_TYPE || typeOf(cdr(car(curExpr))) != CONS_TYPE) {
+        evaluationError("not enough arguments in letrec variable assignment");
+      }
+      if (typeOf(cdr(car(curExpr))) == CONS_TYPE && typeOf(cdr(cdr(car(curExpr)))) != NULL_TYPE) {
+        evaluationError("too many arguments in letrec variable assignment");
+      }
+      if (typeOf(car(car(curExpr))) != SYMBOL_TYPE) {
+        evaluationError("in letrec: cannot assign value to a non-symbol");
+      }
 
-    if (curVar->type != SYMBOL_TYPE) {
-      evaluationError("in letrec: cannot assign value to a non-symbol");
-    }
-    
-    Value *v = newFrame->bindings;
-    while (v->type != NULL_TYPE) {
-      if (!strcmp(car(car(v))->s, curVar->s)) {
-        evaluationError("in letrec: cannot assign variable more that once");
+      Value *v = newFrame->bindings;
+      while (typeOf(v) != NULL_TYPE) {
+        if (!strcmp(car(car(v))->s, car(car(curExpr))->s)) {
+          evaluationError("in letrec: cannot assign variable more that once");
+        }
+        v = cdr(v);
       }
-      v = cdr(v);
     }
 
-    Value *unspecified = talloc(sizeof(Value));
-    unspecified->type = UNSPECIFIED_TYPE;
+    Value *curVar = car(car(curExpr));
+
+    Value *unspecified = makeValue(UNSPECIFIED_TYPE);
 
-    newFrame->bindings = cons(cons(curVar, unspecified), newFrame->bindings);
+    addBinding(newFrame, curVar, unspecified, inRegion);
 
     curExpr = cdr(curExpr);
   }
@@ -422,7 +827,7 @@ Value *evalLetrec(Value *args, Frame *frame) {
   Value *curVal;
   Value *evaledCurVal;
 
-  while(curExpr->type != NULL_TYPE) {
+  while(typeOf(curExpr) != NULL_TYPE) {
     curVal = cdr(car(curExpr));
     evaledCurVal = eval(car(curVal), newFrame);
     evaledRhs = cons(evaledCurVal, evaledRhs);
@@ -432,8 +837,8 @@ Value *evalLetrec(Value *args, Frame *frame) {
   Value *curBinding = newFrame->bindings;
   Value *curEvaledRhs = evaledRhs;
   
-  while (curBinding->type != NULL_TYPE) {
-    car(curBinding)->c.cdr = car(curEvaledRhs);
+  while (typeOf(curBinding) != NULL_TYPE) {
+    setCdr(car(curBinding), car(curEvaledRhs));
     curBinding = cdr(curBinding);
     curEvaledRhs = cdr(curEvaledRhs);
   }
@@ -441,56 +846,56 @@ Value *evalLetrec(Value *args, Frame *frame) {
   Value *evalExpr;
   Value *curArg = cdr(args);
 
-  while (curArg->type != NULL_TYPE) {
+  while (typeOf(curArg) != NULL_TYPE) {
     evalExpr = eval(car(curArg), newFrame);
     curArg = cdr(curArg);
   }
 
+  if (inRegion) {
+    regionRelease(mark);
+  }
   return evalExpr;
 }
 
-Value *evalLetStar(Value *args, Frame *frame) {
+//each binding gets its own frame, so that a closure made in one initializer
+//can't see the variables bound after it. When no closure can be made at all
+//that doesn't matter, and a single region frame holds every binding
+Value *evalLetStar(Value *args, Frame *frame, bool inRegion) {
   
-  if (args->type != CONS_TYPE || cdr(args)->type != CONS_TYPE) {
+  if (typeOf(args) != CONS_TYPE || typeOf(cdr(args)) != CONS_TYPE) {
     evaluationError("not enough arguments in let");
   }
 
   Value *curExpr = car(args);
 
-  Frame *newFrame = talloc(sizeof(Frame));
-  newFrame->parent = frame;
-  newFrame->bindings = makeNull();
+  RegionMark mark = regionMark();
+  if (inRegion) {
+    frame = makeFrame(frame, true);
+  }
 
   //create bindings
-  while (curExpr->type != NULL_TYPE) {
-    if (curExpr->type != CONS_TYPE || car(curExpr)->type != CONS_TYPE || cdr(car(curExpr))->type != CONS_TYPE) {
+  while (typeOf(curExpr) != NULL_TYPE) {
+    if (typeOf(curExpr) != CONS_TYPE || typeOf(car(curExpr)) != CONS_TYPE || typeOf(cdr(car(curExpr))) != CONS_TYPE) {
       evaluationError("not enough arguments in let variable assignment");
     }
-    if (cdr(car(curExpr))->type == CONS_TYPE && cdr(cdr(car(curExpr)))->type != NULL_TYPE) {
+    if (typeOf(cdr(car(curExpr))) == CONS_TYPE && typeOf(cdr(cdr(car(curExpr)))) != NULL_TYPE) {
       evaluationError("too many arguments in let variable assignment");
     }
 
     Value *curVar = car(car(curExpr));
-    if (curVar->type != SYMBOL_TYPE) {
+    if (typeOf(curVar) != SYMBOL_TYPE) {
       evaluationError("cannot assign value to a non-symbol");
     }
     
-    Frame *newFrame = talloc(sizeof(Frame));
-    newFrame->parent = frame;
-    newFrame->bindings = makeNull();
-
-    Value *v = newFrame->bindings;
-    while (v->type != NULL_TYPE) {
-      if (!strcmp(car(car(v))->s, curVar->s)) {
-        evaluationError("cannot assign variable more that once");
-      }
-      v = cdr(v);
-    }
-    
     Value *curVal = eval(car(cdr(car(curExpr))), frame);
-    newFrame->bindings = cons(cons(curVar, curVal), newFrame->bindings);
+    if (curVar->flags & OWN_BOX) {
+      curVal = unshare(curVal);
+    }
+    if (!inRegion) {
+      frame = makeFrame(frame, false);
+    }
+    addBinding(frame, curVar, curVal, inRegion);
 
-    frame = newFrame;
     curExpr = cdr(curExpr);
   }
 
@@ -498,21 +903,24 @@ Value *evalLetStar(Value *args, Frame *frame) {
   Value *curArg = cdr(args);
 
   //evaluate body
-  while (curArg->type != NULL_TYPE) {
+  while (typeOf(curArg) != NULL_TYPE) {
     evalExpr = eval(car(curArg), frame);
     curArg = cdr(curArg);
   }
+
+  if (inRegion) {
+    regionRelease(mark);
+  }
   return evalExpr;
 }
 
 Value *and(Value *args, Frame *frame) {
   
-  Value *isTrue = talloc(sizeof(Value));
-  isTrue->type = BOOL_TYPE;
+  Value *isTrue = makeValue(BOOL_TYPE);
   isTrue->i = 1;
 
   Value *curVal = args;
-  while (curVal->type != NULL_TYPE) {
+  while (typeOf(curVal) != NULL_TYPE) {
     if (eval(car(curVal), frame)->i == 0) {
       isTrue->i = 0;
       return isTrue;
@@ -525,12 +933,11 @@ Value *and(Value *args, Frame *frame) {
 
 Value *or(Value *args, Frame *frame) {
   
-  Value *isTrue = talloc(sizeof(Value));
-  isTrue->type = BOOL_TYPE;
+  Value *isTrue = makeValue(BOOL_TYPE);
   isTrue->i = 0;
 
   Value *curVal = args;
-  while (curVal->type != NULL_TYPE) {
+  while (typeOf(curVal) != NULL_TYPE) {
     if (eval(car(curVal), frame)->i == 1) {
       isTrue->i = 1;
       return isTrue;
@@ -541,29 +948,28 @@ Value *or(Value *args, Frame *frame) {
   return isTrue;
 }
 
-Value *primitiveEquals(Value *args) {
-  if(args->type == NULL_TYPE) {
+Value *primitiveEquals(int argc, Value **argv) {
+  if(argc == 0) {
     evaluationError("no args in primitive =");
   }
-  if(args->type != CONS_TYPE || cdr(args)->type != CONS_TYPE) {
+  if(argc < 2) {
     evaluationError("too few args in primitive =");
   }
-  if(cdr(cdr(args))->type != NULL_TYPE) {
+  if(argc > 2) {
     evaluationError("too many args in primitive =");
   }
 
-  Value *isEqual = talloc(sizeof(Value));
-  isEqual->type = BOOL_TYPE;
+  Value *isEqual = makeValue(BOOL_TYPE);
   isEqual->i = 0;
 
-  if (car(args)->type == INT_TYPE) {
-    if (car(cdr(args))->type == INT_TYPE) {
-      if (car(args)->i == car(cdr(args))->i) {
+  if (typeOf(argv[0]) == INT_TYPE) {
+    if (typeOf(argv[1]) == INT_TYPE) {
+      if (argv[0]->i == argv[1]->i) {
         isEqual->i = 1;
       }
     }
-    else if (car(cdr(args))->type == DOUBLE_TYPE) {
-      if (car(args)->i == car(cdr(args))->d) {
+    else if (typeOf(argv[1]) == DOUBLE_TYPE) {
+      if (argv[0]->i == argv[1]->d) {
         isEqual->i = 1;
       }
     }
@@ -571,14 +977,14 @@ Value *primitiveEquals(Value *args) {
       evaluationError("wrong type arg in primitive =");
     }
   }
-  else if (car(args)->type == DOUBLE_TYPE) {
-    if (car(cdr(args))->type == INT_TYPE) {
-      if (car(args)->d == car(cdr(args))->i) {
+  else if (typeOf(argv[0]) == DOUBLE_TYPE) {
+    if (typeOf(argv[1]) == INT_TYPE) {
+      if (argv[0]->d == argv[1]->i) {
         isEqual->i = 1;
       }
     }
-    else if (car(cdr(args))->type == DOUBLE_TYPE) {
-      if (car(args)->d == car(cdr(args))->d) {
+    else if (typeOf(argv[1]) == DOUBLE_TYPE) {
+      if (argv[0]->d == argv[1]->d) {
         isEqual->i = 1;
       }
     }
@@ -593,29 +999,28 @@ Value *primitiveEquals(Value *args) {
   return isEqual;
 }
 
-Value *primitiveGreaterThan(Value *args) {
-  if(args->type == NULL_TYPE) {
+Value *primitiveGreaterThan(int argc, Value **argv) {
+  if(argc == 0) {
     evaluationError("no args in primitive >");
   }
-  if(args->type != CONS_TYPE || cdr(args)->type != CONS_TYPE) {
+  if(argc < 2) {
     evaluationError("too few args in primitive >");
   }
-  if(cdr(cdr(args))->type != NULL_TYPE) {
+  if(argc > 2) {
     evaluationError("too many args in primitive >");
   }
 
-  Value *isGreaterThan = talloc(sizeof(Value));
-  isGreaterThan->type = BOOL_TYPE;
+  Value *isGreaterThan = makeValue(BOOL_TYPE);
   isGreaterThan->i = 0;
 
-  if (car(args)->type == INT_TYPE) {
-    if (car(cdr(args))->type == INT_TYPE) {
-      if (car(args)->i > car(cdr(args))->i) {
+  if (typeOf(argv[0]) == INT_TYPE) {
+    if (typeOf(argv[1]) == INT_TYPE) {
+      if (argv[0]->i > argv[1]->i) {
         isGreaterThan->i = 1;
       }
     }
-    else if (car(cdr(args))->type == DOUBLE_TYPE) {
-      if (car(args)->i > car(cdr(args))->d) {
+    else if (typeOf(argv[1]) == DOUBLE_TYPE) {
+      if (argv[0]->i > argv[1]->d) {
         isGreaterThan->i = 1;
       }
     }
@@ -623,14 +1028,14 @@ Value *primitiveGreaterThan(Value *args) {
       evaluationError("wrong type arg in primitive >");
     }
   }
-  else if (car(args)->type == DOUBLE_TYPE) {
-    if (car(cdr(args))->type == INT_TYPE) {
-      if (car(args)->d > car(cdr(args))->i) {
+  else if (typeOf(argv[0]) == DOUBLE_TYPE) {
+    if (typeOf(argv[1]) == INT_TYPE) {
+      if (argv[0]->d > argv[1]->i) {
         isGreaterThan->i = 1;
       }
     }
-    else if (car(cdr(args))->type == DOUBLE_TYPE) {
-      if (car(args)->d > car(cdr(args))->d) {
+    else if (typeOf(argv[1]) == DOUBLE_TYPE) {
+      if (argv[0]->d > argv[1]->d) {
         isGreaterThan->i = 1;
       }
     }
@@ -645,29 +1050,28 @@ Value *primitiveGreaterThan(Value *args) {
   return isGreaterThan;
 }
 
-Value *primitiveLessThan(Value *args) {
-  if(args->type == NULL_TYPE) {
+Value *primitiveLessThan(int argc, Value **argv) {
+  if(argc == 0) {
     evaluationError("no args in primitive <");
   }
-  if(args->type != CONS_TYPE || cdr(args)->type != CONS_TYPE) {
+  if(argc < 2) {
     evaluationError("too few args in primitive <");
   }
-  if(cdr(cdr(args))->type != NULL_TYPE) {
+  if(argc > 2) {
     evaluationError("too many args in primitive <");
   }
 
-  Value *isLessThan = talloc(sizeof(Value));
-  isLessThan->type = BOOL_TYPE;
+  Value *isLessThan = makeValue(BOOL_TYPE);
   isLessThan->i = 0;
 
-  if (car(args)->type == INT_TYPE) {
-    if (car(cdr(args))->type == INT_TYPE) {
-      if (car(args)->i < car(cdr(args))->i) {
+  if (typeOf(argv[0]) == INT_TYPE) {
+    if (typeOf(argv[1]) == INT_TYPE) {
+      if (argv[0]->i < argv[1]->i) {
         isLessThan->i = 1;
       }
     }
-    else if (car(cdr(args))->type == DOUBLE_TYPE) {
-      if (car(args)->i < car(cdr(args))->d) {
+    else if (typeOf(argv[1]) == DOUBLE_TYPE) {
+      if (argv[0]->i < argv[1]->d) {
         isLessThan->i = 1;
       }
     }
@@ -675,14 +1079,14 @@ Value *primitiveLessThan(Value *args) {
       evaluationError("wrong type arg in primitive <");
     }
   }
-  else if (car(args)->type == DOUBLE_TYPE) {
-    if (car(cdr(args))->type == INT_TYPE) {
-      if (car(args)->d < car(cdr(args))->i) {
+  else if (typeOf(argv[0]) == DOUBLE_TYPE) {
+    if (typeOf(argv[1]) == INT_TYPE) {
+      if (argv[0]->d < argv[1]->i) {
         isLessThan->i = 1;
       }
     }
-    else if (car(cdr(args))->type == DOUBLE_TYPE) {
-      if (car(args)->d < car(cdr(args))->d) {
+    else if (typeOf(argv[1]) == DOUBLE_TYPE) {
+      if (argv[0]->d < argv[1]->d) {
         isLessThan->i = 1;
       }
     }
@@ -697,37 +1101,37 @@ Value *primitiveLessThan(Value *args) {
   return isLessThan;
 }
 
-Value *primitiveMinus(Value *args) {
-  Value *result = talloc(sizeof(Value));
+Value *primitiveMinus(int argc, Value **argv) {
+  Value *result = makeNumber(INT_TYPE);
 
   bool containsReal = false;
-  Value *curArg = args;
+  if (argc == 0) {
+    evaluationError("no args in -");
+  }
 
   double diff = 0;
-  if (car(curArg)->type == DOUBLE_TYPE) {
+  if (typeOf(argv[0]) == DOUBLE_TYPE) {
       containsReal = true;
-      diff += car(curArg)->d;
+      diff += argv[0]->d;
     }
-  else if (car(curArg)->type == INT_TYPE) {
-      diff += car(curArg)->i;
+  else if (typeOf(argv[0]) == INT_TYPE) {
+      diff += argv[0]->i;
   }
   else {
       evaluationError("nonnumerical argument in -");
     }
-  curArg = cdr(curArg);
 
-  while (curArg->type != NULL_TYPE) {
-    if (car(curArg)->type == DOUBLE_TYPE) {
+  for (int i = 1; i < argc; i++) {
+    if (typeOf(argv[i]) == DOUBLE_TYPE) {
       containsReal = true;
-      diff -= car(curArg)->d;
+      diff -= argv[i]->d;
     }
-    else if (car(curArg)->type == INT_TYPE) {
-      diff -= car(curArg)->i;
+    else if (typeOf(argv[i]) == INT_TYPE) {
+      diff -= argv[i]->i;
     }
     else {
       evaluationError("nonnumerical argument in -");
     }
-    curArg = cdr(curArg);
   }
 
   if (containsReal) {
@@ -745,27 +1149,24 @@ Value *primitiveMinus(Value *args) {
 //returns the sum of the args
 //as an integer if all ints, otherwise as a double if there is at least one real arg
 //error if any arg is nonnumerical
-Value *primitiveAdd(Value *args) {
+Value *primitiveAdd(int argc, Value **argv) {
 
-  Value *result = talloc(sizeof(Value));
+  Value *result = makeNumber(INT_TYPE);
 
   bool containsReal = false;
-  Value *curArg = args;
-
   double sum = 0;
   
-  while (curArg->type != NULL_TYPE) {
-    if (car(curArg)->type == DOUBLE_TYPE) {
+  for (int i = 0; i < argc; i++) {
+    if (typeOf(argv[i]) == DOUBLE_TYPE) {
       containsReal = true;
-      sum += car(curArg)->d;
+      sum += argv[i]->d;
     }
-    else if (car(curArg)->type == INT_TYPE) {
-      sum += car(curArg)->i;
+    else if (typeOf(argv[i]) == INT_TYPE) {
+      sum += argv[i]->i;
     }
     else {
       evaluationError("nonnumerical argument in +");
     }
-    curArg = cdr(curArg);
   }
 
   if (containsReal) {
@@ -780,194 +1181,200 @@ Value *primitiveAdd(Value *args) {
   return result;
 }
 
-Value *primitiveNull(Value *args) {
+//quoted data and runtime lists share one representation, so null?, car and
+//cdr just look at the argument itself and never allocate
+Value *primitiveNull(int argc, Value **argv) {
   
-  Value *isNull = talloc(sizeof(Value));
-  isNull->type = BOOL_TYPE;
-  isNull->i = 0;
-  
-  if (args->type == NULL_TYPE) {
+  if (argc == 0) {
     evaluationError("no args in null?");
   }
-  if (args->type != CONS_TYPE) {
-    evaluationError("wrong type arg in null?");
-  }
-  if (cdr(args)->type != NULL_TYPE) {
+  if (argc > 1) {
     evaluationError("more than one arg in null?");
   }
 
-  if (car(args)->type == CONS_TYPE && car(car(args))->type == NULL_TYPE) {
-    isNull->i = 1;
-  }
-  
-  return isNull;
+  return makeBool(typeOf(argv[0]) == NULL_TYPE);
 }
 
-Value *primitiveCar(Value *args) {
-  if (args->type != CONS_TYPE || car(args)->type != CONS_TYPE || car(car(args))->type != CONS_TYPE) {
+Value *primitiveCar(int argc, Value **argv) {
+  if (argc < 1 || typeOf(argv[0]) != CONS_TYPE) {
     evaluationError("wrong type argument in primitive car");
   }
-  if (cdr(args)->type != NULL_TYPE) {
+  if (argc > 1) {
     evaluationError("too many args in primitive car");
   }
-  return car(car(car(args)));
+  return car(argv[0]);
 }
 
-Value *primitiveCdr(Value *args) {
-
-  if (args->type != CONS_TYPE || car(args)->type != CONS_TYPE) {
+Value *primitiveCdr(int argc, Value **argv) {
+  if (argc < 1 || typeOf(argv[0]) != CONS_TYPE) {
     evaluationError("wrong type argument in primitive cdr");
   }
-
-  if (car(car(args))->type == NULL_TYPE) {
-    return cons(makeNull(), makeNull()); //empty list
-  }
-
-  //improper list case
-  if (cdr(car(car(args)))->type != CONS_TYPE && cdr(car(car(args)))->type != NULL_TYPE) {
-    return cdr(car(car(args)));
+  if (argc > 1) {
+    evaluationError("too many args in primitive cdr");
   }
-  
-  //proper list case
-  return cons(cdr(car(car(args))), makeNull());
+  return cdr(argv[0]);
 }
 
-Value *primitiveCons(Value *args) {
+//allocates exactly one pair; an improper list falls out naturally when the
+//second argument isn't a list
+Value *primitiveCons(int argc, Value **argv) {
 
-  if (args->type != CONS_TYPE) {
+  if (argc < 2) {
     evaluationError("wrong type arg in primitive cons");
   }
-  if (cdr(args)->type != CONS_TYPE) {
-    evaluationError("wrong type arg in primitive cons");
-  }
-  if (cdr(cdr(args))->type != NULL_TYPE) {
+  if (argc > 2) {
     evaluationError("too many args in primitive cons");
   }
 
-  Value *carItem = car(args);
-  Value *cdrItem;
+  return cons(argv[0], argv[1]);
+}
 
-  //improper list case
-  if (car(cdr(args))->type != CONS_TYPE) {
-    cdrItem = car(cdr(args));
+//calls a function on argc already-evaluated arguments in argv. The argument
+//buffer belongs to the caller and is only read here: primitives look at it,
+//and a closure copies the values into the bindings of its new frame
+//while profiling, every call is on the shadow stack for as long as it runs
+Value *apply(Value *function, int argc, Value **argv) {
+  if (metering) {
+    meterApply(function);
   }
-  //proper list case
-  else {
-    cdrItem = car(car(cdr(args)));
+  bool profiled = profiling;
+  if (profiled) {
+    profileEnter(function);
   }
 
-  return cons(cons(carItem, cdrItem), makeNull());
-}
-
-Value *apply(Value *function, Value *args) {
-  
-  if (function->type == PRIMITIVE_TYPE) {
-    return function->pf(args);
+  Value *result;
+  if (typeOf(function) == PRIMITIVE_TYPE) {
+    result = function->pf(argc, argv);
   }
-  
-  //function is a closure
-
-  //check if function is closure??
-  if (function->type != CLOSURE_TYPE) {
-    evaluationError("function not a closure");
+  else if (typeOf(function) == MEMO_TYPE) {
+    result = memoApply(function, argc, argv);
   }
+  else {
+    //function is a closure
+
+    //check if function is closure??
+    if (typeOf(function) != CLOSURE_TYPE) {
+      evaluationError("function not a closure");
+    }
+
+    //it contains the body, param names, and pointer to env
 
-  //it contains the body, param names, and pointer to env
+    //create newFrame, making its parent the env that closure points to
+    //(function->cl.frame). It goes in the frame region if nothing in the body
+    //can capture it
+    bool inRegion = function->flags & NO_ESCAPE;
+    RegionMark mark = regionMark();
+    Frame *newFrame = makeFrame(function->cl.frame, inRegion);
+    bindArguments(newFrame, function->cl.paramNames, argc, argv, inRegion);
 
-  //create newFrame
-  Frame *newFrame = talloc(sizeof(Frame));
-  //make parent of newFrame point to the env that closure points to (function->cl.frame)
-  newFrame->parent = function->cl.frame;
+    //evaluate the body (function->cl.functionCode), with newFrame as the frame
+    result = eval(function->cl.functionCode, newFrame);
+    if (inRegion) {
+      regionRelease(mark);
+    }
+  }
+
+  if (profiled) {
+    profileLeave();
+  }
+  return result;
+}
 
-  //make bindings to connect formal parameters (function->cl.paramNames) with the actual parameters (args)
-  newFrame->bindings = makeNull();
+//makes bindings to connect formal parameters (function->cl.paramNames) with
+//the actual parameters (argv), in a frame of its own so that apply's, which
+//stays on the stack for as long as the call runs, doesn't need the room
+__attribute__((noinline))
+void bindArguments(Frame *newFrame, Value *formals, int argc, Value **argv, bool inRegion) {
 
-  Value *curFormal = function->cl.paramNames;
-  Value *curActual = args;
+  Value *curFormal = formals;
+  int i = 0;
   //create bindings
-  while (curFormal->type != NULL_TYPE && curActual->type != NULL_TYPE) {
-    newFrame->bindings = cons(cons(car(curFormal), car(curActual)), newFrame->bindings);
+  while (typeOf(curFormal) == CONS_TYPE && i < argc) {
+    addBinding(newFrame, car(curFormal), argv[i], inRegion);
 
     curFormal = cdr(curFormal);
-    curActual = cdr(curActual);
+    i++;
+  }
+
+  //a lone symbol (or dotted tail) in place of the parameter list takes the
+  //rest of the arguments as a list
+  if (typeOf(curFormal) == SYMBOL_TYPE) {
+    Value *rest = makeNull();
+    for (int j = argc - 1; j >= i; j--) {
+      rest = cons(argv[j], rest);
+    }
+    addBinding(newFrame, curFormal, rest, inRegion);
+    curFormal = makeNull();
+    i = argc;
   }
 
   //error if different number arguments
-  if (!(curFormal->type == NULL_TYPE && curActual->type == NULL_TYPE)) {
+  if (!(typeOf(curFormal) == NULL_TYPE && i == argc)) {
     evaluationError("inconsistent number of arguments in apply");
   }
-
-  //evaluate the body (function->cl.functionCode), with newFrame as the frame
-  return eval(function->cl.functionCode, newFrame);
 }
 
-Value *evalEach(Value *args, Frame *frame) {
+//evaluates each argument expression, in order, into the caller's argument
+//buffer, which must have room for all of them
+void evalEach(Value *args, Frame *frame, Value **argv) {
   
   Value *curArg = args;
-  Value *evalList = makeNull();
-  Value *lastEvaledArg;
+  int i = 0;
 
-  while (curArg->type != NULL_TYPE) {
-
-    //first iteration
-    if (evalList->type == NULL_TYPE) {
-      evalList = cons(eval(car(curArg), frame), makeNull());
-      lastEvaledArg = evalList;
-    }
-    else {
-      lastEvaledArg->c.cdr = cons(eval(car(curArg), frame), makeNull());
-      lastEvaledArg = cdr(lastEvaledArg);
-    }
+  while (typeOf(curArg) != NULL_TYPE) {
+    argv[i] = eval(car(curArg), frame);
+    i++;
     curArg = cdr(curArg);
   }
-  
-  return evalList;
+  if (metering) {
+    meterArguments(i);
+  }
 }
 
-Value *evalLambda(Value *args, Frame *frame) {
+//checked is whether the expander has already made sure of the syntax
+Value *evalLambda(Value *args, Frame *frame, bool checked) {
+
+  if (checked) {
+    Value *closure = makeValue(CLOSURE_TYPE);
+    closure->cl.frame = frame;
+    closure->cl.paramNames = car(args);
+    closure->cl.functionCode = car(cdr(args));
+    return closure;
+  }
 
-  if (args->type != CONS_TYPE || cdr(args)->type != CONS_TYPE) {
+  if (typeOf(args) != CONS_TYPE || typeOf(cdr(args)) != CONS_TYPE) {
     evaluationError("not enough arguments in lambda");
   }
   
-  if (cdr(cdr(args))->type != NULL_TYPE) {
+  if (typeOf(cdr(cdr(args))) != NULL_TYPE) {
     evaluationError("too many arguments in lambda");
   }
 
-  //catch when formal parameters are not symbol type
-  Value *curArg = args;
-  
-  while (curArg->type != NULL_TYPE) {
-    if (car(args)->type != NULL_TYPE) {
-      if (car(args)->type == CONS_TYPE) {
-        if (car(car(args))->type != SYMBOL_TYPE) {
-          evaluationError("formal argument of lambda not symbol type");
-        }
-      }
-      else if (car(args)->type != SYMBOL_TYPE) {
-        evaluationError("formal argument of lambda not symbol type");
-      }
-    }
-    curArg = cdr(curArg);
-  }
-
-  Value *closure = talloc(sizeof(Value));
-  closure->type = CLOSURE_TYPE;
-  closure->cl.frame = frame;
-  closure->cl.paramNames = car(args);
-
-  curArg = closure->cl.paramNames;
-  Value *current = cdr(curArg);
+  //catch when formal parameters are not symbol type, or appear twice. The
+  //list may end in a symbol instead of (), or be a lone symbol, to take the
+  //rest of the arguments
+  Value *curArg = car(args);
 
-  while (curArg->type != NULL_TYPE) {
-    while (current->type != NULL_TYPE) {
-      if (car(curArg)->type == SYMBOL_TYPE && car(current)->type == SYMBOL_TYPE && !strcmp(car(curArg)->s, car(current)->s)) {
+  while (typeOf(curArg) == CONS_TYPE) {
+    if (typeOf(car(curArg)) != SYMBOL_TYPE) {
+      evaluationError("formal argument of lambda not symbol type");
+    }
+    Value *current = cdr(curArg);
+    while (typeOf(current) == CONS_TYPE) {
+      if (typeOf(car(current)) == SYMBOL_TYPE && !strcmp(car(curArg)->s, car(current)->s)) {
         evaluationError("duplicate formal parameter in lambda");
       }
       current = cdr(current);
     }
     curArg = cdr(curArg);
   }
+  if (typeOf(curArg) != NULL_TYPE && typeOf(curArg) != SYMBOL_TYPE) {
+    evaluationError("formal argument of lambda not symbol type");
+  }
+
+  Value *closure = makeValue(CLOSURE_TYPE);
+  closure->cl.frame = frame;
+  closure->cl.paramNames = car(args);
 
   closure->cl.functionCode = car(cdr(args));
 
@@ -975,80 +1382,107 @@ Value *evalLambda(Value *args, Frame *frame) {
 }
 
 Value *evalDefine(Value *args, Frame *frame) {
-  if (args->type != CONS_TYPE || cdr(args)->type != CONS_TYPE) {
+  if (typeOf(args) != CONS_TYPE || typeOf(cdr(args)) != CONS_TYPE) {
     evaluationError("not enough arguments in define");
   }
-  if (cdr(cdr(args))->type != NULL_TYPE) {
+  if (typeOf(cdr(cdr(args))) != NULL_TYPE) {
     evaluationError("too many arguments in define");
   }
 
- if (car(args)->type != SYMBOL_TYPE) {
+ if (typeOf(car(args)) != SYMBOL_TYPE) {
    evaluationError("wrong type argument in define");
  } 
   
   Value *var = car(args);
   Value *expr = car(cdr(args));
   Value *evalExpr = eval(expr, frame);
+  if (profiling) {
+    profileName(evalExpr, var->s);
+  }
+
+  //redefining a name at top level updates its binding, which references may
+  //have cached, rather than hiding it behind a new one
+  if (frame == currentContext->topFrame) {
+    Value *curVal = frame->bindings;
+    while (typeOf(curVal) != NULL_TYPE) {
+      if (!strcmp(car(car(curVal))->s, var->s)) {
+        setCdr(car(curVal), evalExpr);
+        return makeValue(VOID_TYPE);
+      }
+      curVal = cdr(curVal);
+    }
+  }
+  //any other new binding may hide a global one: a define in a body, or a
+  //server request's define of a name from the prelude
+  if (frame != currentContext->globalFrame) {
+    __atomic_add_fetch(&currentContext->bindingEpoch, 1, __ATOMIC_RELAXED);
+  }
 
   frame->bindings = cons(cons(var, evalExpr), frame->bindings);
 
-  Value *toReturn = talloc(sizeof(Value));
-  toReturn->type = VOID_TYPE;
+  Value *toReturn = makeValue(VOID_TYPE);
 
   return toReturn;
 }
 
-Value *evalIf(Value *args, Frame *frame) {
-  if (args->type != NULL_TYPE && cdr(args)->type != NULL_TYPE && cdr(cdr(args))->type != NULL_TYPE) {
+//evaluates an if's condition and returns the branch it picks, which eval
+//then evaluates in the if's place
+Value *selectIfBranch(Value *args, Frame *frame) {
+  if (typeOf(args) != NULL_TYPE && typeOf(cdr(args)) != NULL_TYPE && typeOf(cdr(cdr(args))) != NULL_TYPE) {
     Value *condition = eval(car(args), frame);
-    if (condition->type != BOOL_TYPE) {
+    if (typeOf(condition) != BOOL_TYPE) {
       evaluationError("if statement condition not bool type");
     }
     if (condition->i) {
-      return eval(car(cdr(args)), frame);
+      return car(cdr(args));
     }
-    return eval(car(cdr(cdr(args))), frame);
+    return car(cdr(cdr(args)));
   }
   evaluationError("if statement wrong number arguments");
   return makeNull(); //unreachable
 }
 
-Value *evalLet(Value *args, Frame *frame) {
+//checked is whether the expander has already made sure of the syntax
+Value *evalLet(Value *args, Frame *frame, bool inRegion, bool checked) {
   
-  Frame *newFrame = talloc(sizeof(Frame));
-  newFrame->parent = frame;
-  newFrame->bindings = makeNull();
+  RegionMark mark = regionMark();
+  Frame *newFrame = makeFrame(frame, inRegion);
   
-  if (args->type != CONS_TYPE || cdr(args)->type != CONS_TYPE) {
+  if (!checked && (typeOf(args) != CONS_TYPE || typeOf(cdr(args)) != CONS_TYPE)) {
     evaluationError("not enough arguments in let");
   }
 
   Value *curExpr = car(args);
 
   //create bindings
-  while (curExpr->type != NULL_TYPE) {
-    if (curExpr->type != CONS_TYPE || car(curExpr)->type != CONS_TYPE || cdr(car(curExpr))->type != CONS_TYPE) {
-      evaluationError("not enough arguments in let variable assignment");
-    }
-    if (cdr(car(curExpr))->type == CONS_TYPE && cdr(cdr(car(curExpr)))->type != NULL_TYPE) {
-      evaluationError("too many arguments in let variable assignment");
-    }
+  while (typeOf(curExpr) != NULL_TYPE) {
+    if (!checked) {
+      if (typeOf(curExpr) != CONS_TYPE || typeOf(car(curExpr)) != CONS_TYPE || typeOf(cdr(car(curExpr))) != CONS_TYPE) {
+        evaluationError("not enough arguments in let variable assignment");
+      }
+      if (typeOf(cdr(car(curExpr))) == CONS_TYPE && typeOf(cdr(cdr(car(curExpr)))) != NULL_TYPE) {
+        evaluationError("too many arguments in let variable assignment");
+      }
+      if (typeOf(car(car(curExpr))) != SYMBOL_TYPE) {
+        evaluationError("cannot assign value to a non-symbol");
+      }
 
-    Value *curVar = car(car(curExpr));
-    if (curVar->type != SYMBOL_TYPE) {
-      evaluationError("cannot assign value to a non-symbol");
-    }
-    
-    Value *v = newFrame->bindings;
-    while (v->type != NULL_TYPE) {
-      if (!strcmp(car(car(v))->s, curVar->s)) {
-        evaluationError("cannot assign variable more that once");
+      Value *v = newFrame->bindings;
+      while (typeOf(v) != NULL_TYPE) {
+        if (!strcmp(car(car(v))->s, car(car(curExpr))->s)) {
+          evaluationError("cannot assign variable more that once");
+        }
+        v = cdr(v);
       }
-      v = cdr(v);
     }
 
+    Value *curVar = car(car(curExpr));
+
     Value *curVal = eval(car(cdr(car(curExpr))), frame);
-    newFrame->bindings = cons(cons(curVar, curVal), newFrame->bindings);
+    if (curVar->flags & OWN_BOX) {
+      curVal = unshare(curVal);
+    }
+    addBinding(newFrame, curVar, curVal, inRegion);
 
     curExpr = cdr(curExpr);
   }
@@ -1057,78 +1491,301 @@ Value *evalLet(Value *args, Frame *frame) {
   Value *curArg = cdr(args);
 
   //evaluate body
-  while (curArg->type != NULL_TYPE) {
+  while (typeOf(curArg) != NULL_TYPE) {
     evalExpr = eval(car(curArg), newFrame);
     curArg = cdr(curArg);
   }
+
+  if (inRegion) {
+    regionRelease(mark);
+  }
   return evalExpr;
 }
 
+//the quoted datum is returned as is, in the same representation that cons
+//builds at runtime
 Value *handleQuote(Value *args) {
-  if (args->type == NULL_TYPE) {
+  if (typeOf(args) == NULL_TYPE) {
     evaluationError("no args after quote");
   }
-  if (cdr(args)->type != NULL_TYPE) {
+  if (typeOf(cdr(args)) != NULL_TYPE) {
     evaluationError("too many args after quote");
   }
-  return args;
+  return car(args);
 }
 
 Value *lookUpSymbol(Value *tree, Frame *frame) {
+  Value *binding = findBinding(tree, frame);
+  if (binding == NULL) {
+    evaluationError("in lookUpSymbol: symbol not found");
+  }
+  return cdr(binding);
+}
 
+//returns the (name . value) binding that a symbol in the program refers to
+//from frame, or NULL if there is none. Global and top-level bindings are
+//never replaced (define and set! update them in place), so a reference
+//that resolves to one keeps it, and from then on finding it is a single
+//load. That's safe because which frames can bind a name at a given place in
+//the program is fixed by the program text, except that a define inside a
+//body adds a name to a local frame, and a server request can hide a prelude
+//binding; those bump the epoch, which every cached reference checks.
+//Futures may look up the same reference at once, hence the atomic loads
+//and stores; a name has only one global binding, so whatever cell a racing
+//thread sees is either NULL or the right one
+Value *findBinding(Value *symbol, Frame *frame) {
+  Value *cell = __atomic_load_n(&symbol->cell, __ATOMIC_ACQUIRE);
+  if (cell != NULL && __atomic_load_n(&symbol->epoch, __ATOMIC_RELAXED)
+      == __atomic_load_n(&currentContext->bindingEpoch, __ATOMIC_RELAXED)) {
+    if (metering) {
+      meterCachedLookup();
+    }
+    return cell;
+  }
+
+  //how far the search went, for --eval-metrics
+  int walked = 0;
+  int compared = 0;
   Frame *curFrame = frame;
   while (curFrame != NULL) {
+    walked++;
     Value *curVal = curFrame->bindings;
-    while (curVal->type != NULL_TYPE) {
-      if (!strcmp(car(car(curVal))->s, tree->s)) {
-        return cdr(car(curVal));
+    while (typeOf(curVal) != NULL_TYPE) {
+      compared++;
+      if (!strcmp(car(car(curVal))->s, symbol->s)) {
+        if (curFrame->parent == NULL || curFrame == currentContext->topFrame) {
+          __atomic_store_n(&symbol->epoch, __atomic_load_n(&currentContext->bindingEpoch, __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+          __atomic_store_n(&symbol->cell, car(curVal), __ATOMIC_RELEASE);
+        }
+        if (metering) {
+          meterLookup(walked, compared);
+        }
+        return car(curVal);
       }
       curVal = cdr(curVal);
     }
     curFrame = curFrame->parent;
   }
-  evaluationError("in lookUpSymbol: symbol not found");
-  return makeNull(); //unreachable
+  if (metering) {
+    meterLookup(walked, compared);
+  }
+  return NULL;
 }
 
 void printEvaluatedExpr(Value *evaluatedExpr) {
+    FILE *output = currentContext->output;
 
-    if (evaluatedExpr->type == INT_TYPE) {
-      printf("%i\n", evaluatedExpr->i);
+    if (typeOf(evaluatedExpr) == INT_TYPE) {
+      fprintf(output, "%i\n", evaluatedExpr->i);
     }
-    else if (evaluatedExpr->type == BOOL_TYPE) {
+    else if (typeOf(evaluatedExpr) == BOOL_TYPE) {
       if (evaluatedExpr->i == 0) {
-        printf("#f\n");
+        fprintf(output, "#f\n");
       }
       else {
-        printf("#t\n");
+        fprintf(output, "#t\n");
       }
     }
-    else if (evaluatedExpr->type == DOUBLE_TYPE) {
-      printf("%g\n", evaluatedExpr->d);
+    else if (typeOf(evaluatedExpr) == DOUBLE_TYPE) {
+      fprintf(output, "%g\n", evaluatedExpr->d);
+    }
+    else if (typeOf(evaluatedExpr) == STR_TYPE || typeOf(evaluatedExpr) == SYMBOL_TYPE) {
+      fprintf(output, "%s\n", evaluatedExpr->s);
+    }
+    else if (typeOf(evaluatedExpr) == CONS_TYPE || typeOf(evaluatedExpr) == NULL_TYPE) {
+      fprintValue(output, evaluatedExpr);
+      fprintf(output, "\n");
+    }
+    else if (typeOf(evaluatedExpr) == CLOSURE_TYPE || typeOf(evaluatedExpr) == MEMO_TYPE) {
+      fprintf(output, "#<procedure>\n");
     }
-    else if (evaluatedExpr->type == STR_TYPE || evaluatedExpr->type == SYMBOL_TYPE) {
-      printf("%s\n", evaluatedExpr->s);
+    else if (typeOf(evaluatedExpr) == FUTURE_TYPE) {
+      fprintf(output, "#<future>\n");
     }
-    else if (evaluatedExpr->type == CONS_TYPE) {
-      printTree(evaluatedExpr);
+    else if (typeOf(evaluatedExpr) == CHANNEL_TYPE) {
+      fprintf(output, "#<channel>\n");
     }
-    else if (evaluatedExpr->type == CLOSURE_TYPE) {
-      printf("#<procedure>\n");
+    else if (typeOf(evaluatedExpr) == PORT_TYPE) {
+      fprintf(output, "#<port>\n");
+    }
+    else if (typeOf(evaluatedExpr) == EOF_TYPE) {
+      fprintf(output, "#<eof>\n");
+    }
+    else if (typeOf(evaluatedExpr) == VECTOR_TYPE) {
+      fprintVector(output, evaluatedExpr->p);
+      fprintf(output, "\n");
+    }
+    else if (typeOf(evaluatedExpr) == PMAP_TYPE) {
+      fprintPmap(output, evaluatedExpr->p);
+      fprintf(output, "\n");
     }
 }
 
-//prints v->type
-//NOTE: must update type names list whenever more types added in value.h
-//type names must be in exact same order as defined in value.h
-void printType(Value *v) {
-  char *typeNames[18] = {"INT_TYPE", "DOUBLE_TYPE", "STR_TYPE", "CONS_TYPE", "NULL_TYPE", "PTR_TYPE","OPEN_TYPE", "CLOSE_TYPE", "BOOL_TYPE", "SYMBOL_TYPE", "OPENBRACKET_TYPE", "CLOSEBRACKET_TYPE", "DOT_TYPE", "SINGLEQUOTE_TYPE", "VOID_TYPE", "CLOSURE_TYPE", "PRIMITIVE_TYPE", "UNSPECIFIED_TYPE"};
+//prints a value the way it would be written back as data: lists in
+//parentheses, with a dot before an improper tail
+void fprintValue(FILE *stream, Value *value) {
+  switch (typeOf(value)) {
+    case INT_TYPE: {
+      fprintf(stream, "%i", value->i);
+      break;
+    }
+    case DOUBLE_TYPE: {
+      fprintf(stream, "%g", value->d);
+      break;
+    }
+    case BOOL_TYPE: {
+      fprintf(stream, value->i ? "#t" : "#f");
+      break;
+    }
+    case STR_TYPE:
+    case SYMBOL_TYPE: {
+      fprintf(stream, "%s", value->s);
+      break;
+    }
+    case NULL_TYPE: {
+      fprintf(stream, "()");
+      break;
+    }
+    case CONS_TYPE: {
+      fprintf(stream, "(");
+      Value *curVal = value;
+      while (typeOf(curVal) == CONS_TYPE) {
+        fprintValue(stream, car(curVal));
+        curVal = cdr(curVal);
+        if (typeOf(curVal) == CONS_TYPE) {
+          fprintf(stream, " ");
+        }
+      }
+      if (typeOf(curVal) != NULL_TYPE) {
+        fprintf(stream, " . ");
+        fprintValue(stream, curVal);
+      }
+      fprintf(stream, ")");
+      break;
+    }
+    case CLOSURE_TYPE:
+    case PRIMITIVE_TYPE:
+    case MEMO_TYPE: {
+      fprintf(stream, "#<procedure>");
+      break;
+    }
+    case FUTURE_TYPE: {
+      fprintf(stream, "#<future>");
+      break;
+    }
+    case CHANNEL_TYPE: {
+      fprintf(stream, "#<channel>");
+      break;
+    }
+    case PORT_TYPE: {
+      fprintf(stream, "#<port>");
+      break;
+    }
+    case EOF_TYPE: {
+      fprintf(stream, "#<eof>");
+      break;
+    }
+    case VECTOR_TYPE: {
+      fprintVector(stream, value->p);
+      break;
+    }
+    case PMAP_TYPE: {
+      fprintPmap(stream, value->p);
+      break;
+    }
+    default: {
+      break;
+    }
+  }
+}
 
-  printf("%s\n", typeNames[(int) v->type]);
+void printValue(Value *value) {
+  fprintValue(currentContext->output, value);
+}
+
+//prints typeOf(v)
+void printType(Value *v) {
+  printf("%s\n", typeName(typeOf(v)));
 }
 
 void evaluationError(char *errorMessage) {
+  if (errorHandler != NULL) {
+    caughtError = errorMessage;
+    longjmp(*errorHandler, 1);
+  }
   //printf("%s\n", errorMessage);
-  printf("Evaluation error: %s\n", errorMessage);
+  fprintf(currentContext->output, "Evaluation error: %s\n", errorMessage);
   texit(1);
 }
+
+//the steps a thread was given but didn't take go back unused, so this
+//thread's next step asks for a fresh slice
+void flushEvalCount() {
+  __atomic_add_fetch(&currentContext->evaluations, slice - fuel, __ATOMIC_RELAXED);
+  if (fuel > 0) {
+    __atomic_add_fetch(&currentContext->stepsLeft, fuel, __ATOMIC_RELAXED);
+  }
+  fuel = 0;
+  slice = 0;
+}
+
+void refuel() {
+  Context *context = currentContext;
+  flushEvalCount();
+  if (context->deadline > 0 && monotonicSeconds() > context->deadline) {
+    evaluationError("time limit exceeded");
+  }
+  long left = __atomic_fetch_sub(&context->stepsLeft, FUEL_SLICE, __ATOMIC_RELAXED);
+  if (left <= 0) {
+    __atomic_add_fetch(&context->stepsLeft, FUEL_SLICE, __ATOMIC_RELAXED);
+    evaluationError("step limit exceeded");
+  }
+  if (left < FUEL_SLICE) {
+    //hand back what this slice was short of
+    __atomic_add_fetch(&context->stepsLeft, FUEL_SLICE - left, __ATOMIC_RELAXED);
+  }
+  slice = left < FUEL_SLICE ? left : FUEL_SLICE;
+  fuel = slice;
+}
+
+EvalState newEvalState() {
+  EvalState state = {NULL, emptyRegion(), {NULL, 0}};
+  return state;
+}
+
+void swapEvalState(EvalState *state) {
+  jmp_buf *handler = errorHandler;
+  errorHandler = state->errorHandler;
+  state->errorHandler = handler;
+  regionSwap(&state->region);
+  profileSwap(&state->shadow);
+}
+
+void freeEvalState(EvalState *state) {
+  regionFree(&state->region);
+  profileFree(&state->shadow);
+}
+
+//evaluates expr like eval, except that an evaluation error comes back as a
+//NULL result with the message in *error instead of ending the program. The
+//frame region and the profiler's shadow stack are popped back to where they
+//were
+Value *evalCatchingErrors(Value *expr, Frame *frame, char **error) {
+  jmp_buf handler;
+  jmp_buf *outerHandler = errorHandler;
+  RegionMark mark = regionMark();
+  int profileDepth = profileMark();
+
+  if (setjmp(handler) != 0) {
+    errorHandler = outerHandler;
+    regionRelease(mark);
+    profileRelease(profileDepth);
+    *error = caughtError;
+    return NULL;
+  }
+  errorHandler = &handler;
+  Value *result = eval(expr, frame);
+  errorHandler = outerHandler;
+  *error = NULL;
+  return result;
+}
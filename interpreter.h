@@ -1,15 +1,77 @@
+#include <stdio.h>
+#include <setjmp.h>
 #include "value.h"
 #include "linkedlist.h"
 #include "talloc.h"
 #include "parser.h"
 #include "tokenizer.h"
+#include "context.h"
+#include "profile.h"
 
 #ifndef _INTERPRETER
 #define _INTERPRETER
 
+// Evaluate each top-level expression of a parsed program in the current
+// context's global frame, printing the results to its output.
 void interpret(Value *tree);
+
+// Fill in a new context's global frame and shared values. Its heap must be
+// the current one.
+void makeGlobalEnvironment(Context *context);
+
 Value *eval(Value *expr, Frame *frame);
 void printValue(Value *value);
+void fprintValue(FILE *stream, Value *value);
+
+// Call a primitive or closure on argc already-evaluated arguments. argv is
+// only read, never kept, so callers can pass a buffer on their own stack.
+Value *apply(Value *function, int argc, Value **argv);
+
+// Two-operand +, -, *, <, > or = (named by op), with the primitives'
+// int/double rules. Fills in result's type and number; returns false if
+// either operand isn't a number.
+bool binaryArithmetic(char op, Value *left, Value *right, Value *result);
+
+// Bind a primitive function to a name in the given frame.
+void bind(char *name, Value *(*function)(int, struct Value **), Frame *frame);
+
+// One of the two shared boolean values.
+Value *makeBool(bool b);
+
+// Report an evaluation error and exit, or, inside evalCatchingErrors, hand
+// it back to that instead.
+void evaluationError(char *errorMessage);
+
+// Add this thread's count of evals to the current context's, and give back
+// the steps it was allowed but didn't take.
+void flushEvalCount();
+
+// Called by eval when this thread has taken every step it was allowed:
+// count them, and allow it more out of the current context's budget, unless
+// the budget is spent or the deadline has passed, which is an evaluation
+// error.
+void refuel();
+
+// Evaluate expr in frame; if that fails, return NULL and set *error to the
+// message rather than exiting.
+Value *evalCatchingErrors(Value *expr, Frame *frame, char **error);
+
+// What the evaluator keeps per thread for the computation it is running:
+// where evaluation errors go, the frame region, and the profiler's shadow
+// stack. A suspended coroutine keeps its own in one of these.
+typedef struct EvalState {
+  jmp_buf *errorHandler;
+  Region region;
+  ShadowStack shadow;
+} EvalState;
+
+// The state of a computation that hasn't started yet.
+EvalState newEvalState();
+
+// Exchange this thread's evaluator state with *state, and free one set
+// aside.
+void swapEvalState(EvalState *state);
+void freeEvalState(EvalState *state);
 
 #endif
 
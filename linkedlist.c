@@ -5,20 +5,26 @@
 #include "linkedlist.h"
 #include "talloc.h"
 
+// Create a new value node of the given (non-pair) type; the caller fills in
+// the rest.
+Value *makeValue(valueType type) {
+  Value *v = tallocValue();
+  v->type = type;
+  return v;
+}
+
 // Create a new NULL_TYPE value node.
 Value *makeNull() {
-  Value *v = talloc(sizeof(Value));
-  v -> type = NULL_TYPE;
-  return v;
+  return makeValue(NULL_TYPE);
 }
 
-// Create a new CONS_TYPE value node.
+// Create a new CONS_TYPE value node. It lives on a pair page, so it has no
+// type field of its own.
 Value *cons(Value *newCar, Value *newCdr) {
-  Value *v = talloc(sizeof(Value));
-  v->type = CONS_TYPE;
-  (v->c).car = newCar;
-  (v->c).cdr = newCdr;
-  return v;
+  Pair *p = tallocPair();
+  p->car = newCar;
+  p->cdr = newCdr;
+  return (Value *) p;
 }
 
 // Display the contents of the linked list to the screen in some kind of
@@ -63,17 +69,17 @@ void appendInPlace(Value *list, Value *v) {
   
   Value *curVal = list;
 
-  if (curVal->type == NULL_TYPE) {
+  if (typeOf(curVal) == NULL_TYPE) {
     list = cons(v, list);
     return;
   }
 
-  while (cdr(curVal)->type != NULL_TYPE) {
+  while (typeOf(cdr(curVal)) != NULL_TYPE) {
     curVal = cdr(curVal);
   }
 
   Value *vCons = cons(v, cdr(curVal));
-  curVal->c.cdr = vCons;
+  setCdr(curVal, vCons);
 }
 
 // Return a new list that is the reverse of the one that is passed in. All
@@ -92,18 +98,17 @@ Value *reverse(Value *list) {
   Value *dupCdr;
   char *dupS;
   
-  while (curVal->type != NULL_TYPE) {
+  while (typeOf(curVal) != NULL_TYPE) {
 
     //duplicate the car of the current Value
-    dupCar = talloc(sizeof(Value));
-    dupCar->type = car(curVal)->type;
-    if (dupCar->type == INT_TYPE || dupCar->type == BOOL_TYPE) {
+    dupCar = makeValue(typeOf(car(curVal)));
+    if (typeOf(dupCar) == INT_TYPE || typeOf(dupCar) == BOOL_TYPE) {
       dupCar->i = car(curVal)->i;
     } 
-    else if (dupCar->type == DOUBLE_TYPE) {
+    else if (typeOf(dupCar) == DOUBLE_TYPE) {
       dupCar->d = car(curVal)->d;
     }
-    else if (dupCar->type == STR_TYPE || dupCar->type == SYMBOL_TYPE) {
+    else if (typeOf(dupCar) == STR_TYPE || typeOf(dupCar) == SYMBOL_TYPE) {
       dupS = talloc(sizeof(char)*(strlen(car(curVal)->s)) + 1);
       strcpy(dupS, car(curVal)->s);
       dupCar->s = dupS;
@@ -121,19 +126,29 @@ Value *reverse(Value *list) {
 // Utility to make it less typing to get car value. Use assertions to make sure
 // that this is a legitimate operation.
 Value *car(Value *list) {
-  return (list->c).car;
+  return ((Pair *) list)->car;
 }
 
 // Utility to make it less typing to get cdr value. Use assertions to make sure
 // that this is a legitimate operation.
 Value *cdr(Value *list) {
-  return (list->c).cdr;
+  return ((Pair *) list)->cdr;
+}
+
+// Replace the car of a pair in place.
+void setCar(Value *list, Value *newCar) {
+  ((Pair *) list)->car = newCar;
+}
+
+// Replace the cdr of a pair in place.
+void setCdr(Value *list, Value *newCdr) {
+  ((Pair *) list)->cdr = newCdr;
 }
 
 // Utility to check if pointing to a NULL_TYPE value. Use assertions to make sure
 // that this is a legitimate operation.
 bool isNull(Value *value) {
-  if (value->type == NULL_TYPE) {
+  if (typeOf(value) == NULL_TYPE) {
     return true;
   }
   return false;
@@ -4,6 +4,10 @@
 #ifndef _LINKEDLIST
 #define _LINKEDLIST
 
+// Create a new value node of the given (non-pair) type; the caller fills in
+// the rest.
+Value *makeValue(valueType type);
+
 // Create a new NULL_TYPE value node.
 Value *makeNull();
 
@@ -28,6 +32,12 @@ Value *car(Value *list);
 // that this is a legitimate operation.
 Value *cdr(Value *list);
 
+// Replace the car of a pair in place.
+void setCar(Value *list, Value *newCar);
+
+// Replace the cdr of a pair in place.
+void setCdr(Value *list, Value *newCdr);
+
 // Utility to check if pointing to a NULL_TYPE value. Use assertions to make sure
 // that this is a legitimate operation.
 bool isNull(Value *value);
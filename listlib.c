@@ -0,0 +1,332 @@
+#include <stdbool.h>
+#include <string.h>
+#include "value.h"
+#include "linkedlist.h"
+#include "talloc.h"
+#include "interpreter.h"
+#include "listlib.h"
+
+// The usual list procedures, written in C so that scripts don't have to
+// define them in interpreted Scheme. The ones that take a procedure hand
+// each call its arguments in a small buffer on the C stack, refilled for
+// every element, so calling back into apply allocates nothing.
+
+// Checks that exactly count arguments were passed.
+void checkArgCount(int argc, int count, char *errorMessage) {
+  if (argc != count) {
+    evaluationError(errorMessage);
+  }
+}
+
+// Checks that list is a proper list, and returns its length.
+int properLength(Value *list, char *errorMessage) {
+  int count = 0;
+  while (typeOf(list) == CONS_TYPE) {
+    count++;
+    list = cdr(list);
+  }
+  if (typeOf(list) != NULL_TYPE) {
+    evaluationError(errorMessage);
+  }
+  return count;
+}
+
+// Structural equality, as in equal?: numbers by value, strings and symbols by
+// name, and pairs element by element.
+bool valuesEqual(Value *a, Value *b) {
+  if (a == b) {
+    return true;
+  }
+  valueType aType = typeOf(a);
+  valueType bType = typeOf(b);
+  if ((aType == INT_TYPE || aType == DOUBLE_TYPE) && (bType == INT_TYPE || bType == DOUBLE_TYPE)) {
+    double aNum = aType == INT_TYPE ? a->i : a->d;
+    double bNum = bType == INT_TYPE ? b->i : b->d;
+    return aType == bType && aNum == bNum;
+  }
+  if (aType != bType) {
+    return false;
+  }
+  switch (aType) {
+    case BOOL_TYPE: {
+      return a->i == b->i;
+    }
+    case STR_TYPE:
+    case SYMBOL_TYPE: {
+      return !strcmp(a->s, b->s);
+    }
+    case NULL_TYPE: {
+      return true;
+    }
+    case CONS_TYPE: {
+      while (typeOf(a) == CONS_TYPE && typeOf(b) == CONS_TYPE) {
+        if (!valuesEqual(car(a), car(b))) {
+          return false;
+        }
+        a = cdr(a);
+        b = cdr(b);
+      }
+      return valuesEqual(a, b);
+    }
+    default: {
+      return false;
+    }
+  }
+}
+
+// A hash that agrees with valuesEqual: equal values always hash the same.
+// Long or deeply nested lists only have their first few elements hashed, so
+// hashing stays cheap; that's still consistent, just less selective.
+unsigned long hashValueDepth(Value *v, int depth) {
+  unsigned long hash = 14695981039346656037UL;
+  switch (typeOf(v)) {
+    case INT_TYPE: {
+      return (unsigned long) v->i * 0x9E3779B97F4A7C15UL;
+    }
+    case DOUBLE_TYPE: {
+      unsigned long bits;
+      double d = v->d == 0 ? 0 : v->d;
+      memcpy(&bits, &d, sizeof(bits));
+      return bits * 0xC2B2AE3D27D4EB4FUL;
+    }
+    case BOOL_TYPE: {
+      return v->i ? 0x51ED27UL : 0x1B873593UL;
+    }
+    case STR_TYPE:
+    case SYMBOL_TYPE: {
+      for (char *c = v->s; *c != '\0'; c++) {
+        hash = (hash ^ (unsigned char) *c) * 1099511628211UL;
+      }
+      return hash + typeOf(v);
+    }
+    case NULL_TYPE: {
+      return 0x85EBCA6BUL;
+    }
+    case CONS_TYPE: {
+      int count = 0;
+      while (typeOf(v) == CONS_TYPE && count < 8) {
+        if (depth < 4) {
+          hash = (hash ^ hashValueDepth(car(v), depth + 1)) * 1099511628211UL;
+        }
+        v = cdr(v);
+        count++;
+      }
+      return hash;
+    }
+    default: {
+      return (unsigned long) v;
+    }
+  }
+}
+
+unsigned long hashValue(Value *v) {
+  return hashValueDepth(v, 0);
+}
+
+Value *primitiveLength(int argc, Value **argv) {
+  checkArgCount(argc, 1, "wrong number of args in length");
+  Value *result = makeValue(INT_TYPE);
+  result->i = properLength(argv[0], "wrong type arg in length");
+  return result;
+}
+
+//copies every list but the last, which the result shares
+Value *primitiveAppend(int argc, Value **argv) {
+  if (argc == 0) {
+    return makeNull();
+  }
+
+  Value *result = makeNull();
+  Value *last = NULL;
+
+  for (int i = 0; i < argc - 1; i++) {
+    properLength(argv[i], "wrong type arg in append");
+    Value *curVal = argv[i];
+    while (typeOf(curVal) == CONS_TYPE) {
+      Value *copy = cons(car(curVal), makeNull());
+      if (last == NULL) {
+        result = copy;
+      }
+      else {
+        setCdr(last, copy);
+      }
+      last = copy;
+      curVal = cdr(curVal);
+    }
+  }
+
+  if (last == NULL) {
+    return argv[argc - 1];
+  }
+  setCdr(last, argv[argc - 1]);
+  return result;
+}
+
+Value *primitiveReverse(int argc, Value **argv) {
+  checkArgCount(argc, 1, "wrong number of args in reverse");
+  properLength(argv[0], "wrong type arg in reverse");
+
+  Value *result = makeNull();
+  Value *curVal = argv[0];
+  while (typeOf(curVal) == CONS_TYPE) {
+    result = cons(car(curVal), result);
+    curVal = cdr(curVal);
+  }
+  return result;
+}
+
+//(map f list1 list2 ...) calls f with one element from each list, stopping at
+//the end of the shortest
+Value *primitiveMap(int argc, Value **argv) {
+  if (argc < 2) {
+    evaluationError("not enough args in map");
+  }
+
+  Value *function = argv[0];
+  int listCount = argc - 1;
+  //where we are in each list, and the arguments for the next call
+  Value *positions[listCount];
+  Value *callArgs[listCount];
+  for (int i = 0; i < listCount; i++) {
+    properLength(argv[i + 1], "wrong type arg in map");
+    positions[i] = argv[i + 1];
+  }
+
+  Value *result = makeNull();
+  Value *last = NULL;
+
+  while (true) {
+    for (int i = 0; i < listCount; i++) {
+      if (typeOf(positions[i]) != CONS_TYPE) {
+        return result;
+      }
+      callArgs[i] = car(positions[i]);
+      positions[i] = cdr(positions[i]);
+    }
+
+    Value *mapped = cons(apply(function, listCount, callArgs), makeNull());
+    if (last == NULL) {
+      result = mapped;
+    }
+    else {
+      setCdr(last, mapped);
+    }
+    last = mapped;
+  }
+}
+
+Value *primitiveFilter(int argc, Value **argv) {
+  checkArgCount(argc, 2, "wrong number of args in filter");
+  properLength(argv[1], "wrong type arg in filter");
+
+  Value *function = argv[0];
+  Value *callArgs[1];
+  Value *result = makeNull();
+  Value *last = NULL;
+
+  Value *curVal = argv[1];
+  while (typeOf(curVal) == CONS_TYPE) {
+    callArgs[0] = car(curVal);
+    Value *keep = apply(function, 1, callArgs);
+    if (!(typeOf(keep) == BOOL_TYPE && keep->i == 0)) {
+      Value *kept = cons(car(curVal), makeNull());
+      if (last == NULL) {
+        result = kept;
+      }
+      else {
+        setCdr(last, kept);
+      }
+      last = kept;
+    }
+    curVal = cdr(curVal);
+  }
+  return result;
+}
+
+//(foldl f init list) calls (f element accumulator) from left to right, as in
+//Racket
+Value *primitiveFoldl(int argc, Value **argv) {
+  checkArgCount(argc, 3, "wrong number of args in foldl");
+  properLength(argv[2], "wrong type arg in foldl");
+
+  Value *function = argv[0];
+  Value *accumulator = argv[1];
+  Value *callArgs[2];
+
+  Value *curVal = argv[2];
+  while (typeOf(curVal) == CONS_TYPE) {
+    callArgs[0] = car(curVal);
+    callArgs[1] = accumulator;
+    accumulator = apply(function, 2, callArgs);
+    curVal = cdr(curVal);
+  }
+  return accumulator;
+}
+
+//returns the first pair in the association list whose car is equal to the
+//key, or #f
+Value *primitiveAssoc(int argc, Value **argv) {
+  checkArgCount(argc, 2, "wrong number of args in assoc");
+  properLength(argv[1], "wrong type arg in assoc");
+
+  Value *key = argv[0];
+  Value *curVal = argv[1];
+  while (typeOf(curVal) == CONS_TYPE) {
+    if (typeOf(car(curVal)) != CONS_TYPE) {
+      evaluationError("non-pair element in assoc");
+    }
+    if (valuesEqual(key, car(car(curVal)))) {
+      return car(curVal);
+    }
+    curVal = cdr(curVal);
+  }
+  return makeBool(false);
+}
+
+//returns the tail of the list starting at the first element equal to the
+//given one, or #f
+Value *primitiveMember(int argc, Value **argv) {
+  checkArgCount(argc, 2, "wrong number of args in member");
+  properLength(argv[1], "wrong type arg in member");
+
+  Value *curVal = argv[1];
+  while (typeOf(curVal) == CONS_TYPE) {
+    if (valuesEqual(argv[0], car(curVal))) {
+      return curVal;
+    }
+    curVal = cdr(curVal);
+  }
+  return makeBool(false);
+}
+
+Value *primitiveListRef(int argc, Value **argv) {
+  checkArgCount(argc, 2, "wrong number of args in list-ref");
+  if (typeOf(argv[1]) != INT_TYPE || argv[1]->i < 0) {
+    evaluationError("wrong type arg in list-ref");
+  }
+
+  Value *curVal = argv[0];
+  int i;
+  for (i = argv[1]->i; i > 0; i--) {
+    if (typeOf(curVal) != CONS_TYPE) {
+      evaluationError("index out of range in list-ref");
+    }
+    curVal = cdr(curVal);
+  }
+  if (typeOf(curVal) != CONS_TYPE) {
+    evaluationError("index out of range in list-ref");
+  }
+  return car(curVal);
+}
+
+void bindListPrimitives(Frame *frame) {
+  bind("length", primitiveLength, frame);
+  bind("append", primitiveAppend, frame);
+  bind("reverse", primitiveReverse, frame);
+  bind("map", primitiveMap, frame);
+  bind("filter", primitiveFilter, frame);
+  bind("foldl", primitiveFoldl, frame);
+  bind("assoc", primitiveAssoc, frame);
+  bind("member", primitiveMember, frame);
+  bind("list-ref", primitiveListRef, frame);
+}
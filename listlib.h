@@ -0,0 +1,18 @@
+#include <stdbool.h>
+#include "value.h"
+
+#ifndef _LISTLIB
+#define _LISTLIB
+
+// Structural equality, as in equal?: numbers by value, strings and symbols by
+// name, and pairs element by element.
+bool valuesEqual(Value *a, Value *b);
+
+// A hash that agrees with valuesEqual: equal values always hash the same.
+unsigned long hashValue(Value *v);
+
+// Bind length, append, reverse, map, filter, foldl, assoc, member and
+// list-ref in the given frame.
+void bindListPrimitives(Frame *frame);
+
+#endif
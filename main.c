@@ -1,16 +1,134 @@
 #include <stdio.h>
-#include "tokenizer.h"
-#include "value.h"
-#include "linkedlist.h"
-#include "parser.h"
-#include "talloc.h"
-#include "interpreter.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include "context.h"
+#include "server.h"
+#include "profile.h"
+#include "metrics.h"
+#include "heapdump.h"
 
-int main() {
-   Value *list = tokenize(stdin);
-   Value *tree = parse(list);
-   interpret(tree);
+// Evaluates a prelude into the context's global environment. Its output goes
+// to stderr, so that in server mode it can't be mistaken for a reply.
+int loadPrelude(Context *context, char *path, bool optimizing) {
+   FILE *prelude = fopen(path, "r");
+   if (prelude == NULL) {
+      fprintf(stderr, "can't open prelude %s\n", path);
+      return 1;
+   }
+   context->input = prelude;
+   context->output = stderr;
+   int status = runProgram(context, optimizing, false);
+   context->input = stdin;
+   context->output = stdout;
+   fclose(prelude);
+   return status;
+}
+
+int main(int argc, char **argv) {
+   bool optimizing = true;
+   bool reporting = false;
+   bool serving = false;
+   bool stats = false;
+   bool countAllocations = false;
+   char *profile = NULL;
+   char *heapDumpPath = NULL;
+   long stepLimit = 0;
+   double timeLimit = 0;
+   char *prelude = NULL;
+   for (int i = 1; i < argc; i++) {
+      if (!strcmp(argv[i], "--no-optimize")) {
+         optimizing = false;
+      }
+      else if (!strcmp(argv[i], "--optimize-report")) {
+         reporting = true;
+      }
+      else if (!strcmp(argv[i], "--stats")) {
+         stats = true;
+      }
+      else if (!strcmp(argv[i], "--alloc-stats")) {
+         countAllocations = true;
+      }
+      else if (!strcmp(argv[i], "--eval-metrics")) {
+         metering = true;
+      }
+      else if (!strcmp(argv[i], "--profile") && i + 1 < argc) {
+         i++;
+         profile = argv[i];
+      }
+      else if (!strcmp(argv[i], "--heap-dump") && i + 1 < argc) {
+         i++;
+         heapDumpPath = argv[i];
+      }
+      else if (!strcmp(argv[i], "--step-limit") && i + 1 < argc && atol(argv[i + 1]) > 0) {
+         i++;
+         stepLimit = atol(argv[i]);
+      }
+      else if (!strcmp(argv[i], "--time-limit") && i + 1 < argc && atof(argv[i + 1]) > 0) {
+         i++;
+         timeLimit = atof(argv[i]);
+      }
+      else if (!strcmp(argv[i], "--server")) {
+         serving = true;
+      }
+      else if (!strcmp(argv[i], "--prelude") && i + 1 < argc) {
+         i++;
+         prelude = argv[i];
+      }
+      else {
+         fprintf(stderr, "usage: %s [--no-optimize] [--optimize-report] [--prelude file] [--server] [--stats] [--alloc-stats] [--eval-metrics] [--profile file] [--heap-dump file] [--step-limit steps] [--time-limit seconds] < program.scm\n", argv[0]);
+         return 1;
+      }
+   }
 
-   tfree();
-   return 0;
+   if (countAllocations) {
+      tallocEnableStats();
+   }
+   FILE *collapsed = NULL;
+   if (profile != NULL) {
+      collapsed = fopen(profile, "w");
+      if (collapsed == NULL) {
+         fprintf(stderr, "can't write profile to %s\n", profile);
+         return 1;
+      }
+      startProfiler();
+   }
+   Context *context = newContext(stdin, stdout);
+   context->stepLimit = stepLimit;
+   context->timeLimit = timeLimit;
+   int status = 0;
+   if (prelude != NULL) {
+      status = loadPrelude(context, prelude, optimizing);
+   }
+   if (status == 0) {
+      if (serving) {
+         status = serve(context, stdin, stdout, optimizing);
+      }
+      else {
+         status = runProgram(context, optimizing, reporting);
+      }
+   }
+   if (heapDumpPath != NULL) {
+      FILE *dump = fopen(heapDumpPath, "w");
+      if (dump == NULL) {
+         fprintf(stderr, "can't write heap dump to %s\n", heapDumpPath);
+      }
+      else {
+         heapDump(context, dump);
+         fclose(dump);
+      }
+   }
+   if (collapsed != NULL) {
+      stopProfiler(collapsed);
+      fclose(collapsed);
+   }
+   if (metering) {
+      printMetrics(stderr);
+   }
+   if (stats) {
+      fprintf(stderr, "stats: %ld evals, %ld allocations\n",
+         context->evaluations, context->allocations);
+   }
+   freeContext(context);
+   return status;
 }
@@ -0,0 +1,252 @@
+#include <stdbool.h>
+#include <limits.h>
+#include <string.h>
+#include <pthread.h>
+#include "value.h"
+#include "linkedlist.h"
+#include "talloc.h"
+#include "interpreter.h"
+#include "listlib.h"
+#include "context.h"
+#include "memo.h"
+
+// (memoize f) or (memoize f size) wraps a procedure in a result cache. The
+// cache holds at most size entries (1024 by default), keyed on the
+// structural hash of the arguments and checked with valuesEqual, so lists
+// and strings work as keys as well as numbers. When it is full, the CLOCK
+// policy picks the victim: every hit sets an entry's referenced bit, and the
+// clock hand sweeps round clearing bits until it finds an entry that hasn't
+// been used since its last pass. The procedure is assumed to be pure; that's
+// the caller's promise, not something this checks. Futures may call the same
+// memoized procedure at once, so the cache has a lock, which is never held
+// while the procedure itself runs.
+
+#define DEFAULT_MEMO_SIZE 1024
+// the largest size whose bucket count, the next power of two at or above
+// twice the size, still fits in an int
+#define MAX_MEMO_SIZE (INT_MAX / 4)
+
+typedef struct MemoEntry {
+  unsigned long hash;
+  int argc;
+  int argCapacity;
+  Value **args;
+  Value *result;
+  bool referenced;
+  // next entry in the same bucket, or -1
+  int next;
+} MemoEntry;
+
+typedef struct Memo {
+  Value *function;
+  int capacity;
+  int count;
+  MemoEntry *entries;
+  // heads of the bucket chains, as indices into entries, or -1
+  int *buckets;
+  int bucketCount;
+  int hand;
+  long hits;
+  long misses;
+  long evictions;
+  // the server request the entries were made in; see memoApply
+  int requestCount;
+  pthread_mutex_t lock;
+} Memo;
+
+Memo *newMemo(Value *function, int capacity) {
+  Memo *memo = talloc(sizeof(Memo));
+  memo->function = function;
+  memo->capacity = capacity;
+  memo->count = 0;
+  memo->entries = talloc(sizeof(MemoEntry) * capacity);
+  memo->bucketCount = 1;
+  while (memo->bucketCount < capacity * 2) {
+    memo->bucketCount *= 2;
+  }
+  memo->buckets = talloc(sizeof(int) * memo->bucketCount);
+  for (int i = 0; i < memo->bucketCount; i++) {
+    memo->buckets[i] = -1;
+  }
+  memo->hand = 0;
+  memo->hits = 0;
+  memo->misses = 0;
+  memo->evictions = 0;
+  memo->requestCount = currentContext->requestCount;
+  pthread_mutex_init(&memo->lock, NULL);
+  return memo;
+}
+
+unsigned long hashArgs(int argc, Value **argv) {
+  unsigned long hash = 1469598103934665603UL + argc;
+  for (int i = 0; i < argc; i++) {
+    hash = (hash ^ hashValue(argv[i])) * 1099511628211UL;
+  }
+  return hash ^ (hash >> 29);
+}
+
+bool argsMatch(MemoEntry *entry, unsigned long hash, int argc, Value **argv) {
+  if (entry->hash != hash || entry->argc != argc) {
+    return false;
+  }
+  for (int i = 0; i < argc; i++) {
+    if (!valuesEqual(entry->args[i], argv[i])) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Take an entry out of its bucket chain.
+void unlinkEntry(Memo *memo, int index) {
+  int *link = &memo->buckets[memo->entries[index].hash & (memo->bucketCount - 1)];
+  while (*link != index) {
+    link = &memo->entries[*link].next;
+  }
+  *link = memo->entries[index].next;
+}
+
+// Find a slot for a new entry, evicting one if the cache is full.
+int claimEntry(Memo *memo) {
+  if (memo->count < memo->capacity) {
+    memo->entries[memo->count].argCapacity = 0;
+    memo->count++;
+    return memo->count - 1;
+  }
+
+  while (memo->entries[memo->hand].referenced) {
+    memo->entries[memo->hand].referenced = false;
+    memo->hand = (memo->hand + 1) % memo->capacity;
+  }
+  int victim = memo->hand;
+  memo->hand = (memo->hand + 1) % memo->capacity;
+  unlinkEntry(memo, victim);
+  memo->evictions++;
+  return victim;
+}
+
+void clearMemo(Memo *memo) {
+  memo->count = 0;
+  memo->hand = 0;
+  for (int i = 0; i < memo->bucketCount; i++) {
+    memo->buckets[i] = -1;
+  }
+  memo->requestCount = currentContext->requestCount;
+}
+
+Value *memoApply(Value *memoized, int argc, Value **argv) {
+  Memo *memo = memoized->p;
+  unsigned long hash = hashArgs(argc, argv);
+  int bucket = hash & (memo->bucketCount - 1);
+
+  pthread_mutex_lock(&memo->lock);
+  //a memoized procedure from a server's prelude outlives each request, but
+  //the arguments and results it cached during one are freed with it
+  if (memo->requestCount != currentContext->requestCount) {
+    clearMemo(memo);
+  }
+  for (int i = memo->buckets[bucket]; i != -1; i = memo->entries[i].next) {
+    if (argsMatch(&memo->entries[i], hash, argc, argv)) {
+      memo->entries[i].referenced = true;
+      memo->hits++;
+      Value *result = memo->entries[i].result;
+      pthread_mutex_unlock(&memo->lock);
+      return result;
+    }
+  }
+  memo->misses++;
+  pthread_mutex_unlock(&memo->lock);
+
+  Value *result = apply(memo->function, argc, argv);
+
+  //the call may have filled the cache with recursive results in the
+  //meantime, so only now pick the slot
+  pthread_mutex_lock(&memo->lock);
+  int index = claimEntry(memo);
+  MemoEntry *entry = &memo->entries[index];
+  if (entry->argCapacity < argc) {
+    entry->args = talloc(sizeof(Value *) * argc);
+    entry->argCapacity = argc;
+  }
+  memcpy(entry->args, argv, sizeof(Value *) * argc);
+  entry->argc = argc;
+  entry->hash = hash;
+  entry->result = result;
+  entry->referenced = false;
+  entry->next = memo->buckets[bucket];
+  memo->buckets[bucket] = index;
+  pthread_mutex_unlock(&memo->lock);
+  return result;
+}
+
+size_t walkMemo(void *memoized, HeapWalk *walk) {
+  Memo *memo = memoized;
+  heapReach(walk, memo->function, NULL);
+  size_t bytes = sizeof(Memo) + sizeof(MemoEntry) * memo->capacity + sizeof(int) * memo->bucketCount;
+  pthread_mutex_lock(&memo->lock);
+  //entries from an earlier server request have been freed with it
+  if (memo->requestCount == currentContext->requestCount) {
+    for (int i = 0; i < memo->count; i++) {
+      for (int j = 0; j < memo->entries[i].argc; j++) {
+        heapReach(walk, memo->entries[i].args[j], "memo");
+      }
+      heapReach(walk, memo->entries[i].result, "memo");
+      bytes += sizeof(Value *) * memo->entries[i].argCapacity;
+    }
+  }
+  pthread_mutex_unlock(&memo->lock);
+  return bytes;
+}
+
+//(memoize f) or (memoize f size)
+Value *primitiveMemoize(int argc, Value **argv) {
+  if (argc < 1 || argc > 2) {
+    evaluationError("wrong number of args in memoize");
+  }
+  if (typeOf(argv[0]) != CLOSURE_TYPE && typeOf(argv[0]) != PRIMITIVE_TYPE) {
+    evaluationError("wrong type arg in memoize");
+  }
+
+  int capacity = DEFAULT_MEMO_SIZE;
+  if (argc == 2) {
+    if (typeOf(argv[1]) != INT_TYPE || argv[1]->i < 1) {
+      evaluationError("cache size in memoize must be a positive integer");
+    }
+    if (argv[1]->i > MAX_MEMO_SIZE) {
+      evaluationError("cache size in memoize is too large");
+    }
+    capacity = argv[1]->i;
+  }
+
+  Value *memoized = makeValue(MEMO_TYPE);
+  memoized->p = newMemo(argv[0], capacity);
+  return memoized;
+}
+
+Value *makeCounter(char *name, long count) {
+  Value *key = makeValue(SYMBOL_TYPE);
+  key->s = name;
+  Value *number = makeValue(INT_TYPE);
+  number->i = (int) count;
+  return cons(key, number);
+}
+
+//(memo-stats f) returns an association list of the cache's counters
+Value *primitiveMemoStats(int argc, Value **argv) {
+  if (argc != 1 || typeOf(argv[0]) != MEMO_TYPE) {
+    evaluationError("memo-stats needs one memoized procedure");
+  }
+  Memo *memo = argv[0]->p;
+  Value *stats = makeNull();
+  stats = cons(makeCounter("capacity", memo->capacity), stats);
+  stats = cons(makeCounter("size", memo->count), stats);
+  stats = cons(makeCounter("evictions", memo->evictions), stats);
+  stats = cons(makeCounter("misses", memo->misses), stats);
+  stats = cons(makeCounter("hits", memo->hits), stats);
+  return stats;
+}
+
+void bindMemoPrimitives(Frame *frame) {
+  bind("memoize", primitiveMemoize, frame);
+  bind("memo-stats", primitiveMemoStats, frame);
+}
@@ -0,0 +1,19 @@
+#include <stddef.h>
+#include "value.h"
+#include "heapdump.h"
+
+#ifndef _MEMO
+#define _MEMO
+
+// Call a memoized procedure, answering from its cache when the same
+// arguments have been seen before.
+Value *memoApply(Value *memoized, int argc, Value **argv);
+
+// Add a memoized procedure's procedure and what it has cached to a heap
+// dump's walk, and return the bytes its cache takes up.
+size_t walkMemo(void *memo, HeapWalk *walk);
+
+// Bind memoize and memo-stats in the given frame.
+void bindMemoPrimitives(Frame *frame);
+
+#endif
@@ -0,0 +1,178 @@
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <pthread.h>
+#include "value.h"
+#include "metrics.h"
+
+// Each thread counts into its own Metrics, so that futures running on
+// worker threads don't contend for the counters; a worker adds its counts
+// to the totals when it exits, and printMetrics adds the main thread's.
+// Small numbers get a histogram bucket each, larger ones share a bucket
+// per power of two.
+
+#define SMALL_BUCKETS 8
+#define BUCKET_COUNT 16
+
+// The special forms eval recognizes, in the order it tries them. Anything
+// else is a procedure call.
+static char *formNames[] = {
+  "if", "let", "let*", "letrec", "cond", "set!", "begin", "quote", "define",
+  "lambda", "or", "and", "future", "spawn"
+};
+#define FORM_COUNT (int) (sizeof(formNames) / sizeof(formNames[0]))
+
+typedef enum {
+  APPLY_PRIMITIVE,
+  APPLY_CLOSURE,
+  APPLY_MEMO,
+  APPLY_OTHER,
+  APPLY_INLINED,
+  APPLY_COUNT
+} ApplyKind;
+
+static char *applyNames[] = {
+  "primitive", "closure", "memoized", "not a procedure", "inlined arithmetic"
+};
+
+typedef struct Metrics {
+  long cachedLookups;
+  long walked[BUCKET_COUNT];
+  long compared[BUCKET_COUNT];
+  // one more for calls
+  long forms[FORM_COUNT + 1];
+  long arguments[BUCKET_COUNT];
+  long applies[APPLY_COUNT];
+} Metrics;
+
+bool metering = false;
+
+_Thread_local Metrics threadMetrics;
+Metrics totals;
+pthread_mutex_t totalsLock = PTHREAD_MUTEX_INITIALIZER;
+
+int bucketOf(int n) {
+  if (n < SMALL_BUCKETS) {
+    return n;
+  }
+  int bucket = SMALL_BUCKETS + (31 - __builtin_clz(n)) - 3;
+  return bucket < BUCKET_COUNT ? bucket : BUCKET_COUNT - 1;
+}
+
+void meterLookup(int walked, int compared) {
+  threadMetrics.walked[bucketOf(walked)]++;
+  threadMetrics.compared[bucketOf(compared)]++;
+}
+
+void meterCachedLookup() {
+  threadMetrics.cachedLookups++;
+}
+
+void meterForm(char *name) {
+  int form = 0;
+  while (form < FORM_COUNT && (name == NULL || strcmp(name, formNames[form]))) {
+    form++;
+  }
+  threadMetrics.forms[form]++;
+}
+
+void meterArguments(int argc) {
+  threadMetrics.arguments[bucketOf(argc)]++;
+}
+
+void meterApply(Value *function) {
+  switch (typeOf(function)) {
+    case PRIMITIVE_TYPE:
+      threadMetrics.applies[APPLY_PRIMITIVE]++;
+      break;
+    case CLOSURE_TYPE:
+      threadMetrics.applies[APPLY_CLOSURE]++;
+      break;
+    case MEMO_TYPE:
+      threadMetrics.applies[APPLY_MEMO]++;
+      break;
+    default:
+      threadMetrics.applies[APPLY_OTHER]++;
+      break;
+  }
+}
+
+void meterInlined() {
+  threadMetrics.applies[APPLY_INLINED]++;
+}
+
+void flushMetrics() {
+  long *from = (long *) &threadMetrics;
+  long *to = (long *) &totals;
+  pthread_mutex_lock(&totalsLock);
+  for (size_t i = 0; i < sizeof(Metrics) / sizeof(long); i++) {
+    to[i] += from[i];
+  }
+  pthread_mutex_unlock(&totalsLock);
+  memset(&threadMetrics, 0, sizeof(Metrics));
+}
+
+long sum(long *counts, int n) {
+  long total = 0;
+  for (int i = 0; i < n; i++) {
+    total += counts[i];
+  }
+  return total;
+}
+
+void printRow(FILE *stream, char *label, long count, long total) {
+  fprintf(stream, "  %-20s %12ld %6.1f%%\n", label, count,
+          total > 0 ? 100.0 * count / total : 0.0);
+}
+
+// One row per bucket, up to the last one anything fell in.
+void printHistogram(FILE *stream, char *title, long *counts) {
+  long total = sum(counts, BUCKET_COUNT);
+  int last = BUCKET_COUNT - 1;
+  while (last > 0 && counts[last] == 0) {
+    last--;
+  }
+  fprintf(stream, "  %-20s %12s\n", title, "count");
+  for (int i = 0; i <= last; i++) {
+    char label[32];
+    if (i < SMALL_BUCKETS) {
+      snprintf(label, sizeof(label), "%d", i);
+    }
+    else if (i == BUCKET_COUNT - 1) {
+      snprintf(label, sizeof(label), "%d+", 1 << (i - SMALL_BUCKETS + 3));
+    }
+    else {
+      snprintf(label, sizeof(label), "%d-%d", 1 << (i - SMALL_BUCKETS + 3),
+               (1 << (i - SMALL_BUCKETS + 4)) - 1);
+    }
+    printRow(stream, label, counts[i], total);
+  }
+}
+
+void printMetrics(FILE *stream) {
+  flushMetrics();
+  long walkedLookups = sum(totals.walked, BUCKET_COUNT);
+  long lookups = walkedLookups + totals.cachedLookups;
+  fprintf(stream, "eval metrics: %ld variable lookups, %ld (%.1f%%) from a cached global binding\n",
+          lookups, totals.cachedLookups,
+          lookups > 0 ? 100.0 * totals.cachedLookups / lookups : 0.0);
+  printHistogram(stream, "frames walked", totals.walked);
+  printHistogram(stream, "bindings compared", totals.compared);
+
+  long forms = sum(totals.forms, FORM_COUNT + 1);
+  fprintf(stream, "  %-20s %12s\n", "compound forms", "count");
+  for (int i = 0; i < FORM_COUNT; i++) {
+    if (totals.forms[i] > 0) {
+      printRow(stream, formNames[i], totals.forms[i], forms);
+    }
+  }
+  printRow(stream, "(call)", totals.forms[FORM_COUNT], forms);
+
+  printHistogram(stream, "arguments evaluated", totals.arguments);
+
+  long applies = sum(totals.applies, APPLY_COUNT);
+  fprintf(stream, "  %-20s %12s\n", "calls", "count");
+  for (int i = 0; i < APPLY_COUNT; i++) {
+    printRow(stream, applyNames[i], totals.applies[i], applies);
+  }
+}
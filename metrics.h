@@ -0,0 +1,36 @@
+#include <stdio.h>
+#include <stdbool.h>
+#include "value.h"
+
+#ifndef _METRICS
+#define _METRICS
+
+// Whether the evaluator is counting what it does, for --eval-metrics. Set
+// before any program runs.
+extern bool metering;
+
+// A variable reference that findBinding resolved by walking frames (walked
+// of them, comparing names with compared bindings along the way), or
+// straight from the symbol's cached global binding.
+void meterLookup(int walked, int compared);
+void meterCachedLookup();
+
+// A compound expression eval is about to handle, named by its first
+// element if that's a symbol (name is NULL otherwise).
+void meterForm(char *name);
+
+// An argument list of argc expressions evaluated by evalEach.
+void meterArguments(int argc);
+
+// A call through apply, and a two-operand arithmetic call eval did inline.
+void meterApply(Value *function);
+void meterInlined();
+
+// Add this thread's counts to the totals.
+void flushMetrics();
+
+// Flush the calling thread's counts, then print the totals from every
+// thread as histograms and tables.
+void printMetrics(FILE *stream);
+
+#endif
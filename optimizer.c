@@ -0,0 +1,647 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include "value.h"
+#include "linkedlist.h"
+#include "talloc.h"
+#include "interpreter.h"
+#include "escape.h"
+#include "optimizer.h"
+
+// A source-to-source pass over the parse tree, run once before evaluation.
+// It folds +, -, *, <, > and = applied to two numeric literals, picks the
+// branch of an if whose test is a boolean literal, turns an immediately
+// applied lambda into a let (substituting the arguments that are constants),
+// and inlines calls to small top-level procedures.
+//
+// Every rewrite has to leave the program's behaviour alone, errors
+// included, so each one only fires when it provably can't change anything:
+// a primitive is only folded or a procedure inlined if its name is never
+// assigned with set!, never defined anywhere but once at top level, and not
+// shadowed by a local binding at that point. Anything malformed is left for
+// the evaluator to report.
+
+// The most leaves a procedure body may have and still be inlined.
+#define INLINE_LIMIT 24
+
+// What the program does with one name, gathered before rewriting.
+typedef struct NameInfo {
+  char *name;
+  int topLevelDefines;
+  // the target of a set! somewhere
+  bool assigned;
+  // defined somewhere other than at top level
+  bool definedLocally;
+  // the lambda to inline calls with, once its define has been passed
+  Value *procedure;
+  // the procedure body's free names, as a list of symbols
+  Value *freeNames;
+} NameInfo;
+
+// Per thread, since separate interpreters may be optimizing at once.
+_Thread_local NameInfo *names = NULL;
+_Thread_local int nameCapacity = 0;
+_Thread_local int nameCount = 0;
+
+_Thread_local bool reporting = false;
+_Thread_local int foldCount = 0;
+_Thread_local int ifCount = 0;
+_Thread_local int betaCount = 0;
+_Thread_local int inlineCount = 0;
+
+Value *optimizeExpr(Value *expr, Value *scope);
+
+// Finds the entry for name in the open-addressed table, adding one if it
+// isn't there yet.
+NameInfo *lookUpName(char *name) {
+  if (nameCount * 2 >= nameCapacity) {
+    NameInfo *old = names;
+    int oldCapacity = nameCapacity;
+    nameCapacity = nameCapacity == 0 ? 256 : nameCapacity * 2;
+    names = talloc(sizeof(NameInfo) * nameCapacity);
+    memset(names, 0, sizeof(NameInfo) * nameCapacity);
+    nameCount = 0;
+    for (int i = 0; i < oldCapacity; i++) {
+      if (old[i].name != NULL) {
+        *lookUpName(old[i].name) = old[i];
+      }
+    }
+  }
+
+  unsigned long hash = 14695981039346656037UL;
+  for (char *c = name; *c != '\0'; c++) {
+    hash = (hash ^ (unsigned char) *c) * 1099511628211UL;
+  }
+  int i = hash & (nameCapacity - 1);
+  while (names[i].name != NULL && strcmp(names[i].name, name)) {
+    i = (i + 1) & (nameCapacity - 1);
+  }
+  if (names[i].name == NULL) {
+    names[i].name = name;
+    nameCount++;
+  }
+  return &names[i];
+}
+
+bool isKeyword(char *name) {
+  char *keywords[] = {"if", "let", "let*", "letrec", "cond", "set!", "begin",
+    "quote", "define", "lambda", "or", "and", "future", "spawn", "else"};
+  for (int i = 0; i < (int) (sizeof(keywords) / sizeof(keywords[0])); i++) {
+    if (!strcmp(name, keywords[i])) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool inScope(Value *scope, char *name) {
+  while (typeOf(scope) == CONS_TYPE) {
+    if (!strcmp(car(scope)->s, name)) {
+      return true;
+    }
+    scope = cdr(scope);
+  }
+  return false;
+}
+
+bool isConstant(Value *expr) {
+  valueType type = typeOf(expr);
+  return type == INT_TYPE || type == DOUBLE_TYPE || type == BOOL_TYPE || type == STR_TYPE;
+}
+
+// A fresh copy of an expression, so that a rewritten site never shares
+// structure (or, later, annotations) with another.
+Value *copyExpr(Value *expr) {
+  if (typeOf(expr) == CONS_TYPE) {
+    return cons(copyExpr(car(expr)), copyExpr(cdr(expr)));
+  }
+  if (typeOf(expr) == NULL_TYPE) {
+    return makeNull();
+  }
+  Value *copy = makeValue(typeOf(expr));
+  *copy = *expr;
+  return copy;
+}
+
+// Whether a lambda parameter list is a proper list of distinct symbols.
+bool simpleParams(Value *params) {
+  while (typeOf(params) == CONS_TYPE) {
+    if (typeOf(car(params)) != SYMBOL_TYPE) {
+      return false;
+    }
+    for (Value *rest = cdr(params); typeOf(rest) == CONS_TYPE; rest = cdr(rest)) {
+      if (typeOf(car(rest)) == SYMBOL_TYPE && !strcmp(car(rest)->s, car(params)->s)) {
+        return false;
+      }
+    }
+    params = cdr(params);
+  }
+  return typeOf(params) == NULL_TYPE;
+}
+
+// Whether expr is (lambda params body) with a parameter list lambda accepts:
+// symbols, possibly ending in (or consisting of) a rest symbol.
+bool wellFormedLambda(Value *expr) {
+  if (!isForm(expr, "lambda") || typeOf(cdr(expr)) != CONS_TYPE
+      || typeOf(cdr(cdr(expr))) != CONS_TYPE || typeOf(cdr(cdr(cdr(expr)))) != NULL_TYPE) {
+    return false;
+  }
+  Value *params = car(cdr(expr));
+  while (typeOf(params) == CONS_TYPE) {
+    if (typeOf(car(params)) != SYMBOL_TYPE) {
+      return false;
+    }
+    params = cdr(params);
+  }
+  return typeOf(params) == NULL_TYPE || typeOf(params) == SYMBOL_TYPE;
+}
+
+// Whether expr is a let, let* or letrec with a body and a proper list of
+// (name init) bindings.
+bool wellFormedLet(Value *expr) {
+  if (typeOf(cdr(expr)) != CONS_TYPE || typeOf(cdr(cdr(expr))) != CONS_TYPE) {
+    return false;
+  }
+  Value *bindings = car(cdr(expr));
+  while (typeOf(bindings) == CONS_TYPE) {
+    Value *binding = car(bindings);
+    if (typeOf(binding) != CONS_TYPE || typeOf(car(binding)) != SYMBOL_TYPE
+        || typeOf(cdr(binding)) != CONS_TYPE || typeOf(cdr(cdr(binding))) != NULL_TYPE) {
+      return false;
+    }
+    bindings = cdr(bindings);
+  }
+  return typeOf(bindings) == NULL_TYPE;
+}
+
+bool isLet(Value *expr) {
+  return isForm(expr, "let") || isForm(expr, "let*") || isForm(expr, "letrec");
+}
+
+// Adds the names a lambda's parameter list binds to scope.
+Value *bindParams(Value *params, Value *scope) {
+  while (typeOf(params) == CONS_TYPE) {
+    scope = cons(car(params), scope);
+    params = cdr(params);
+  }
+  if (typeOf(params) == SYMBOL_TYPE) {
+    scope = cons(params, scope);
+  }
+  return scope;
+}
+
+// First pass: count top-level defines, and note every name that is assigned
+// or defined anywhere else.
+void collectNames(Value *expr, bool topLevel) {
+  if (typeOf(expr) != CONS_TYPE || isForm(expr, "quote")) {
+    return;
+  }
+  if ((isForm(expr, "define") || isForm(expr, "set!"))
+      && typeOf(cdr(expr)) == CONS_TYPE && typeOf(car(cdr(expr))) == SYMBOL_TYPE) {
+    NameInfo *info = lookUpName(car(cdr(expr))->s);
+    if (isForm(expr, "set!")) {
+      info->assigned = true;
+    }
+    else if (topLevel) {
+      info->topLevelDefines++;
+    }
+    else {
+      info->definedLocally = true;
+    }
+  }
+  while (typeOf(expr) == CONS_TYPE) {
+    collectNames(car(expr), false);
+    expr = cdr(expr);
+  }
+}
+
+// Whether a global name always refers to what its single top-level define
+// (or, with no define, the builtin) binds it to.
+bool neverRebound(char *name) {
+  NameInfo *info = lookUpName(name);
+  return !info->assigned && !info->definedLocally;
+}
+
+// Whether expr sets or defines name anywhere inside.
+bool assigns(Value *expr, char *name) {
+  if (typeOf(expr) != CONS_TYPE || isForm(expr, "quote")) {
+    return false;
+  }
+  if ((isForm(expr, "define") || isForm(expr, "set!")) && typeOf(cdr(expr)) == CONS_TYPE
+      && typeOf(car(cdr(expr))) == SYMBOL_TYPE && !strcmp(car(cdr(expr))->s, name)) {
+    return true;
+  }
+  while (typeOf(expr) == CONS_TYPE) {
+    if (assigns(car(expr), name)) {
+      return true;
+    }
+    expr = cdr(expr);
+  }
+  return false;
+}
+
+Value *substitute(Value *expr, char *name, Value *constant);
+
+// Substitutes into every element of a list; false if any of them couldn't
+// be.
+bool substituteEach(Value *list, char *name, Value *constant) {
+  while (typeOf(list) == CONS_TYPE) {
+    Value *substituted = substitute(car(list), name, constant);
+    if (substituted == NULL) {
+      return false;
+    }
+    setCar(list, substituted);
+    list = cdr(list);
+  }
+  return true;
+}
+
+// Replaces the free occurrences of name in expr with copies of constant,
+// stopping wherever a lambda or let binds name again. Rewrites in place, and
+// returns NULL if expr contains a binding form too malformed to be sure
+// about.
+Value *substitute(Value *expr, char *name, Value *constant) {
+  if (typeOf(expr) == SYMBOL_TYPE) {
+    return strcmp(expr->s, name) ? expr : copyExpr(constant);
+  }
+  if (typeOf(expr) != CONS_TYPE || isForm(expr, "quote")) {
+    return expr;
+  }
+
+  if (isForm(expr, "lambda")) {
+    if (!wellFormedLambda(expr)) {
+      return NULL;
+    }
+    if (inScope(bindParams(car(cdr(expr)), makeNull()), name)) {
+      return expr;
+    }
+    return substituteEach(cdr(cdr(expr)), name, constant) ? expr : NULL;
+  }
+
+  if (isLet(expr)) {
+    if (!wellFormedLet(expr)) {
+      return NULL;
+    }
+    bool letrec = isForm(expr, "letrec");
+    bool sequential = isForm(expr, "let*");
+    bool shadowed = false;
+    for (Value *binding = car(cdr(expr)); typeOf(binding) == CONS_TYPE; binding = cdr(binding)) {
+      if (!strcmp(car(car(binding))->s, name)) {
+        shadowed = true;
+      }
+    }
+    if (letrec && shadowed) {
+      return expr;
+    }
+    //the initializers see the outer name, except in a let* after the
+    //binding that shadows it
+    for (Value *binding = car(cdr(expr)); typeOf(binding) == CONS_TYPE; binding = cdr(binding)) {
+      if (!substituteEach(cdr(car(binding)), name, constant)) {
+        return NULL;
+      }
+      if (sequential && !strcmp(car(car(binding))->s, name)) {
+        return expr;
+      }
+    }
+    if (shadowed) {
+      return expr;
+    }
+    return substituteEach(cdr(cdr(expr)), name, constant) ? expr : NULL;
+  }
+
+  if (isForm(expr, "cond")) {
+    for (Value *clause = cdr(expr); typeOf(clause) == CONS_TYPE; clause = cdr(clause)) {
+      if (!substituteEach(car(clause), name, constant)) {
+        return NULL;
+      }
+    }
+    return expr;
+  }
+
+  if (isForm(expr, "define") || isForm(expr, "set!")) {
+    if (typeOf(cdr(expr)) != CONS_TYPE) {
+      return NULL;
+    }
+    return substituteEach(cdr(cdr(expr)), name, constant) ? expr : NULL;
+  }
+
+  if (typeOf(car(expr)) == SYMBOL_TYPE && isKeyword(car(expr)->s)) {
+    return substituteEach(cdr(expr), name, constant) ? expr : NULL;
+  }
+  return substituteEach(expr, name, constant) ? expr : NULL;
+}
+
+// Rewrites ((lambda (p ...) body) a ...) as (let ((p a) ...) body). A
+// parameter whose argument is a constant, and which the body never assigns,
+// is substituted into the body instead of bound; if that covers them all,
+// the result is just the body. The arguments have already been optimized;
+// the body is optimized here, once the constants are in it. The caller
+// checks that the lambda is well formed and the argument count matches.
+Value *betaReduce(Value *lambda, Value *args, Value *scope) {
+  Value *body = car(cdr(cdr(lambda)));
+  Value *bindings = makeNull();
+  Value *last = NULL;
+  Value *bodyScope = scope;
+
+  Value *param = car(cdr(lambda));
+  Value *arg = args;
+  while (typeOf(param) == CONS_TYPE) {
+    char *name = car(param)->s;
+    Value *substituted = NULL;
+    if (isConstant(car(arg)) && !isKeyword(name) && !assigns(body, name)) {
+      substituted = substitute(copyExpr(body), name, car(arg));
+    }
+
+    if (substituted != NULL) {
+      body = substituted;
+    }
+    else {
+      Value *binding = cons(cons(car(param), cons(car(arg), makeNull())), makeNull());
+      if (last == NULL) {
+        bindings = binding;
+      }
+      else {
+        setCdr(last, binding);
+      }
+      last = binding;
+      bodyScope = cons(car(param), bodyScope);
+    }
+    param = cdr(param);
+    arg = cdr(arg);
+  }
+
+  body = optimizeExpr(body, bodyScope);
+  if (typeOf(bindings) == NULL_TYPE) {
+    return body;
+  }
+  Value *let = makeValue(SYMBOL_TYPE);
+  let->s = "let";
+  return cons(let, cons(bindings, cons(body, makeNull())));
+}
+
+void report(char *what, Value *expr, char *detail, Value *result) {
+  if (!reporting) {
+    return;
+  }
+  fprintf(stderr, "optimizer: %s ", what);
+  fprintValue(stderr, expr);
+  if (result != NULL) {
+    fprintf(stderr, " %s ", detail);
+    fprintValue(stderr, result);
+  }
+  fprintf(stderr, "\n");
+}
+
+// Optimizes each element of a list in place.
+void optimizeEach(Value *list, Value *scope) {
+  while (typeOf(list) == CONS_TYPE) {
+    setCar(list, optimizeExpr(car(list), scope));
+    list = cdr(list);
+  }
+}
+
+// let inits see the outer scope, let* inits each see the names before them,
+// and letrec inits see all of them; the body sees them all.
+void optimizeLet(Value *expr, Value *scope) {
+  Value *bindings = car(cdr(expr));
+  Value *innerScope = scope;
+  for (Value *binding = bindings; typeOf(binding) == CONS_TYPE; binding = cdr(binding)) {
+    innerScope = cons(car(car(binding)), innerScope);
+  }
+
+  Value *initScope = isForm(expr, "letrec") ? innerScope : scope;
+  for (Value *binding = bindings; typeOf(binding) == CONS_TYPE; binding = cdr(binding)) {
+    optimizeEach(cdr(car(binding)), initScope);
+    if (isForm(expr, "let*")) {
+      initScope = cons(car(car(binding)), initScope);
+    }
+  }
+  optimizeEach(cdr(cdr(expr)), innerScope);
+}
+
+// The rewrites that apply to a procedure call whose operator and operands
+// have been optimized already.
+Value *optimizeCall(Value *expr, Value *scope) {
+  Value *operator = car(expr);
+  Value *args = cdr(expr);
+  int argc = 0;
+  Value *curArg = args;
+  while (typeOf(curArg) == CONS_TYPE) {
+    argc++;
+    curArg = cdr(curArg);
+  }
+  if (typeOf(curArg) != NULL_TYPE || typeOf(operator) != SYMBOL_TYPE
+      || inScope(scope, operator->s)) {
+    return expr;
+  }
+
+  char *name = operator->s;
+  NameInfo *info = lookUpName(name);
+
+  if (argc == 2 && strlen(name) == 1 && strchr("+-*<>=", name[0]) != NULL
+      && info->topLevelDefines == 0 && neverRebound(name)) {
+    Value number;
+    if (binaryArithmetic(name[0], car(args), car(cdr(args)), &number)) {
+      Value *folded = makeValue(number.type);
+      if (number.type == DOUBLE_TYPE) {
+        folded->d = number.d;
+      }
+      else {
+        folded->i = number.i;
+      }
+      foldCount++;
+      report("folded", expr, "to", folded);
+      return folded;
+    }
+  }
+
+  if (info->procedure != NULL && length(car(cdr(info->procedure))) == argc) {
+    for (Value *free = info->freeNames; typeOf(free) == CONS_TYPE; free = cdr(free)) {
+      if (inScope(scope, car(free)->s)) {
+        return expr;
+      }
+    }
+    inlineCount++;
+    report("inlined", expr, NULL, NULL);
+    return betaReduce(copyExpr(info->procedure), args, scope);
+  }
+  return expr;
+}
+
+Value *optimizeExpr(Value *expr, Value *scope) {
+  if (typeOf(expr) != CONS_TYPE || isForm(expr, "quote")) {
+    return expr;
+  }
+
+  if (isForm(expr, "lambda")) {
+    if (wellFormedLambda(expr)) {
+      optimizeEach(cdr(cdr(expr)), bindParams(car(cdr(expr)), scope));
+    }
+    return expr;
+  }
+
+  if (isLet(expr)) {
+    if (wellFormedLet(expr)) {
+      optimizeLet(expr, scope);
+    }
+    return expr;
+  }
+
+  if (isForm(expr, "cond")) {
+    for (Value *clause = cdr(expr); typeOf(clause) == CONS_TYPE; clause = cdr(clause)) {
+      optimizeEach(car(clause), scope);
+    }
+    return expr;
+  }
+
+  if (isForm(expr, "define") || isForm(expr, "set!")) {
+    if (typeOf(cdr(expr)) == CONS_TYPE) {
+      optimizeEach(cdr(cdr(expr)), scope);
+    }
+    return expr;
+  }
+
+  if (isForm(expr, "if")) {
+    optimizeEach(cdr(expr), scope);
+    //only when there are exactly three parts; otherwise it's an error that
+    //eval should still report
+    Value *args = cdr(expr);
+    if (length(args) == 3 && typeOf(car(args)) == BOOL_TYPE) {
+      ifCount++;
+      report("simplified", expr, NULL, NULL);
+      return car(args)->i ? car(cdr(args)) : car(cdr(cdr(args)));
+    }
+    return expr;
+  }
+
+  if (typeOf(car(expr)) == SYMBOL_TYPE && isKeyword(car(expr)->s)) {
+    optimizeEach(cdr(expr), scope);
+    return expr;
+  }
+
+  //an immediately applied lambda: its arguments first, then its body once
+  //the constants are substituted in
+  if (wellFormedLambda(car(expr)) && simpleParams(car(cdr(car(expr))))
+      && length(car(cdr(car(expr)))) == length(cdr(expr))) {
+    optimizeEach(cdr(expr), scope);
+    betaCount++;
+    report("beta-reduced", expr, NULL, NULL);
+    return betaReduce(car(expr), cdr(expr), scope);
+  }
+
+  optimizeEach(expr, scope);
+  return optimizeCall(expr, scope);
+}
+
+// Counts the leaves in a procedure body, or returns -1 if the body contains
+// anything that would make inlining it unsafe or not worthwhile: a lambda,
+// any binding form but let, define or set!.
+int inlineSize(Value *expr) {
+  if (typeOf(expr) != CONS_TYPE) {
+    return 1;
+  }
+  if (isForm(expr, "quote")) {
+    return 1;
+  }
+  if (isForm(expr, "lambda") || isForm(expr, "let*") || isForm(expr, "letrec")
+      || isForm(expr, "define") || isForm(expr, "set!")) {
+    return -1;
+  }
+  if (isForm(expr, "let") && !wellFormedLet(expr)) {
+    return -1;
+  }
+  int size = 0;
+  while (typeOf(expr) == CONS_TYPE) {
+    int elementSize = inlineSize(car(expr));
+    if (elementSize < 0) {
+      return -1;
+    }
+    size += elementSize;
+    expr = cdr(expr);
+  }
+  return size;
+}
+
+// Adds the names expr refers to without binding them itself to free. expr
+// has passed inlineSize, so the only binding form in it is let.
+Value *collectFreeNames(Value *expr, Value *bound, Value *free) {
+  if (typeOf(expr) == SYMBOL_TYPE) {
+    if (!inScope(bound, expr->s) && !inScope(free, expr->s)) {
+      free = cons(expr, free);
+    }
+    return free;
+  }
+  if (typeOf(expr) != CONS_TYPE || isForm(expr, "quote")) {
+    return free;
+  }
+  if (isForm(expr, "let")) {
+    Value *innerBound = bound;
+    for (Value *binding = car(cdr(expr)); typeOf(binding) == CONS_TYPE; binding = cdr(binding)) {
+      free = collectFreeNames(car(cdr(car(binding))), bound, free);
+      innerBound = cons(car(car(binding)), innerBound);
+    }
+    for (Value *body = cdr(cdr(expr)); typeOf(body) == CONS_TYPE; body = cdr(body)) {
+      free = collectFreeNames(car(body), innerBound, free);
+    }
+    return free;
+  }
+  if (typeOf(car(expr)) == SYMBOL_TYPE && isKeyword(car(expr)->s)) {
+    expr = cdr(expr);
+  }
+  while (typeOf(expr) == CONS_TYPE) {
+    free = collectFreeNames(car(expr), bound, free);
+    expr = cdr(expr);
+  }
+  return free;
+}
+
+// After a top-level (define f (lambda ...)) has been optimized, decides
+// whether later calls to f may be inlined. f must be defined just this once
+// and never assigned, take a fixed number of parameters, and have a small
+// body that doesn't refer to f (even through procedures inlined into it).
+void considerInlining(Value *expr) {
+  if (!isForm(expr, "define") || length(expr) != 3 || typeOf(car(cdr(expr))) != SYMBOL_TYPE) {
+    return;
+  }
+  Value *name = car(cdr(expr));
+  Value *lambda = car(cdr(cdr(expr)));
+  NameInfo *info = lookUpName(name->s);
+  if (info->topLevelDefines != 1 || !neverRebound(name->s)
+      || !wellFormedLambda(lambda) || !simpleParams(car(cdr(lambda)))) {
+    return;
+  }
+
+  Value *body = car(cdr(cdr(lambda)));
+  int size = inlineSize(body);
+  if (size < 0 || size > INLINE_LIMIT) {
+    return;
+  }
+  Value *free = collectFreeNames(body, car(cdr(lambda)), makeNull());
+  if (inScope(free, name->s)) {
+    return;
+  }
+  info->procedure = lambda;
+  info->freeNames = free;
+}
+
+Value *optimize(Value *tree, bool report) {
+  //the table is in the heap of whichever context ran last
+  names = NULL;
+  nameCapacity = nameCount = 0;
+  foldCount = ifCount = betaCount = inlineCount = 0;
+  reporting = report;
+  for (Value *curExpr = tree; typeOf(curExpr) == CONS_TYPE; curExpr = cdr(curExpr)) {
+    collectNames(car(curExpr), true);
+  }
+
+  for (Value *curExpr = tree; typeOf(curExpr) == CONS_TYPE; curExpr = cdr(curExpr)) {
+    setCar(curExpr, optimizeExpr(car(curExpr), makeNull()));
+    considerInlining(car(curExpr));
+  }
+
+  if (reporting) {
+    fprintf(stderr, "optimizer: %i folded, %i ifs simplified, %i lambdas beta-reduced, %i calls inlined\n",
+      foldCount, ifCount, betaCount, inlineCount);
+  }
+  return tree;
+}
@@ -0,0 +1,13 @@
+#include <stdbool.h>
+#include "value.h"
+
+#ifndef _OPTIMIZER
+#define _OPTIMIZER
+
+// Rewrites the parse tree before it is interpreted: folds constant
+// arithmetic, simplifies ifs with constant tests, beta-reduces immediately
+// applied lambdas and inlines small top-level procedures. With report set,
+// each rewrite is described on stderr.
+Value *optimize(Value *tree, bool report);
+
+#endif
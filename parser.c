@@ -20,6 +20,7 @@ void printTree(Value *tree);
 // Takes a list of tokens from a Racket program, and returns a pointer to a
 // parse tree representing that program.
 Value *parse(Value *tokens) {
+  AllocSite outerSite = tallocSetSite(SITE_PARSER);
 
   Value *tree = makeNull();
   int depth = 0;
@@ -27,10 +28,10 @@ Value *parse(Value *tokens) {
   Value *current = tokens;
   assert(current != NULL && "Error (parse): null pointer");
   
-  while (current->type != NULL_TYPE) {
+  while (typeOf(current) != NULL_TYPE) {
     Value *token = car(current);
-    if (token->type != CLOSE_TYPE) {
-      if (token->type == OPEN_TYPE) {
+    if (typeOf(token) != CLOSE_TYPE) {
+      if (typeOf(token) == OPEN_TYPE) {
         depth++;
       }
       tree = addToParseTree(token, tree);
@@ -48,6 +49,7 @@ Value *parse(Value *tokens) {
   }
 
   tree = reverseParseTree(tree);
+  tallocSetSite(outerSite);
   return tree;
 }
 
@@ -63,13 +65,13 @@ Value *makeSubTree(Value *tree) {
   Value *subTree = makeNull();
   Value *current = tree;
 
-  while (current->type != NULL_TYPE && car(current)->type != OPEN_TYPE) {
+  while (typeOf(current) != NULL_TYPE && typeOf(car(current)) != OPEN_TYPE) {
     Value *token = car(current);
     subTree = cons(token, subTree);
     current = cdr(current);
   }
 
-  if (current->type == NULL_TYPE) {
+  if (typeOf(current) == NULL_TYPE) {
     syntaxError(-1);
   }
 
@@ -84,11 +86,11 @@ void printTree(Value *tree) {
   
   Value *curVal = tree;
 
-  while (curVal->type != NULL_TYPE) {
-    if (car(curVal)->type == CONS_TYPE) {
+  while (typeOf(curVal) != NULL_TYPE) {
+    if (typeOf(car(curVal)) == CONS_TYPE) {
       printSubTree(car(curVal));
     }
-    else if (car(curVal)->type == NULL_TYPE) {
+    else if (typeOf(car(curVal)) == NULL_TYPE) {
       printf("()");
     }
     else {
@@ -106,18 +108,18 @@ void printSubTree(Value *subTree) {
   printf("(");
 
   Value *curVal = subTree; 
-  while (curVal->type != NULL_TYPE) {
+  while (typeOf(curVal) != NULL_TYPE) {
     
-    if (curVal->type == CONS_TYPE) {
+    if (typeOf(curVal) == CONS_TYPE) {
       
-      if (cdr(curVal)->type != CONS_TYPE && cdr(curVal)->type != NULL_TYPE) {
-        if (car(curVal)->type != CONS_TYPE && car(curVal)->type != NULL_TYPE) {
+      if (typeOf(cdr(curVal)) != CONS_TYPE && typeOf(cdr(curVal)) != NULL_TYPE) {
+        if (typeOf(car(curVal)) != CONS_TYPE && typeOf(car(curVal)) != NULL_TYPE) {
           printToken(car(curVal));
           printf(" . ");
           printToken(cdr(curVal));
         }
         else {
-          if (car(car(curVal))->type != CONS_TYPE) {
+          if (typeOf(car(car(curVal))) != CONS_TYPE) {
             printSubTree(car(curVal));
           }
           else {
@@ -129,15 +131,15 @@ void printSubTree(Value *subTree) {
         break;
       }
 
-      else if (car(curVal)->type == CONS_TYPE) {
-        if (car(car(curVal))->type != CONS_TYPE) {
+      else if (typeOf(car(curVal)) == CONS_TYPE) {
+        if (typeOf(car(car(curVal))) != CONS_TYPE) {
             printSubTree(car(curVal));
           }
           else {
             printSubTree(car(car(curVal)));
           }
       }
-      else if (car(curVal)->type == NULL_TYPE) {
+      else if (typeOf(car(curVal)) == NULL_TYPE) {
         printf("()");
       }
       else {
@@ -156,16 +158,16 @@ void printSubTree(Value *subTree) {
 }
 
 void printToken(Value *token) {
-  if (token->type == INT_TYPE) {
+  if (typeOf(token) == INT_TYPE) {
     printf("%i ", token->i);
   }
-  else if (token->type == DOUBLE_TYPE) {
+  else if (typeOf(token) == DOUBLE_TYPE) {
     printf("%0.6f ", token->d);
   }
-  else if (token->type == STR_TYPE || token->type == SYMBOL_TYPE) {
+  else if (typeOf(token) == STR_TYPE || typeOf(token) == SYMBOL_TYPE) {
     printf("%s ", token->s);
   }
-  else if (token->type == BOOL_TYPE) {
+  else if (typeOf(token) == BOOL_TYPE) {
     if (token->i == 1) {
       printf("#t ");
     }
@@ -185,9 +187,9 @@ Value *reverseParseTree(Value *tree) {
   Value *prevVal = makeNull();
   Value *nextVal;
 
-  while (curVal->type != NULL_TYPE) {
+  while (typeOf(curVal) != NULL_TYPE) {
     nextVal = cdr(curVal);
-    (curVal->c).cdr = prevVal;
+    setCdr(curVal, prevVal);
     prevVal = curVal;
     curVal = nextVal;
   }
@@ -197,8 +199,8 @@ Value *reverseParseTree(Value *tree) {
 
 void syntaxError(int depth) {
   if (depth < 0)
-    printf("Syntax error: too many close parentheses \n");
+    fprintf(currentContext->output, "Syntax error: too many close parentheses \n");
   else if (depth > 0)
-    printf("Syntax error: not enough close parentheses\n");
+    fprintf(currentContext->output, "Syntax error: not enough close parentheses\n");
   texit(1);
 }
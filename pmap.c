@@ -0,0 +1,386 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include "value.h"
+#include "linkedlist.h"
+#include "talloc.h"
+#include "interpreter.h"
+#include "listlib.h"
+#include "pmap.h"
+
+// Persistent maps, as hash array mapped tries. Keys are compared with
+// valuesEqual and hashed with hashValue, so anything equal? can tell apart
+// works as a key.
+//
+// Each level of the trie takes the next five bits of a key's hash. A node
+// only has slots for the values of those bits that some key has, in order,
+// and a 32-bit bitmap says which those are, so a key's slot is found by
+// counting the bits set below its own. A slot holds either one entry or a
+// subnode for the keys that share its bits. Keys whose whole hashes are
+// equal end up in a node below the last level that is just a list of them.
+//
+// Nothing is ever changed once it's made. pmap-set and pmap-remove copy
+// the nodes on the path to the key, at most one per level, and share every
+// other node with the map they were given, which stays as it was. A
+// subnode left with a single entry by a removal is replaced by the entry,
+// so a map's shape depends only on its keys, not on how it was built. Maps
+// can be handed between futures and coroutines freely, since none of them
+// can see another change one.
+
+#define BITS_PER_LEVEL 5
+#define HASH_BITS 64
+
+typedef struct Node Node;
+
+// An entry, or a subnode if key is NULL.
+typedef struct Slot {
+  unsigned long hash;
+  Value *key;
+  union {
+    Value *value;
+    Node *node;
+  };
+} Slot;
+
+struct Node {
+  uint32_t bitmap;
+  int length;
+  Slot slots[];
+};
+
+typedef struct Pmap {
+  int count;
+  // NULL when the map is empty
+  Node *root;
+} Pmap;
+
+Value *makePmap(int count, Node *root) {
+  Pmap *map = talloc(sizeof(Pmap));
+  map->count = count;
+  map->root = root;
+  Value *result = makeValue(PMAP_TYPE);
+  result->p = map;
+  return result;
+}
+
+Node *newNode(uint32_t bitmap, int length) {
+  Node *node = talloc(sizeof(Node) + sizeof(Slot) * length);
+  node->bitmap = bitmap;
+  node->length = length;
+  return node;
+}
+
+uint32_t bitFor(unsigned long hash, int shift) {
+  return (uint32_t) 1 << ((hash >> shift) & 31);
+}
+
+int indexFor(Node *node, uint32_t bit) {
+  return __builtin_popcount(node->bitmap & (bit - 1));
+}
+
+bool isEntryFor(Slot *slot, unsigned long hash, Value *key) {
+  return slot->key != NULL && slot->hash == hash && valuesEqual(slot->key, key);
+}
+
+// A copy of node with slot i replaced.
+Node *replaceSlot(Node *node, int i, Slot slot) {
+  Node *copy = newNode(node->bitmap, node->length);
+  memcpy(copy->slots, node->slots, sizeof(Slot) * node->length);
+  copy->slots[i] = slot;
+  return copy;
+}
+
+// A copy of node with slot put in at i.
+Node *insertSlot(Node *node, uint32_t bit, int i, Slot slot) {
+  Node *copy = newNode(node->bitmap | bit, node->length + 1);
+  memcpy(copy->slots, node->slots, sizeof(Slot) * i);
+  copy->slots[i] = slot;
+  memcpy(copy->slots + i + 1, node->slots + i, sizeof(Slot) * (node->length - i));
+  return copy;
+}
+
+// A copy of node without slot i, or NULL if that was its only one.
+Node *removeSlot(Node *node, uint32_t bit, int i) {
+  if (node->length == 1) {
+    return NULL;
+  }
+  Node *copy = newNode(node->bitmap & ~bit, node->length - 1);
+  memcpy(copy->slots, node->slots, sizeof(Slot) * i);
+  memcpy(copy->slots + i, node->slots + i + 1, sizeof(Slot) * (node->length - i - 1));
+  return copy;
+}
+
+Slot subnodeSlot(Node *node) {
+  Slot slot = {0, NULL, {.node = node}};
+  return slot;
+}
+
+// A node at the given level holding two entries with different keys.
+Node *pairNode(Slot a, Slot b, int shift) {
+  if (shift >= HASH_BITS) {
+    Node *node = newNode(0, 2);
+    node->slots[0] = a;
+    node->slots[1] = b;
+    return node;
+  }
+  uint32_t aBit = bitFor(a.hash, shift);
+  uint32_t bBit = bitFor(b.hash, shift);
+  if (aBit == bBit) {
+    Node *node = newNode(aBit, 1);
+    node->slots[0] = subnodeSlot(pairNode(a, b, shift + BITS_PER_LEVEL));
+    return node;
+  }
+  Node *node = newNode(aBit | bBit, 2);
+  node->slots[aBit < bBit ? 0 : 1] = a;
+  node->slots[aBit < bBit ? 1 : 0] = b;
+  return node;
+}
+
+Value *lookUp(Node *node, unsigned long hash, Value *key) {
+  int shift = 0;
+  while (node != NULL) {
+    if (shift >= HASH_BITS) {
+      for (int i = 0; i < node->length; i++) {
+        if (isEntryFor(&node->slots[i], hash, key)) {
+          return node->slots[i].value;
+        }
+      }
+      return NULL;
+    }
+    uint32_t bit = bitFor(hash, shift);
+    if (!(node->bitmap & bit)) {
+      return NULL;
+    }
+    Slot *slot = &node->slots[indexFor(node, bit)];
+    if (slot->key != NULL) {
+      return isEntryFor(slot, hash, key) ? slot->value : NULL;
+    }
+    node = slot->node;
+    shift += BITS_PER_LEVEL;
+  }
+  return NULL;
+}
+
+// The node with entry set in it, sharing everything off the path to it.
+// Sets *added if its key is new.
+Node *setEntry(Node *node, Slot entry, int shift, bool *added) {
+  if (node == NULL) {
+    node = newNode(bitFor(entry.hash, shift), 1);
+    node->slots[0] = entry;
+    *added = true;
+    return node;
+  }
+  if (shift >= HASH_BITS) {
+    for (int i = 0; i < node->length; i++) {
+      if (isEntryFor(&node->slots[i], entry.hash, entry.key)) {
+        return replaceSlot(node, i, entry);
+      }
+    }
+    *added = true;
+    return insertSlot(node, 0, node->length, entry);
+  }
+
+  uint32_t bit = bitFor(entry.hash, shift);
+  int i = indexFor(node, bit);
+  if (!(node->bitmap & bit)) {
+    *added = true;
+    return insertSlot(node, bit, i, entry);
+  }
+  Slot *slot = &node->slots[i];
+  if (slot->key == NULL) {
+    return replaceSlot(node, i, subnodeSlot(setEntry(slot->node, entry, shift + BITS_PER_LEVEL, added)));
+  }
+  if (isEntryFor(slot, entry.hash, entry.key)) {
+    return slot->value == entry.value ? node : replaceSlot(node, i, entry);
+  }
+  *added = true;
+  return replaceSlot(node, i, subnodeSlot(pairNode(*slot, entry, shift + BITS_PER_LEVEL)));
+}
+
+// The node without key in it, or NULL if nothing is left, sharing
+// everything off the path to it. Sets *removed if key was there.
+Node *removeEntry(Node *node, unsigned long hash, Value *key, int shift, bool *removed) {
+  if (shift >= HASH_BITS) {
+    for (int i = 0; i < node->length; i++) {
+      if (isEntryFor(&node->slots[i], hash, key)) {
+        *removed = true;
+        return removeSlot(node, 0, i);
+      }
+    }
+    return node;
+  }
+
+  uint32_t bit = bitFor(hash, shift);
+  if (!(node->bitmap & bit)) {
+    return node;
+  }
+  int i = indexFor(node, bit);
+  Slot *slot = &node->slots[i];
+  if (slot->key != NULL) {
+    if (!isEntryFor(slot, hash, key)) {
+      return node;
+    }
+    *removed = true;
+    return removeSlot(node, bit, i);
+  }
+
+  Node *child = removeEntry(slot->node, hash, key, shift + BITS_PER_LEVEL, removed);
+  if (child == slot->node) {
+    return node;
+  }
+  if (child == NULL) {
+    return removeSlot(node, bit, i);
+  }
+  if (child->length == 1 && child->slots[0].key != NULL) {
+    return replaceSlot(node, i, child->slots[0]);
+  }
+  return replaceSlot(node, i, subnodeSlot(child));
+}
+
+// Calls (f key value accumulator) on each entry under node, and returns
+// the last result.
+Value *foldNode(Node *node, Value *function, Value *accumulator) {
+  Value *callArgs[3];
+  for (int i = 0; i < node->length; i++) {
+    Slot *slot = &node->slots[i];
+    if (slot->key == NULL) {
+      accumulator = foldNode(slot->node, function, accumulator);
+    }
+    else {
+      callArgs[0] = slot->key;
+      callArgs[1] = slot->value;
+      callArgs[2] = accumulator;
+      accumulator = apply(function, 3, callArgs);
+    }
+  }
+  return accumulator;
+}
+
+size_t walkNode(Node *node, HeapWalk *walk) {
+  size_t bytes = sizeof(Node) + sizeof(Slot) * node->length;
+  for (int i = 0; i < node->length; i++) {
+    Slot *slot = &node->slots[i];
+    if (slot->key == NULL) {
+      bytes += walkNode(slot->node, walk);
+    }
+    else {
+      heapReach(walk, slot->key, "pmap");
+      heapReach(walk, slot->value, "pmap");
+    }
+  }
+  return bytes;
+}
+
+size_t walkPmap(void *map, HeapWalk *walk) {
+  Pmap *pmap = map;
+  return sizeof(Pmap) + (pmap->root != NULL ? walkNode(pmap->root, walk) : 0);
+}
+
+void fprintPmap(FILE *stream, void *map) {
+  fprintf(stream, "#<pmap %i>", ((Pmap *) map)->count);
+}
+
+Pmap *pmapArg(Value *value, char *errorMessage) {
+  if (typeOf(value) != PMAP_TYPE) {
+    evaluationError(errorMessage);
+  }
+  return value->p;
+}
+
+Value *primitivePmapEmpty(int argc, Value **argv) {
+  (void) argv;
+  if (argc != 0) {
+    evaluationError("wrong number of args in pmap-empty");
+  }
+  return makePmap(0, NULL);
+}
+
+Value *primitiveIsPmap(int argc, Value **argv) {
+  if (argc != 1) {
+    evaluationError("wrong number of args in pmap?");
+  }
+  return makeBool(typeOf(argv[0]) == PMAP_TYPE);
+}
+
+Value *primitivePmapCount(int argc, Value **argv) {
+  if (argc != 1) {
+    evaluationError("wrong number of args in pmap-count");
+  }
+  Pmap *map = pmapArg(argv[0], "wrong type arg in pmap-count");
+  Value *count = makeValue(INT_TYPE);
+  count->i = map->count;
+  return count;
+}
+
+//(pmap-set map key value) is map with key bound to value
+Value *primitivePmapSet(int argc, Value **argv) {
+  if (argc != 3) {
+    evaluationError("wrong number of args in pmap-set");
+  }
+  Pmap *map = pmapArg(argv[0], "wrong type arg in pmap-set");
+  Slot entry = {hashValue(argv[1]), argv[1], {.value = argv[2]}};
+  bool added = false;
+  Node *root = setEntry(map->root, entry, 0, &added);
+  if (root == map->root) {
+    return argv[0];
+  }
+  return makePmap(map->count + added, root);
+}
+
+//(pmap-ref map key) is what key is bound to, which is an error if it
+//isn't; (pmap-ref map key default) is default then instead
+Value *primitivePmapRef(int argc, Value **argv) {
+  if (argc != 2 && argc != 3) {
+    evaluationError("wrong number of args in pmap-ref");
+  }
+  Pmap *map = pmapArg(argv[0], "wrong type arg in pmap-ref");
+  Value *value = lookUp(map->root, hashValue(argv[1]), argv[1]);
+  if (value != NULL) {
+    return value;
+  }
+  if (argc == 3) {
+    return argv[2];
+  }
+  evaluationError("key not found in pmap-ref");
+  return NULL;
+}
+
+//(pmap-remove map key) is map without key, or map itself if key isn't in it
+Value *primitivePmapRemove(int argc, Value **argv) {
+  if (argc != 2) {
+    evaluationError("wrong number of args in pmap-remove");
+  }
+  Pmap *map = pmapArg(argv[0], "wrong type arg in pmap-remove");
+  if (map->root == NULL) {
+    return argv[0];
+  }
+  bool removed = false;
+  Node *root = removeEntry(map->root, hashValue(argv[1]), argv[1], 0, &removed);
+  if (!removed) {
+    return argv[0];
+  }
+  return makePmap(map->count - 1, root);
+}
+
+//(pmap-fold f init map) calls (f key value accumulator) on each entry in
+//turn, in no particular order, like vector-fold
+Value *primitivePmapFold(int argc, Value **argv) {
+  if (argc != 3) {
+    evaluationError("wrong number of args in pmap-fold");
+  }
+  Pmap *map = pmapArg(argv[2], "wrong type arg in pmap-fold");
+  if (map->root == NULL) {
+    return argv[1];
+  }
+  return foldNode(map->root, argv[0], argv[1]);
+}
+
+void bindPmapPrimitives(Frame *frame) {
+  bind("pmap-empty", primitivePmapEmpty, frame);
+  bind("pmap?", primitiveIsPmap, frame);
+  bind("pmap-count", primitivePmapCount, frame);
+  bind("pmap-set", primitivePmapSet, frame);
+  bind("pmap-ref", primitivePmapRef, frame);
+  bind("pmap-remove", primitivePmapRemove, frame);
+  bind("pmap-fold", primitivePmapFold, frame);
+}
@@ -0,0 +1,20 @@
+#include <stdio.h>
+#include <stddef.h>
+#include "value.h"
+#include "heapdump.h"
+
+#ifndef _PMAP
+#define _PMAP
+
+// Print a map as #<pmap n>, n being how many keys it has.
+void fprintPmap(FILE *stream, void *map);
+
+// Add a map's keys and values to a heap dump's walk, and return the bytes
+// its nodes take up.
+size_t walkPmap(void *map, HeapWalk *walk);
+
+// Bind pmap-empty, pmap?, pmap-count, pmap-set, pmap-ref, pmap-remove and
+// pmap-fold in the given frame.
+void bindPmapPrimitives(Frame *frame);
+
+#endif
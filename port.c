@@ -0,0 +1,349 @@
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "value.h"
+#include "linkedlist.h"
+#include "talloc.h"
+#include "interpreter.h"
+#include "context.h"
+#include "port.h"
+
+// A port reads or writes a file through a buffer of PORT_BUFFER_SIZE bytes,
+// so that bulk I/O takes one system call per megabyte rather than one per
+// line. read-line finds the end of a line in the buffer with memchr, and
+// copies the line straight into its string; only a line that runs past the
+// end of the buffer is gathered separately. Strings come from a block of
+// TEXT_BLOCK_SIZE bytes shared by every string the port makes, and
+// read-char and peek-char hand back the same one-character string each time
+// a character comes round again, so reading a file makes one allocation
+// per line, or none per character.
+//
+// Strings are kept with their double quotes, as the tokenizer leaves them,
+// so that member and assoc match a line read from a file with the same text
+// written in the program. File names and write-string's output leave them
+// off.
+//
+// Ports last as long as the program that opened them: whatever it leaves
+// open is flushed and closed when it ends. A port isn't meant to be used by
+// two futures at once.
+
+#define PORT_BUFFER_SIZE (1024 * 1024)
+#define TEXT_BLOCK_SIZE (64 * 1024)
+
+typedef struct Port {
+  int fd;
+  bool input;
+  bool open;
+  // whether an input port has read everything there is
+  bool atEnd;
+  // For an input port, buffer[start..end) is read but not yet used; for
+  // an output port, buffer[0..end) is waiting to be written.
+  char *buffer;
+  long start;
+  long end;
+  // where the next string's text goes
+  char *textNext;
+  char *textEnd;
+  // the one-character strings read-char has made, by character
+  Value *chars[256];
+  Value *eof;
+  struct Port *next;
+} Port;
+
+// A string Value for length bytes of text, with the quotes added.
+Value *portString(Port *port, const char *text, long length) {
+  long size = length + 3;
+  char *s;
+  if (size > TEXT_BLOCK_SIZE / 4) {
+    s = talloc(size);
+  }
+  else {
+    if (port->textNext == NULL || port->textNext + size > port->textEnd) {
+      port->textNext = talloc(TEXT_BLOCK_SIZE);
+      port->textEnd = port->textNext + TEXT_BLOCK_SIZE;
+    }
+    s = port->textNext;
+    port->textNext += size;
+  }
+  s[0] = '"';
+  memcpy(s + 1, text, length);
+  s[length + 1] = '"';
+  s[length + 2] = '\0';
+  Value *string = makeValue(STR_TYPE);
+  string->s = s;
+  return string;
+}
+
+char *stringText(Value *string, long *length) {
+  long size = strlen(string->s);
+  if (size >= 2 && string->s[0] == '"' && string->s[size - 1] == '"') {
+    *length = size - 2;
+    return string->s + 1;
+  }
+  *length = size;
+  return string->s;
+}
+
+// Opens the file a string names. Futures may open ports at the same time,
+// hence the atomic push onto the context's list.
+Value *openPort(Value *name, int flags, char *error) {
+  long length;
+  char *text = stringText(name, &length);
+  char *path = talloc(length + 1);
+  memcpy(path, text, length);
+  path[length] = '\0';
+
+  int fd = open(path, flags | O_CLOEXEC, 0666);
+  if (fd < 0) {
+    evaluationError(error);
+  }
+  bool input = (flags & O_ACCMODE) == O_RDONLY;
+  if (input) {
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+  }
+
+  Port *port = talloc(sizeof(Port));
+  memset(port, 0, sizeof(Port));
+  port->fd = fd;
+  port->input = input;
+  port->open = true;
+  port->buffer = malloc(PORT_BUFFER_SIZE);
+  port->next = __atomic_load_n(&currentContext->ports, __ATOMIC_RELAXED);
+  while (!__atomic_compare_exchange_n(&currentContext->ports, &port->next, port, true,
+                                      __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+  }
+
+  Value *result = makeValue(PORT_TYPE);
+  result->p = port;
+  return result;
+}
+
+size_t walkPort(void *file, HeapWalk *walk) {
+  Port *port = file;
+  for (int c = 0; c < 256; c++) {
+    heapReach(walk, port->chars[c], "port");
+  }
+  heapReach(walk, port->eof, "port");
+  return sizeof(Port) + (port->buffer != NULL ? PORT_BUFFER_SIZE : 0);
+}
+
+//(open-input-file name)
+Value *primitiveOpenInputFile(int argc, Value **argv) {
+  if (argc != 1) {
+    evaluationError("wrong number of args in open-input-file");
+  }
+  if (typeOf(argv[0]) != STR_TYPE) {
+    evaluationError("wrong type arg in open-input-file");
+  }
+  return openPort(argv[0], O_RDONLY, "can't open file in open-input-file");
+}
+
+//(open-output-file name) creates the file, or empties it if it exists
+Value *primitiveOpenOutputFile(int argc, Value **argv) {
+  if (argc != 1) {
+    evaluationError("wrong number of args in open-output-file");
+  }
+  if (typeOf(argv[0]) != STR_TYPE) {
+    evaluationError("wrong type arg in open-output-file");
+  }
+  return openPort(argv[0], O_WRONLY | O_CREAT | O_TRUNC, "can't open file in open-output-file");
+}
+
+// The open port that is a primitive's first and only argument.
+Port *portArg(int argc, Value **argv, int expected, bool input, char *message) {
+  if (argc != expected || typeOf(argv[0]) != PORT_TYPE) {
+    evaluationError(message);
+  }
+  Port *port = argv[0]->p;
+  if (!port->open || port->input != input) {
+    evaluationError(message);
+  }
+  return port;
+}
+
+// Refills an input port's buffer, once everything in it has been used.
+// Returns false at the end of the file.
+bool fill(Port *port) {
+  if (port->atEnd) {
+    return false;
+  }
+  ssize_t count;
+  do {
+    count = read(port->fd, port->buffer, PORT_BUFFER_SIZE);
+  } while (count < 0 && errno == EINTR);
+  if (count < 0) {
+    evaluationError("can't read from port");
+  }
+  port->start = 0;
+  port->end = count;
+  port->atEnd = count == 0;
+  return count > 0;
+}
+
+bool flush(Port *port) {
+  long written = 0;
+  while (written < port->end) {
+    ssize_t count = write(port->fd, port->buffer + written, port->end - written);
+    //a write that makes no progress won't make any by being retried
+    if (count == 0 || (count < 0 && errno != EINTR)) {
+      return false;
+    }
+    if (count > 0) {
+      written += count;
+    }
+  }
+  port->end = 0;
+  return true;
+}
+
+Value *eofOf(Port *port) {
+  if (port->eof == NULL) {
+    port->eof = makeValue(EOF_TYPE);
+  }
+  return port->eof;
+}
+
+Value *charAt(Port *port, unsigned char c) {
+  if (port->chars[c] == NULL) {
+    port->chars[c] = portString(port, (char *) &c, 1);
+  }
+  return port->chars[c];
+}
+
+//(read-char port) returns the next character, as a one-character string
+Value *primitiveReadChar(int argc, Value **argv) {
+  Port *port = portArg(argc, argv, 1, true, "read-char needs an open input port");
+  if (port->start == port->end && !fill(port)) {
+    return eofOf(port);
+  }
+  Value *c = charAt(port, port->buffer[port->start]);
+  port->start++;
+  return c;
+}
+
+//(peek-char port) is the character read-char would return next
+Value *primitivePeekChar(int argc, Value **argv) {
+  Port *port = portArg(argc, argv, 1, true, "peek-char needs an open input port");
+  if (port->start == port->end && !fill(port)) {
+    return eofOf(port);
+  }
+  return charAt(port, port->buffer[port->start]);
+}
+
+//(read-line port) returns the text up to the next newline, leaving the
+//newline out
+Value *primitiveReadLine(int argc, Value **argv) {
+  Port *port = portArg(argc, argv, 1, true, "read-line needs an open input port");
+  if (port->start == port->end && !fill(port)) {
+    return eofOf(port);
+  }
+  char *from = port->buffer + port->start;
+  char *newline = memchr(from, '\n', port->end - port->start);
+  if (newline != NULL) {
+    port->start = newline + 1 - port->buffer;
+    return portString(port, from, newline - from);
+  }
+
+  //the line goes on past the buffer
+  long length = 0;
+  long capacity = 2 * PORT_BUFFER_SIZE;
+  char *line = malloc(capacity);
+  do {
+    from = port->buffer + port->start;
+    newline = memchr(from, '\n', port->end - port->start);
+    long count = (newline != NULL ? newline : port->buffer + port->end) - from;
+    if (length + count > capacity) {
+      capacity = 2 * (length + count);
+      line = realloc(line, capacity);
+    }
+    memcpy(line + length, from, count);
+    length += count;
+    port->start += newline != NULL ? count + 1 : count;
+  } while (newline == NULL && fill(port));
+  Value *result = portString(port, line, length);
+  free(line);
+  return result;
+}
+
+//(eof-object? v) is whether v is what reading returns at the end of a file
+Value *primitiveEofObject(int argc, Value **argv) {
+  if (argc != 1) {
+    evaluationError("wrong number of args in eof-object?");
+  }
+  return makeBool(typeOf(argv[0]) == EOF_TYPE);
+}
+
+//(write-string port string) writes the string's text, without its quotes
+Value *primitiveWriteString(int argc, Value **argv) {
+  Port *port = portArg(argc, argv, 2, false, "write-string needs an open output port");
+  if (typeOf(argv[1]) != STR_TYPE) {
+    evaluationError("wrong type arg in write-string");
+  }
+  long length;
+  char *text = stringText(argv[1], &length);
+  if (port->end + length > PORT_BUFFER_SIZE && !flush(port)) {
+    evaluationError("can't write to port");
+  }
+  if (length > PORT_BUFFER_SIZE) {
+    //too big to be worth copying: write it straight from the string
+    char *saved = port->buffer;
+    port->buffer = text;
+    port->end = length;
+    bool written = flush(port);
+    port->buffer = saved;
+    if (!written) {
+      evaluationError("can't write to port");
+    }
+  }
+  else {
+    memcpy(port->buffer + port->end, text, length);
+    port->end += length;
+  }
+  return makeValue(VOID_TYPE);
+}
+
+// Flushes what an output port has waiting, and closes it. Returns false if
+// the flush failed.
+bool closePort(Port *port) {
+  bool flushed = port->input || flush(port);
+  close(port->fd);
+  free(port->buffer);
+  port->buffer = NULL;
+  port->open = false;
+  return flushed;
+}
+
+//(close-port port); closing one that's already closed does nothing
+Value *primitiveClosePort(int argc, Value **argv) {
+  if (argc != 1 || typeOf(argv[0]) != PORT_TYPE) {
+    evaluationError("close-port needs a port");
+  }
+  Port *port = argv[0]->p;
+  if (port->open && !closePort(port)) {
+    evaluationError("can't write to port");
+  }
+  return makeValue(VOID_TYPE);
+}
+
+void closePorts() {
+  for (Port *port = currentContext->ports; port != NULL; port = port->next) {
+    if (port->open) {
+      closePort(port);
+    }
+  }
+  currentContext->ports = NULL;
+}
+
+void bindPortPrimitives(Frame *frame) {
+  bind("open-input-file", primitiveOpenInputFile, frame);
+  bind("open-output-file", primitiveOpenOutputFile, frame);
+  bind("read-char", primitiveReadChar, frame);
+  bind("peek-char", primitivePeekChar, frame);
+  bind("read-line", primitiveReadLine, frame);
+  bind("eof-object?", primitiveEofObject, frame);
+  bind("write-string", primitiveWriteString, frame);
+  bind("close-port", primitiveClosePort, frame);
+}
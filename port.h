@@ -0,0 +1,22 @@
+#include <stddef.h>
+#include "value.h"
+#include "heapdump.h"
+
+#ifndef _PORT
+#define _PORT
+
+// Bind open-input-file, open-output-file, read-char, peek-char, read-line,
+// eof-object?, write-string and close-port in the given frame.
+void bindPortPrimitives(Frame *frame);
+
+// The text of a string, without the quotes it keeps, and how long it is.
+char *stringText(Value *string, long *length);
+
+// Add the strings a port has made to a heap dump's walk, and return the
+// bytes the port and its buffer take up.
+size_t walkPort(void *port, HeapWalk *walk);
+
+// Flush and close every port the current context's program left open.
+void closePorts();
+
+#endif
@@ -0,0 +1,353 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <time.h>
+#include "value.h"
+#include "profile.h"
+
+// Each thread keeps a shadow stack of the procedures it is running, as the
+// code pointer that identifies each: a closure's body, a primitive's
+// function, or a memoized procedure's cache. On each tick of the profiling
+// timer, SIGPROF interrupts whichever thread is running, and the handler copies
+// the innermost SAMPLE_DEPTH entries of its stack into the next free
+// sample. Nothing else happens in the handler, since almost nothing else is
+// safe there: names are only looked up once sampling has stopped. A stack
+// deeper than SAMPLE_DEPTH keeps its ROOT_DEPTH outermost entries as well,
+// so that deep recursion still shows up under whatever called it.
+
+#define STACK_CAPACITY 16384
+#define SAMPLE_DEPTH 48
+#define ROOT_DEPTH 8
+#define SAMPLE_CAPACITY 100000
+#define INTERVAL_USEC 1000
+#define TOP_COUNT 20
+
+typedef struct Sample {
+  int depth;
+  // whether frames were left out, between the first ROOT_DEPTH and the rest
+  bool truncated;
+  void *frames[SAMPLE_DEPTH];
+} Sample;
+
+bool profiling = false;
+
+_Thread_local void **shadowStack = NULL;
+_Thread_local volatile int shadowDepth = 0;
+
+Sample *samples = NULL;
+long sampleCount = 0;
+
+// The process's CPU time when sampling started. The timer asks for a sample
+// every INTERVAL_USEC, but the kernel may deliver them less often, so the
+// report works out how much time each one stands for.
+struct timespec startTime;
+
+double cpuSeconds() {
+  struct timespec now;
+  clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &now);
+  return (now.tv_sec - startTime.tv_sec) + (now.tv_nsec - startTime.tv_nsec) / 1e9;
+}
+
+// Names given to procedures by define, or bind for primitives, in an
+// open-addressed table keyed by code pointer.
+typedef struct ProcedureName {
+  void *code;
+  char *name;
+} ProcedureName;
+
+pthread_mutex_t procedureNameLock = PTHREAD_MUTEX_INITIALIZER;
+ProcedureName *procedureNames = NULL;
+long procedureNameCapacity = 0;
+long procedureNameCount = 0;
+
+// The code pointer a call to procedure is known by, or NULL.
+void *codeOf(Value *procedure) {
+  switch (typeOf(procedure)) {
+    case CLOSURE_TYPE: {
+      return procedure->cl.functionCode;
+    }
+    case PRIMITIVE_TYPE: {
+      return (void *) procedure->pf;
+    }
+    case MEMO_TYPE: {
+      return procedure->p;
+    }
+    default: {
+      return NULL;
+    }
+  }
+}
+
+long nameSlot(ProcedureName *table, long capacity, void *code) {
+  long i = ((unsigned long) code >> 4) & (capacity - 1);
+  while (table[i].code != NULL && table[i].code != code) {
+    i = (i + 1) & (capacity - 1);
+  }
+  return i;
+}
+
+void profileName(Value *procedure, char *name) {
+  void *code = codeOf(procedure);
+  if (code == NULL) {
+    return;
+  }
+  pthread_mutex_lock(&procedureNameLock);
+  if (procedureNameCount * 2 >= procedureNameCapacity) {
+    long oldCapacity = procedureNameCapacity;
+    ProcedureName *old = procedureNames;
+    procedureNameCapacity = procedureNameCapacity == 0 ? 256 : procedureNameCapacity * 2;
+    procedureNames = calloc(procedureNameCapacity, sizeof(ProcedureName));
+    for (long i = 0; i < oldCapacity; i++) {
+      if (old[i].code != NULL) {
+        procedureNames[nameSlot(procedureNames, procedureNameCapacity, old[i].code)] = old[i];
+      }
+    }
+    free(old);
+  }
+  long i = nameSlot(procedureNames, procedureNameCapacity, code);
+  //the first name a procedure is defined with is the one it keeps
+  if (procedureNames[i].code == NULL) {
+    procedureNames[i].code = code;
+    procedureNames[i].name = strdup(name);
+    procedureNameCount++;
+  }
+  pthread_mutex_unlock(&procedureNameLock);
+}
+
+char *nameOf(void *code) {
+  if (procedureNameCapacity == 0) {
+    return "(lambda)";
+  }
+  long i = nameSlot(procedureNames, procedureNameCapacity, code);
+  return procedureNames[i].code == NULL ? "(lambda)" : procedureNames[i].name;
+}
+
+void profileEnter(Value *procedure) {
+  if (shadowStack == NULL) {
+    shadowStack = malloc(sizeof(void *) * STACK_CAPACITY);
+  }
+  if (shadowDepth < STACK_CAPACITY) {
+    shadowStack[shadowDepth] = codeOf(procedure);
+  }
+  //the entry has to be in place before the handler can see it
+  __atomic_signal_fence(__ATOMIC_SEQ_CST);
+  shadowDepth++;
+}
+
+void profileLeave() {
+  shadowDepth--;
+}
+
+int profileMark() {
+  return shadowDepth;
+}
+
+void profileRelease(int mark) {
+  shadowDepth = mark;
+}
+
+//the handler may interrupt this at any point, so it must never see the
+//new stack with the old depth
+void profileSwap(ShadowStack *stack) {
+  ShadowStack thread = {shadowStack, shadowDepth};
+  shadowDepth = 0;
+  __atomic_signal_fence(__ATOMIC_SEQ_CST);
+  shadowStack = stack->frames;
+  __atomic_signal_fence(__ATOMIC_SEQ_CST);
+  shadowDepth = stack->depth;
+  *stack = thread;
+}
+
+void profileFree(ShadowStack *stack) {
+  free(stack->frames);
+  stack->frames = NULL;
+  stack->depth = 0;
+}
+
+void profileThreadExit() {
+  void **stack = shadowStack;
+  shadowDepth = 0;
+  shadowStack = NULL;
+  __atomic_signal_fence(__ATOMIC_SEQ_CST);
+  free(stack);
+}
+
+void takeSample(int signal) {
+  (void) signal;
+  long index = __atomic_fetch_add(&sampleCount, 1, __ATOMIC_RELAXED);
+  if (index >= SAMPLE_CAPACITY) {
+    return;
+  }
+  Sample *sample = &samples[index];
+  int depth = shadowStack == NULL ? 0 : shadowDepth;
+  int stored = depth < STACK_CAPACITY ? depth : STACK_CAPACITY;
+  sample->truncated = stored > SAMPLE_DEPTH || stored < depth;
+  if (stored <= SAMPLE_DEPTH) {
+    for (int i = 0; i < stored; i++) {
+      sample->frames[i] = shadowStack[i];
+    }
+    sample->depth = stored;
+    return;
+  }
+  for (int i = 0; i < ROOT_DEPTH; i++) {
+    sample->frames[i] = shadowStack[i];
+  }
+  int from = stored - (SAMPLE_DEPTH - ROOT_DEPTH);
+  for (int i = from; i < stored; i++) {
+    sample->frames[ROOT_DEPTH + i - from] = shadowStack[i];
+  }
+  sample->depth = SAMPLE_DEPTH;
+}
+
+void startProfiler() {
+  samples = malloc(sizeof(Sample) * SAMPLE_CAPACITY);
+  sampleCount = 0;
+  profiling = true;
+  clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &startTime);
+
+  struct sigaction action;
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = takeSample;
+  action.sa_flags = SA_RESTART;
+  sigemptyset(&action.sa_mask);
+  sigaction(SIGPROF, &action, NULL);
+
+  struct itimerval timer;
+  timer.it_interval.tv_sec = 0;
+  timer.it_interval.tv_usec = INTERVAL_USEC;
+  timer.it_value = timer.it_interval;
+  setitimer(ITIMER_PROF, &timer, NULL);
+}
+
+// Orders samples so that identical stacks end up next to each other.
+int compareSamples(const void *left, const void *right) {
+  const Sample *a = left;
+  const Sample *b = right;
+  if (a->truncated != b->truncated) {
+    return a->truncated - b->truncated;
+  }
+  if (a->depth != b->depth) {
+    return a->depth - b->depth;
+  }
+  return memcmp(a->frames, b->frames, sizeof(void *) * a->depth);
+}
+
+void writeStack(FILE *stream, Sample *sample) {
+  if (sample->depth == 0) {
+    fprintf(stream, "(top level)");
+  }
+  for (int i = 0; i < sample->depth; i++) {
+    if (i > 0) {
+      fprintf(stream, ";");
+    }
+    if (i == ROOT_DEPTH && sample->truncated) {
+      fprintf(stream, "...;");
+    }
+    fprintf(stream, "%s", nameOf(sample->frames[i]));
+  }
+}
+
+typedef struct ProcedureCount {
+  void *code;
+  long self;
+  long total;
+} ProcedureCount;
+
+int compareCounts(const void *left, const void *right) {
+  const ProcedureCount *a = left;
+  const ProcedureCount *b = right;
+  if (a->self != b->self) {
+    return a->self < b->self ? 1 : -1;
+  }
+  return a->total < b->total ? 1 : (a->total > b->total ? -1 : 0);
+}
+
+void printTopProcedures(long count, double seconds) {
+  ProcedureCount *counts = NULL;
+  int countCount = 0;
+  int countCapacity = 0;
+  long topLevel = 0;
+
+  for (long i = 0; i < count; i++) {
+    Sample *sample = &samples[i];
+    if (sample->depth == 0) {
+      topLevel++;
+    }
+    for (int j = 0; j < sample->depth; j++) {
+      void *code = sample->frames[j];
+      //a recursive procedure counts once towards its total per sample
+      bool seen = false;
+      for (int k = j + 1; k < sample->depth && !seen; k++) {
+        seen = sample->frames[k] == code;
+      }
+      if (seen) {
+        continue;
+      }
+      int c = 0;
+      while (c < countCount && counts[c].code != code) {
+        c++;
+      }
+      if (c == countCount) {
+        if (countCount == countCapacity) {
+          countCapacity = countCapacity == 0 ? 64 : countCapacity * 2;
+          counts = realloc(counts, sizeof(ProcedureCount) * countCapacity);
+        }
+        counts[c].code = code;
+        counts[c].self = 0;
+        counts[c].total = 0;
+        countCount++;
+      }
+      counts[c].total++;
+      if (j == sample->depth - 1) {
+        counts[c].self++;
+      }
+    }
+  }
+  qsort(counts, countCount, sizeof(ProcedureCount), compareCounts);
+
+  fprintf(stderr, "profile: %ld samples over %.0f ms of CPU time\n", count, seconds * 1000);
+  fprintf(stderr, "  %8s %7s %8s %7s  %s\n", "self", "", "total", "", "procedure");
+  for (int c = 0; c < countCount && c < TOP_COUNT; c++) {
+    fprintf(stderr, "  %8ld %6.1f%% %8ld %6.1f%%  %s\n", counts[c].self, 100.0 * counts[c].self / count,
+            counts[c].total, 100.0 * counts[c].total / count, nameOf(counts[c].code));
+  }
+  if (topLevel > 0) {
+    fprintf(stderr, "  %8ld %6.1f%% %8s %7s  (top level)\n", topLevel, 100.0 * topLevel / count, "", "");
+  }
+  free(counts);
+}
+
+void stopProfiler(FILE *collapsed) {
+  struct itimerval timer;
+  memset(&timer, 0, sizeof(timer));
+  setitimer(ITIMER_PROF, &timer, NULL);
+  signal(SIGPROF, SIG_IGN);
+  profiling = false;
+  double seconds = cpuSeconds();
+
+  long count = sampleCount < SAMPLE_CAPACITY ? sampleCount : SAMPLE_CAPACITY;
+  qsort(samples, count, sizeof(Sample), compareSamples);
+  for (long i = 0; i < count; ) {
+    long j = i + 1;
+    while (j < count && compareSamples(&samples[i], &samples[j]) == 0) {
+      j++;
+    }
+    writeStack(collapsed, &samples[i]);
+    fprintf(collapsed, " %ld\n", j - i);
+    i = j;
+  }
+
+  if (count > 0) {
+    printTopProcedures(count, seconds);
+  }
+  if (sampleCount > SAMPLE_CAPACITY) {
+    fprintf(stderr, "profile: %ld samples dropped after the first %d\n",
+            sampleCount - SAMPLE_CAPACITY, SAMPLE_CAPACITY);
+  }
+  free(samples);
+  samples = NULL;
+}
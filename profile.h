@@ -0,0 +1,50 @@
+#include <stdio.h>
+#include <stdbool.h>
+#include "value.h"
+
+#ifndef _PROFILE
+#define _PROFILE
+
+// Whether the sampling profiler is running. Set by startProfiler, before
+// any program runs.
+extern bool profiling;
+
+// Start sampling: from now on a SIGPROF timer records, as often as every
+// millisecond of CPU time, the stack of procedures the interrupted thread is
+// in.
+void startProfiler();
+
+// Stop sampling, write every sampled stack to collapsed in the folded format
+// flame graph tools read (one line per distinct stack, root first, names
+// separated by semicolons, then the number of samples), and print the
+// procedures with the most samples to stderr.
+void stopProfiler(FILE *collapsed);
+
+// Push a call to procedure onto this thread's shadow stack, and pop it.
+// apply does this for every call while profiling.
+void profileEnter(Value *procedure);
+void profileLeave();
+
+// The depth of this thread's shadow stack, and a way back to it after an
+// error has jumped out of the calls above.
+int profileMark();
+void profileRelease(int mark);
+
+// Remember name for procedure, if it is one, so that samples in it can be
+// reported by name. define does this for whatever it binds.
+void profileName(Value *procedure, char *name);
+
+// A shadow stack set aside while the coroutine it belongs to is suspended.
+typedef struct ShadowStack {
+  void **frames;
+  int depth;
+} ShadowStack;
+
+// Exchange this thread's shadow stack with *stack, and free one set aside.
+void profileSwap(ShadowStack *stack);
+void profileFree(ShadowStack *stack);
+
+// Release this thread's shadow stack.
+void profileThreadExit();
+
+#endif
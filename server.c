@@ -0,0 +1,63 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <ctype.h>
+#include "context.h"
+#include "server.h"
+
+// Reads a request's length line. Returns the length, -1 at the end of the
+// requests, or -2 if the line isn't a length.
+long readLength(FILE *requests) {
+  long length = 0;
+  int digits = 0;
+  int c = fgetc(requests);
+  if (c == EOF) {
+    return -1;
+  }
+  while (isdigit(c)) {
+    length = length * 10 + (c - '0');
+    digits++;
+    if (length > 1L << 30) {
+      return -2;
+    }
+    c = fgetc(requests);
+  }
+  if (c != '\n' || digits == 0) {
+    return -2;
+  }
+  return length;
+}
+
+int serve(Context *context, FILE *requests, FILE *replies, bool optimizing) {
+  while (true) {
+    long length = readLength(requests);
+    if (length == -1) {
+      return 0;
+    }
+    if (length == -2) {
+      fprintf(stderr, "server: expected the length of a program\n");
+      return 1;
+    }
+
+    char *program = malloc(length + 1);
+    if (fread(program, 1, length, requests) != (size_t) length) {
+      fprintf(stderr, "server: program ended early\n");
+      free(program);
+      return 1;
+    }
+
+    char *output = NULL;
+    size_t outputLength = 0;
+    FILE *input = fmemopen(program, length, "r");
+    FILE *out = open_memstream(&output, &outputLength);
+    int status = runRequest(context, input, out, optimizing);
+    fclose(input);
+    fclose(out);
+
+    fprintf(replies, "%i %zu\n", status, outputLength);
+    fwrite(output, 1, outputLength, replies);
+    fflush(replies);
+    free(output);
+    free(program);
+  }
+}
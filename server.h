@@ -0,0 +1,16 @@
+#include <stdio.h>
+#include <stdbool.h>
+#include "context.h"
+
+#ifndef _SERVER
+#define _SERVER
+
+// Evaluate a stream of programs in one context, each as a separate request
+// on top of whatever the context has defined so far (its prelude). Every
+// request is a line giving the program's length in bytes, followed by that
+// many bytes of program. Each reply is a line giving the program's exit
+// status and the length of its output, followed by the output itself.
+// Returns at the end of the requests, with 0, or 1 if one is malformed.
+int serve(Context *context, FILE *requests, FILE *replies, bool optimizing);
+
+#endif
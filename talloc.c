@@ -1,60 +1,125 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdbool.h>
+#include <string.h>
+#include <pthread.h>
+#include <setjmp.h>
+#include <sys/mman.h>
 #include "value.h"
 #include "talloc.h"
 
-Value *pointers;
-bool initialized = false;
+// talloc's own bookkeeping can't be made of cons cells any more, since those
+// now live on pair pages that talloc itself hands out. A plain malloc'd node
+// per allocation does the job.
+struct Allocation {
+  void *p;
+  struct Allocation *next;
+};
 
-//Duplicated code from linkedlist.c
+// Values and Pairs are carved out of pages, and pages out of chunks of
+// CHUNK_PAGES pages, which only tfree gives back. Every thread fills pages
+// of its own (its allocation buffers), so allocating is a bump of a
+// thread-local pointer, with no synchronization at all. Only taking the next
+// page from the shared chunk takes a lock, once per page.
+#define CHUNK_PAGES 64
 
-// Create a new NULL_TYPE value node.
-Value *makeNullNEW() {
-  Value *v = malloc(sizeof(Value));
-  v -> type = NULL_TYPE;
-  return v;
-}
+struct Chunk {
+  char *memory;
+  struct Chunk *next;
+};
 
-// Create a new CONS_TYPE value node.
-Value *consNEW(Value *newCar, Value *newCdr) {
-  Value *v = malloc(sizeof(Value));
-  v->type = CONS_TYPE;
-  (v->c).car = newCar;
-  (v->c).cdr = newCdr;
-  return v;
-}
+// A file mapped into memory by tallocMap.
+struct Mapping {
+  void *memory;
+  size_t size;
+  struct Mapping *next;
+};
 
-// Utility to make it less typing to get car value. Use assertions to make sure
-// that this is a legitimate operation.
-Value *carNEW(Value *list) {
-  return (list->c).car;
-}
+struct AllocCount {
+  long count;
+  long bytes;
+};
 
-// Utility to make it less typing to get cdr value. Use assertions to make sure
-// that this is a legitimate operation.
-Value *cdrNEW(Value *list) {
-  return (list->c).cdr;
-}
+// What --alloc-stats has seen a heap allocate. Values aren't counted by type
+// as they are made, since many only get their type after allocation;
+// printAllocStats counts them on their pages instead.
+struct AllocStats {
+  struct AllocCount bySite[SITE_COUNT];
+  struct AllocCount pairs;
+  struct AllocCount blocks;
+  long liveBytes;
+  long peakLiveBytes;
+};
 
-void displayNEW(Value *list) {
-  Value *curVal = list;
+// Everything one interpreter has allocated. Nothing in here is shared
+// between heaps, so separate interpreters never contend.
+struct Heap {
+  // pushed onto without a lock, so that threads can talloc at once
+  struct Allocation *pointers;
+  pthread_mutex_t chunkLock;
+  struct Chunk *chunks;
+  char *chunkNext;
+  char *chunkEnd;
+  // guarded by chunkLock too
+  struct Mapping *mappings;
+  // allocations made by threads that have since left the heap
+  long allocations;
+  // NULL unless allocation statistics are on
+  struct AllocStats *stats;
+  // whether other threads may be allocating; see texit
+  bool threaded;
+};
 
-  while (curVal -> type != NULL_TYPE) {
-    if (carNEW(curVal) -> type == INT_TYPE || carNEW(curVal) -> type == BOOL_TYPE) {
-      printf("%i\n", carNEW(curVal)->i);
-    }
-    else if (carNEW(curVal) -> type == DOUBLE_TYPE) {
-      printf("%g\n", carNEW(curVal)->d);
-    }
-    else if (carNEW(curVal) -> type == STR_TYPE || carNEW(curVal) -> type == SYMBOL_TYPE) {
-      printf("%s\n", carNEW(curVal)->s);
-    }
-    else if (carNEW(curVal) -> type == PTR_TYPE) {
-      printf("%p\n", carNEW(curVal)->p);
-    }
-    
-    curVal = cdrNEW(curVal);
+// The heap talloc uses when the program hasn't set up one of its own.
+Heap defaultHeap = {NULL, PTHREAD_MUTEX_INITIALIZER, NULL, NULL, NULL, NULL, 0, NULL, false};
+
+// The heap this thread allocates from.
+_Thread_local Heap *currentHeap = &defaultHeap;
+
+// Where texit goes instead of exiting, if the thread's host has said so.
+_Thread_local jmp_buf *exitHandler = NULL;
+
+// Allocations this thread has made in its current heap, added to the heap's
+// own count when it leaves.
+_Thread_local long allocationCount = 0;
+
+bool allocStats = false;
+
+// What this thread is doing, for --alloc-stats.
+_Thread_local AllocSite allocSite = SITE_OTHER;
+
+static const char *siteNames[SITE_COUNT] = {
+  "other", "tokenizer", "parser", "evaluator (other)", "frames", "cons", "numbers"
+};
+
+// This thread's bump pointers into the page of Values and the page of pairs
+// it is filling.
+_Thread_local char *valueNext = NULL;
+_Thread_local char *valueEnd = NULL;
+_Thread_local char *pairNext = NULL;
+_Thread_local char *pairEnd = NULL;
+
+// The frame region: a stack of pair pages for frames that can't outlive the
+// call that made them. Its pages are kept in order so that releasing a mark
+// can step back to an earlier page, and are reused rather than freed until
+// tfree. Calls nest per thread, so each thread has a region of its own.
+_Thread_local PageHeader **regionPages = NULL;
+_Thread_local int regionPageCount = 0;
+_Thread_local int regionPageCapacity = 0;
+_Thread_local int regionPage = -1;
+_Thread_local char *regionNext = NULL;
+_Thread_local char *regionEnd = NULL;
+
+// Charges an allocation of bytes to site in the current heap's statistics,
+// and raises its peak live size if need be.
+void recordAllocation(AllocSite site, long bytes) {
+  struct AllocStats *stats = currentHeap->stats;
+  __atomic_add_fetch(&stats->bySite[site].count, 1, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&stats->bySite[site].bytes, bytes, __ATOMIC_RELAXED);
+  long live = __atomic_add_fetch(&stats->liveBytes, bytes, __ATOMIC_RELAXED);
+  long peak = __atomic_load_n(&stats->peakLiveBytes, __ATOMIC_RELAXED);
+  while (live > peak && !__atomic_compare_exchange_n(&stats->peakLiveBytes, &peak, live, true,
+                                                     __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
   }
 }
 
@@ -64,43 +129,365 @@ void displayNEW(Value *list) {
 // pre-existing linkedlist.h. Otherwise you'll end up with circular
 // dependencies, since you're going to modify the linked list to use talloc.
 void *talloc(size_t size) {
-  
-  if (!initialized) {
-    pointers = makeNullNEW();
-    initialized = true;
+  Heap *heap = currentHeap;
+  allocationCount++;
+  if (allocStats) {
+    recordAllocation(allocSite, size);
+    __atomic_add_fetch(&heap->stats->blocks.count, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&heap->stats->blocks.bytes, size, __ATOMIC_RELAXED);
   }
-
-  Value *pointer = malloc(sizeof(Value));
-  pointer->type = PTR_TYPE;
+  struct Allocation *pointer = malloc(sizeof(struct Allocation));
   pointer->p = malloc(size);
+  pointer->next = __atomic_load_n(&heap->pointers, __ATOMIC_RELAXED);
+  while (!__atomic_compare_exchange_n(&heap->pointers, &pointer->next, pointer, true,
+                                      __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+  }
 
-  pointers = consNEW(pointer, pointers);
- 
   return pointer->p;
 }
 
+// Take the next page from the heap's current chunk (starting a new chunk
+// when that one runs out), tag it with the given type, and point next/end at
+// the slots in it. The first slot starts after the header, rounded up to the
+// slot size so that every slot stays aligned.
+PageHeader *newPage(valueType type, size_t slotSize, char **next, char **end) {
+  Heap *heap = currentHeap;
+  pthread_mutex_lock(&heap->chunkLock);
+  if (heap->chunkNext == heap->chunkEnd) {
+    struct Chunk *chunk = malloc(sizeof(struct Chunk));
+    chunk->memory = aligned_alloc(PAGE_SIZE, PAGE_SIZE * CHUNK_PAGES);
+    if (chunk->memory == NULL) {
+      pthread_mutex_unlock(&heap->chunkLock);
+      printf("Out of memory\n");
+      texit(1);
+    }
+    chunk->next = heap->chunks;
+    heap->chunks = chunk;
+    heap->chunkNext = chunk->memory;
+    heap->chunkEnd = chunk->memory + PAGE_SIZE * CHUNK_PAGES;
+  }
+  PageHeader *page = (PageHeader *) heap->chunkNext;
+  heap->chunkNext += PAGE_SIZE;
+  pthread_mutex_unlock(&heap->chunkLock);
+
+  page->type = type;
+  page->heap = heap;
+
+  size_t firstSlot = ((sizeof(PageHeader) + slotSize - 1) / slotSize) * slotSize;
+  //so that printAllocStats can tell the slots never handed out
+  if (allocStats && type == PTR_TYPE) {
+    memset((char *) page + firstSlot, 0xff, PAGE_SIZE - firstSlot);
+  }
+  *next = (char *) page + firstSlot;
+  *end = (char *) page + PAGE_SIZE;
+  return page;
+}
+
+// Allocate one Value from a page of ordinary Values. All Values must come
+// from here (or from tallocPair), since typeOf looks at the page header. It
+// starts with no flags and, if it becomes a symbol, no cached binding.
+Value *tallocValue() {
+  if (valueNext == NULL || valueNext + sizeof(Value) > valueEnd) {
+    newPage(PTR_TYPE, sizeof(Value), &valueNext, &valueEnd);
+  }
+  Value *v = (Value *) valueNext;
+  valueNext += sizeof(Value);
+  allocationCount++;
+  if (allocStats) {
+    recordAllocation(allocSite, sizeof(Value));
+  }
+  v->flags = 0;
+  v->cell = NULL;
+  return v;
+}
+
+// Allocate one car/cdr slot from a page that holds nothing but pairs.
+Pair *tallocPair() {
+  if (pairNext == NULL || pairNext + sizeof(Pair) > pairEnd) {
+    newPage(CONS_TYPE, sizeof(Pair), &pairNext, &pairEnd);
+  }
+  Pair *p = (Pair *) pairNext;
+  pairNext += sizeof(Pair);
+  allocationCount++;
+  if (allocStats) {
+    recordAllocation(allocSite == SITE_EVAL ? SITE_CONS : allocSite, sizeof(Pair));
+    __atomic_add_fetch(&currentHeap->stats->pairs.count, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&currentHeap->stats->pairs.bytes, sizeof(Pair), __ATOMIC_RELAXED);
+  }
+  return p;
+}
+
+// Remember the current top of the frame region.
+RegionMark regionMark() {
+  RegionMark mark;
+  mark.page = regionPage;
+  mark.next = regionNext;
+  return mark;
+}
+
+// How many pair slots of the frame region lie below a position in it.
+long regionSlots(int page, char *next) {
+  if (page < 0) {
+    return 0;
+  }
+  long perPage = PAGE_SIZE / sizeof(Pair) - 1;
+  return page * perPage + (next - (char *) regionPages[page]) / (long) sizeof(Pair) - 1;
+}
+
+// Pop everything allocated in the frame region since the mark was taken.
+void regionRelease(RegionMark mark) {
+  if (allocStats) {
+    long released = regionSlots(regionPage, regionNext) - regionSlots(mark.page, mark.next);
+    __atomic_sub_fetch(&currentHeap->stats->liveBytes, released * sizeof(Pair), __ATOMIC_RELAXED);
+  }
+  regionPage = mark.page;
+  regionNext = mark.next;
+  regionEnd = regionPage < 0 ? NULL : (char *) regionPages[regionPage] + PAGE_SIZE;
+}
+
+// Allocate one pair slot from the frame region. Frames themselves are the
+// same size as a pair, so they come from here too.
+Pair *regionPair() {
+  if (regionNext == NULL || regionNext + sizeof(Pair) > regionEnd) {
+    regionPage++;
+    if (regionPage == regionPageCount) {
+      if (regionPageCount == regionPageCapacity) {
+        regionPageCapacity = regionPageCapacity == 0 ? 16 : regionPageCapacity * 2;
+        regionPages = realloc(regionPages, sizeof(PageHeader *) * regionPageCapacity);
+      }
+      regionPages[regionPageCount] = newPage(CONS_TYPE, sizeof(Pair), &regionNext, &regionEnd);
+      regionPageCount++;
+    }
+    else {
+      regionNext = (char *) regionPages[regionPage] + sizeof(Pair);
+      regionEnd = (char *) regionPages[regionPage] + PAGE_SIZE;
+    }
+  }
+  Pair *p = (Pair *) regionNext;
+  regionNext += sizeof(Pair);
+  allocationCount++;
+  if (allocStats) {
+    recordAllocation(SITE_FRAME, sizeof(Pair));
+    __atomic_add_fetch(&currentHeap->stats->pairs.count, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&currentHeap->stats->pairs.bytes, sizeof(Pair), __ATOMIC_RELAXED);
+  }
+  return p;
+}
+
+Region emptyRegion() {
+  Region region = {NULL, 0, 0, -1, NULL, NULL};
+  return region;
+}
+
+void regionSwap(Region *region) {
+  Region thread = {regionPages, regionPageCount, regionPageCapacity, regionPage,
+                   regionNext, regionEnd};
+  regionPages = region->pages;
+  regionPageCount = region->pageCount;
+  regionPageCapacity = region->pageCapacity;
+  regionPage = region->page;
+  regionNext = region->next;
+  regionEnd = region->end;
+  *region = thread;
+}
+
+void regionFree(Region *region) {
+  free(region->pages);
+  *region = emptyRegion();
+}
+
+void *tallocMap(int fd, size_t size) {
+  void *memory = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (memory == MAP_FAILED) {
+    return NULL;
+  }
+  struct Mapping *mapping = malloc(sizeof(struct Mapping));
+  mapping->memory = memory;
+  mapping->size = size;
+  pthread_mutex_lock(&currentHeap->chunkLock);
+  mapping->next = currentHeap->mappings;
+  currentHeap->mappings = mapping;
+  pthread_mutex_unlock(&currentHeap->chunkLock);
+  return memory;
+}
+
+Heap *newHeap() {
+  Heap *heap = malloc(sizeof(Heap));
+  heap->pointers = NULL;
+  pthread_mutex_init(&heap->chunkLock, NULL);
+  heap->chunks = NULL;
+  heap->chunkNext = heap->chunkEnd = NULL;
+  heap->mappings = NULL;
+  heap->allocations = 0;
+  heap->stats = allocStats ? calloc(1, sizeof(struct AllocStats)) : NULL;
+  heap->threaded = false;
+  return heap;
+}
+
+bool heapOwns(Heap *heap, const void *p) {
+  return pageOf(p)->heap == heap;
+}
+
+// Switching heaps leaves the old heap's pages behind: the thread's
+// allocation buffers and frame region start afresh in the new one.
+void useHeap(Heap *heap) {
+  if (heap == NULL) {
+    heap = &defaultHeap;
+  }
+  if (heap != currentHeap) {
+    tallocThreadExit();
+    currentHeap = heap;
+  }
+}
+
+void freeHeap(Heap *heap) {
+  Heap *previous = currentHeap;
+  useHeap(heap);
+  tfree();
+  useHeap(previous == heap ? NULL : previous);
+  pthread_mutex_destroy(&heap->chunkLock);
+  free(heap->stats);
+  free(heap);
+}
+
+void tallocSetThreaded(bool isThreaded) {
+  currentHeap->threaded = isThreaded;
+}
+
+void tallocSetExitHandler(jmp_buf *handler) {
+  exitHandler = handler;
+}
+
+void tallocEnableStats() {
+  allocStats = true;
+  if (currentHeap->stats == NULL) {
+    currentHeap->stats = calloc(1, sizeof(struct AllocStats));
+  }
+}
+
+AllocSite tallocSetSite(AllocSite site) {
+  AllocSite outer = allocSite;
+  allocSite = site;
+  return outer;
+}
+
+// Prints a heap's statistics to stderr. The Values are counted by type
+// here, page by page, skipping the slots newPage marked as unused.
+void printAllocStats(Heap *heap) {
+  struct AllocStats *stats = heap->stats;
+  long total = 0;
+  long totalBytes = 0;
+  for (int i = 0; i < SITE_COUNT; i++) {
+    total += stats->bySite[i].count;
+    totalBytes += stats->bySite[i].bytes;
+  }
+  if (total == 0) {
+    return;
+  }
+
+  long byType[VALUE_TYPE_COUNT] = {0};
+  for (struct Chunk *chunk = heap->chunks; chunk != NULL; chunk = chunk->next) {
+    char *end = chunk == heap->chunks ? heap->chunkNext : chunk->memory + PAGE_SIZE * CHUNK_PAGES;
+    for (char *page = chunk->memory; page < end; page += PAGE_SIZE) {
+      if (((PageHeader *) page)->type != PTR_TYPE) {
+        continue;
+      }
+      size_t firstSlot = ((sizeof(PageHeader) + sizeof(Value) - 1) / sizeof(Value)) * sizeof(Value);
+      for (char *slot = page + firstSlot; slot + sizeof(Value) <= page + PAGE_SIZE; slot += sizeof(Value)) {
+        unsigned type = ((Value *) slot)->type;
+        if (type < VALUE_TYPE_COUNT) {
+          byType[type]++;
+        }
+      }
+    }
+  }
+
+  fprintf(stderr, "allocation stats: %ld allocations, %ld bytes, peak live %ld bytes\n",
+          total, totalBytes, stats->peakLiveBytes);
+  fprintf(stderr, "  %-20s %12s %14s\n", "by type", "count", "bytes");
+  for (int i = 0; i < VALUE_TYPE_COUNT; i++) {
+    if (byType[i] != 0) {
+      fprintf(stderr, "  %-20s %12ld %14ld\n", typeName(i), byType[i], byType[i] * (long) sizeof(Value));
+    }
+  }
+  if (stats->pairs.count != 0) {
+    fprintf(stderr, "  %-20s %12ld %14ld\n", "pairs", stats->pairs.count, stats->pairs.bytes);
+  }
+  if (stats->blocks.count != 0) {
+    fprintf(stderr, "  %-20s %12ld %14ld\n", "other blocks", stats->blocks.count, stats->blocks.bytes);
+  }
+  fprintf(stderr, "  %-20s %12s %14s\n", "by site", "count", "bytes");
+  for (int i = 0; i < SITE_COUNT; i++) {
+    if (stats->bySite[i].count != 0) {
+      fprintf(stderr, "  %-20s %12ld %14ld\n", siteNames[i], stats->bySite[i].count, stats->bySite[i].bytes);
+    }
+  }
+}
+
+long tallocCount() {
+  return __atomic_load_n(&currentHeap->allocations, __ATOMIC_RELAXED) + allocationCount;
+}
+
+// The thread's pages belong to the heap's chunks and go when tfree runs;
+// whatever is left of its allocation buffers is simply abandoned. Only its
+// index of region pages has to go now.
+void tallocThreadExit() {
+  __atomic_add_fetch(&currentHeap->allocations, allocationCount, __ATOMIC_RELAXED);
+  allocationCount = 0;
+  valueNext = valueEnd = NULL;
+  pairNext = pairEnd = NULL;
+  free(regionPages);
+  regionPages = NULL;
+  regionPageCount = regionPageCapacity = 0;
+  regionPage = -1;
+  regionNext = regionEnd = NULL;
+}
+
 // Free all pointers allocated by talloc, as well as whatever memory you
 // allocated in lists to hold those pointers.
 void tfree() {
-  if (!initialized)
-    return;
-  Value *curVal = pointers;
-  Value *nextVal;
-  while (curVal->type != NULL_TYPE) {
-    nextVal = cdrNEW(curVal);
-    free(carNEW(curVal)->p);
-    free(carNEW(curVal));
-    free(curVal);
-    curVal = nextVal;
+  Heap *heap = currentHeap;
+  if (heap->stats != NULL) {
+    printAllocStats(heap);
+    memset(heap->stats, 0, sizeof(struct AllocStats));
+  }
+  while (heap->chunks != NULL) {
+    struct Chunk *next = heap->chunks->next;
+    free(heap->chunks->memory);
+    free(heap->chunks);
+    heap->chunks = next;
+  }
+  heap->chunkNext = heap->chunkEnd = NULL;
+  while (heap->mappings != NULL) {
+    struct Mapping *next = heap->mappings->next;
+    munmap(heap->mappings->memory, heap->mappings->size);
+    free(heap->mappings);
+    heap->mappings = next;
+  }
+
+  tallocThreadExit();
+
+  while (heap->pointers != NULL) {
+    struct Allocation *next = heap->pointers->next;
+    free(heap->pointers->p);
+    free(heap->pointers);
+    heap->pointers = next;
   }
-  free(curVal);
-  initialized = false;
 }
 
 // Replacement for the C function "exit", that consists of two lines: it calls
 // tfree before calling exit. It's useful to have later on; if an error happens,
 // you can exit your program, and all memory is automatically cleaned up.
+// If the thread's host installed an exit handler, only the program ends: the
+// host gets the status back there, and frees the heap itself. While other
+// threads are running, they might still be using memory tfree would release,
+// so then the operating system gets to clean up instead.
 void texit(int status) {
-  tfree();
+  if (exitHandler != NULL) {
+    longjmp(*exitHandler, status == 0 ? EXIT_FAILURE : status);
+  }
+  if (!currentHeap->threaded) {
+    tfree();
+  }
   exit(status);
 }
@@ -1,4 +1,6 @@
 #include <stdlib.h>
+#include <stdbool.h>
+#include <setjmp.h>
 #include "value.h"
 
 #ifndef _TALLOC
@@ -11,8 +13,114 @@
 // dependencies, since you're going to modify the linked list to use talloc.
 void *talloc(size_t size);
 
+// Map the first size bytes of an open file into memory, read-only, until
+// the heap is freed. Returns NULL if the file can't be mapped.
+void *tallocMap(int fd, size_t size);
+
+// Allocate one Value from a page of ordinary Values. Every Value has to come
+// from here or from tallocPair, since typeOf finds a value's type through the
+// header of the page it lives on.
+Value *tallocValue();
+
+// Allocate one pair (just a car and a cdr) from a page reserved for pairs.
+Pair *tallocPair();
+
+// A position in the frame region, which holds frames and bindings that the
+// escape analysis proved can't outlive the call or let that created them.
+typedef struct RegionMark {
+  int page;
+  char *next;
+} RegionMark;
+
+// Remember the current top of the frame region.
+RegionMark regionMark();
+
+// Pop everything allocated in the frame region since the mark was taken.
+void regionRelease(RegionMark mark);
+
+// Allocate one pair slot from the frame region.
+Pair *regionPair();
+
+// A frame region set aside: its index of pages and how far it is filled.
+// Each coroutine has one of its own, since the frames a suspended coroutine
+// is in the middle of don't nest with the ones made while it waits.
+typedef struct Region {
+  PageHeader **pages;
+  int pageCount;
+  int pageCapacity;
+  int page;
+  char *next;
+  char *end;
+} Region;
+
+// A region with nothing in it.
+Region emptyRegion();
+
+// Exchange this thread's frame region with *region.
+void regionSwap(Region *region);
+
+// Free a region set aside. Its pages belong to the heap, so only the index
+// goes now.
+void regionFree(Region *region);
+
+// What an allocation was for, as far as --alloc-stats can tell. Each thread
+// has a current site, which the tokenizer, parser and evaluator set while
+// they run. While evaluating, pairs count as cons, except those in the frame
+// region, which count as frames.
+typedef enum {
+  SITE_OTHER, SITE_TOKENIZER, SITE_PARSER, SITE_EVAL, SITE_FRAME, SITE_CONS, SITE_NUMBER,
+  SITE_COUNT
+} AllocSite;
+
+// Whether allocation statistics are being kept. Only tallocEnableStats sets
+// it, before anything has been allocated.
+extern bool allocStats;
+
+// Count allocations from now on, by type and site, along with the peak of
+// live bytes, and print a summary to stderr whenever a heap is freed.
+void tallocEnableStats();
+
+// Make site the one this thread's allocations are charged to, and return the
+// one it replaces.
+AllocSite tallocSetSite(AllocSite site);
+
+// Everything one interpreter allocates. talloc and friends allocate from the
+// calling thread's current heap, which is a process-wide default one unless
+// useHeap has set another.
+typedef struct Heap Heap;
+
+Heap *newHeap();
+
+// Whether a Value or pair was allocated from heap.
+bool heapOwns(Heap *heap, const void *p);
+
+// Make heap (or the default one, given NULL) the one this thread allocates
+// from.
+void useHeap(Heap *heap);
+
+// tfree a heap and discard it.
+void freeHeap(Heap *heap);
+
+// Tell talloc whether other threads may be allocating from the current heap
+// at the same time. Every thread allocates from buffers of its own, so
+// everything here is safe to call from any thread; this only decides whether
+// texit can free.
+void tallocSetThreaded(bool isThreaded);
+
+// Have texit on this thread longjmp to handler with the exit status instead
+// of ending the process, or go back to exiting given NULL.
+void tallocSetExitHandler(jmp_buf *handler);
+
+// How many blocks, Values and pairs have been allocated from the current
+// heap, counting this thread's and those of threads that have left it.
+long tallocCount();
+
+// Release a finishing thread's own bookkeeping: its allocation buffers and
+// its frame region index.
+void tallocThreadExit();
+
 // Free all pointers allocated by talloc, as well as whatever memory you
-// allocated in lists to hold those pointers.
+// allocated in lists to hold those pointers. This frees the current heap.
 void tfree();
 
 // Replacement for the C function "exit", that consists of two lines: it calls
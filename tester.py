@@ -18,18 +18,31 @@ import signal
 TestResult = collections.namedtuple('TestResult', ['output', 'error'])
 
 
-def get_student_output(executable_command, test_path) -> str:
+def get_flags(test_dir, test_name) -> list:
+    '''Command-line options a test runs the interpreter with, from its .flags
+    file if it has one.'''
+    flags_path = os.path.join(test_dir, test_name + ".flags")
+    if not os.path.exists(flags_path):
+        return []
+    return open(flags_path, 'r').read().split()
+
+
+def get_student_output(executable_command, test_path, flags=[]) -> str:
+    '''A test with flags also has the exit status checked, as a last line of
+    output.'''
     try:
         student_process = subprocess.run(
-            executable_command,
+            [executable_command] + flags,
             stdin=open(test_path, 'r'),
             stderr=subprocess.STDOUT,
             stdout=subprocess.PIPE,
             timeout=10)
         if (student_process.returncode == -signal.SIGSEGV):
             return "Segmentation fault"
-        else:
-            return student_process.stdout.decode('utf-8')
+        output = student_process.stdout.decode('utf-8')
+        if flags:
+            output += "\nexit %d\n" % student_process.returncode
+        return output
     except subprocess.TimeoutExpired:
         return "Timed out"
 
@@ -40,20 +53,22 @@ def get_correct_output(test_path) -> str:
     return correct_output.read()
 
 
-def clean_output(output: str) -> str:
+def clean_output(output: str, exact_errors=False) -> str:
     '''Clean up output as much as possible to allow the student output and the
     correct output to be compared.'''
     result = output
 
     # If any line starts off with an error phrase, truncate the line just to
-    # include the error. This is for test matching purposes.
-    result = re.sub('^Syntax error.*$', 'Syntax error',
-                    result,
-                    flags=re.MULTILINE | re.IGNORECASE)
-    result = re.sub('^Evaluation error.*$',
-                    'Evaluation error',
-                    result,
-                    flags=re.MULTILINE | re.IGNORECASE)
+    # include the error. This is for test matching purposes. Tests with flags
+    # check the whole message.
+    if not exact_errors:
+        result = re.sub('^Syntax error.*$', 'Syntax error',
+                        result,
+                        flags=re.MULTILINE | re.IGNORECASE)
+        result = re.sub('^Evaluation error.*$',
+                        'Evaluation error',
+                        result,
+                        flags=re.MULTILINE | re.IGNORECASE)
 
     # Sequences of one or more whitespace
     result = re.sub('\\s+', ' ', result)
@@ -82,13 +97,15 @@ def clean_output(output: str) -> str:
     return result
 
 
-def run_tests_with_valgrind(executable_command, test_path) -> TestResult:
+def run_tests_with_valgrind(executable_command, test_path,
+                            flags=[]) -> TestResult:
     '''Run again with valgrind (just student version) and look for errors)'''
     valgrind_command = ['valgrind',
                         '--leak-check=full',
                         '--show-leak-kinds=all',
                         '--error-exitcode=99']
     valgrind_command.append(executable_command)
+    valgrind_command.extend(flags)
 
     try:
         process = subprocess.run(
@@ -122,12 +139,13 @@ def main() -> None:
 
         test_input_path = os.path.join(test_dir, test_name + ".scm")
         test_output_path = os.path.join(test_dir, test_name + ".output")
+        flags = get_flags(test_dir, test_name)
         student_output = get_student_output(executable_command,
-                                            test_input_path)
-        student_output = clean_output(student_output)
+                                            test_input_path, flags)
+        student_output = clean_output(student_output, bool(flags))
 
         correct_output = get_correct_output(test_output_path)
-        correct_output = clean_output(correct_output)
+        correct_output = clean_output(correct_output, bool(flags))
 
         if student_output != correct_output:
             error_encountered = True
@@ -141,7 +159,8 @@ def main() -> None:
 
         valgrind_test_results = run_tests_with_valgrind(
             executable_command,
-            test_input_path)
+            test_input_path,
+            flags)
 
         if valgrind_test_results.error:
             error_encountered = True
@@ -0,0 +1,16 @@
+(quote (1 2 3))
+(car (quote (1 2 3)))
+(cdr (quote (1 2 3)))
+(cdr (quote (3)))
+(null? (cdr (quote (3))))
+(null? (quote (1)))
+(null? (quote ()))
+(cons 1 (quote (2 3)))
+(cons (quote (1 2)) (quote (3)))
+(cons 1 2)
+(cons 1 (quote ()))
+(car (cdr (cons 1 (cons 2 (quote ())))))
+(quote a)
+(define lst (quote (1 (2 3) 4)))
+(car (cdr lst))
+(cdr (cdr (cdr lst)))
@@ -0,0 +1,18 @@
+(define lst (quote (1 2 3 4 5)))
+(length lst)
+(length (quote ()))
+(append (quote (1 2)) (quote (3)) (quote (4 5)))
+(append (quote ()) (quote (1)))
+(append)
+(reverse lst)
+(map (lambda (x) (* x x)) lst)
+(map + (quote (1 2 3)) (quote (10 20)))
+(filter (lambda (x) (> x 2)) lst)
+(foldl + 0 lst)
+(foldl cons (quote ()) (quote (1 2 3)))
+(assoc (quote b) (quote ((a 1) (b 2) (c 3))))
+(assoc 4 (quote ((1 one) (2 two))))
+(member 3 lst)
+(member 9 lst)
+(list-ref lst 2)
+(list-ref lst 5)
@@ -0,0 +1,12 @@
+(+ 1 2)
+(- 10 4.5)
+(* 3 4)
+(< 1 2)
+(> 1 2)
+(= 2 2.0)
+(+ 1 2 3)
+(let ((< (lambda (a b) #t)))
+  (< 5 1))
+(define + (lambda (a b) (* a b)))
+(+ 3 4)
+(- 1 (quote a))
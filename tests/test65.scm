@@ -0,0 +1,10 @@
+(define count-args (lambda args (length args)))
+(count-args)
+(count-args 1 2 3)
+(define first-and-rest (lambda args (cons (car args) (cdr args))))
+(first-and-rest 1 2 3)
+(map (lambda (x y) (+ x y)) (quote (1 2 3)) (quote (4 5 6)))
+(foldl (lambda (x acc) (+ acc (* x x))) 0 (quote (1 2 3)))
+(define add3 (lambda (a b c) (+ a b c)))
+(add3 1 2 3)
+(add3 1 2)
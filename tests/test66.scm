@@ -0,0 +1,19 @@
+(define count
+  (lambda (n)
+    (if (= n 0) 0 (+ 1 (count (- n 1))))))
+(count 5000)
+(define make-adder (lambda (n) (lambda (x) (+ x n))))
+(define add5 (make-adder 5))
+(count 100)
+(add5 10)
+(let* ((x 1) (x (+ x 1))) x)
+(let* ((f (lambda () 10)) (g (lambda () (f)))) (g))
+(define sum-list
+  (lambda (lst)
+    (let ((head (car lst)) (tail (cdr lst)))
+      (if (null? tail) head (+ head (sum-list tail))))))
+(sum-list (quote (1 2 3 4 5)))
+(letrec ((a 1) (b 2)) (let ((c 3)) (+ a b c)))
+(let ((x 2))
+  (let ((k (lambda (y) (* x y))))
+    (let ((z 4)) (k z))))
@@ -0,0 +1,16 @@
+(define fib
+  (memoize
+    (lambda (n)
+      (if (< n 2) n (+ (fib (- n 1)) (fib (- n 2)))))))
+(fib 40)
+(memo-stats fib)
+(fib 30)
+(define slow-len (memoize (lambda (lst) (length lst)) 2))
+(slow-len (quote (1 2 3)))
+(slow-len (quote (1 2 3)))
+(slow-len (quote (a b)))
+(slow-len (quote ()))
+(slow-len (quote (1 2 3)))
+(memo-stats slow-len)
+fib
+(memoize 5)
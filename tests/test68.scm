@@ -0,0 +1,33 @@
+;; Programs whose meaning the optimizer must not change
+(+ 1 2)
+(* 2.5 (- 10 4))
+(if (< 1 2) "yes" "no")
+((lambda (x y) (+ x y)) 5 (* 3 3))
+((lambda (x) (* x x)) 7)
+((lambda () 42))
+(define square (lambda (x) (* x x)))
+(square 12)
+(define sumsq (lambda (a b) (+ (square a) (square b))))
+(sumsq 3 4)
+(let ((square (lambda (x) x))) (square 5))
+(define fact (lambda (n) (if (= n 0) 1 (* n (fact (- n 1))))))
+(fact 5)
+(define counter 0)
+(define bump (lambda (n) (+ counter n)))
+(set! counter 10)
+(bump 1)
+(define twice (lambda (f x) (f (f x))))
+(twice square 3)
+(let ((+ -)) (+ 5 3))
+(define y 5)
+(define gety (lambda () y))
+(let ((y 100)) (gety))
+(define addy (lambda (x) (+ x y)))
+(define f (lambda (y) (addy y)))
+(f 1)
+(define h (lambda (n) (* n 2)))
+(define h (lambda (n) (* n 3)))
+(h 1)
+(define quoted (lambda (x) (quote x)))
+(quoted 1)
+(if #f 1)
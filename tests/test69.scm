@@ -0,0 +1,27 @@
+(define x 1)
+(define getx (lambda () x))
+(getx)
+(define x 2)
+(getx)
+(set! x 3)
+(getx)
+(define shadow
+  (lambda (n)
+    (begin
+      (define result x)
+      (define x n)
+      (+ result x))))
+(shadow 10)
+(shadow 20)
+(getx)
+(define count 0)
+(define loop
+  (lambda (n)
+    (if (= n 0)
+        count
+        (begin (set! count (+ count 1)) (loop (- n 1))))))
+(loop 1000)
+(define + -)
+(+ 10 4)
+(define f (lambda (y) (let ((x y)) (getx))))
+(f 99)
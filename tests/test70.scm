@@ -0,0 +1,22 @@
+(define pfib
+  (lambda (n)
+    (if (< n 15)
+        (if (< n 2) n (+ (pfib (- n 1)) (pfib (- n 2))))
+        (let ((left (future (pfib (- n 1))))
+              (right (pfib (- n 2))))
+          (+ (touch left) right)))))
+(pfib 22)
+(define f (future (* 6 7)))
+(touch f)
+(touch f)
+(touch 5)
+(define sum-list
+  (lambda (lst)
+    (if (null? lst) 0 (+ (car lst) (sum-list (cdr lst))))))
+(define parts (map (lambda (lst) (future (sum-list lst))) (quote ((1 2 3) (4 5 6) (7 8 9)))))
+(map touch parts)
+(future 1)
+(define bad (future (car 5)))
+"before the error"
+(touch bad)
+"never printed"
@@ -0,0 +1,31 @@
+(define numbers (make-channel))
+(define doubled (make-channel 4))
+(define produce
+  (lambda (i n)
+    (if (< i n)
+        (begin (send numbers i) (produce (+ i 1) n))
+        (send numbers -1))))
+(define double
+  (lambda ()
+    (let ((v (receive numbers)))
+      (if (< v 0)
+          (send doubled -1)
+          (begin (send doubled (* 2 v)) (double))))))
+(spawn (produce 0 5))
+(spawn (double))
+(define collect
+  (lambda ()
+    (let ((v (receive doubled)))
+      (if (< v 0) (quote ()) (cons v (collect))))))
+(collect)
+(define counter 0)
+(spawn (begin (set! counter (+ counter 1)) (yield) (set! counter (+ counter 10))))
+counter
+(yield)
+counter
+(yield)
+counter
+numbers
+(spawn (receive numbers))
+"before the deadlock"
+(receive doubled)
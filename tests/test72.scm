@@ -0,0 +1,19 @@
+(define out (open-output-file "/tmp/interpreter-test72.txt"))
+out
+(write-string out "first line")
+(write-string out "
+second")
+(close-port out)
+(define in (open-input-file "/tmp/interpreter-test72.txt"))
+(read-char in)
+(peek-char in)
+(read-char in)
+(read-line in)
+(read-line in)
+(define end (read-line in))
+end
+(eof-object? end)
+(eof-object? (read-char in))
+(close-port in)
+(member (read-line (open-input-file "/tmp/interpreter-test72.txt")) (quote ("first" "first line")))
+(read-line in)
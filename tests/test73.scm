@@ -0,0 +1,31 @@
+(define out (open-output-file "/tmp/interpreter-test73.csv"))
+(write-string out "name,count,price,note
+apple,3,1.25,red
+
+pear,-12,2,
+plum,7,0.5e1,ripe,extra
+fig,40,3
+")
+(close-port out)
+(define table (read-csv "/tmp/interpreter-test73.csv"))
+table
+(define counts (cdr (assoc "count" table)))
+(vector? counts)
+(vector-length counts)
+(vector-ref counts 1)
+(vector-fold + 0 counts)
+(vector-fold + 0 (cdr (assoc "price" table)))
+(vector->list (cdr (assoc "name" table)))
+(member (vector-ref (cdr (assoc "name" table)) 0) (quote ("apple")))
+(define out (open-output-file "/tmp/interpreter-test73.tsv"))
+(write-string out "a	b
+1,5	x
+2,5	y
+")
+(close-port out)
+(read-csv "/tmp/interpreter-test73.tsv")
+(read-csv "/tmp/interpreter-test73.tsv" ",")
+(vector 1 "two" (quote three))
+(list->vector (quote (1 2 3)))
+(vector? (quote (1 2)))
+(vector-ref counts 4)
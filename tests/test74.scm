@@ -0,0 +1,54 @@
+(define sum-to
+  (lambda (n)
+    (let ((i 0) (total 0))
+      (letrec ((loop (lambda ()
+                       (if (< i n)
+                           (begin (set! total (+ total (* i i)))
+                                  (set! i (+ i 1))
+                                  (loop))
+                           total))))
+        (loop)))))
+(sum-to 100)
+(sum-to 1000)
+(define average
+  (lambda (a b c)
+    (let* ((total 0.0) (count 0))
+      (set! total (+ total a))
+      (set! total (+ total b))
+      (set! total (+ total c))
+      (set! count (+ count 3))
+      (* total (- 2 (* count 0.5))))))
+(average 1 2 3)
+(let ((i 0) (saved 0))
+  (set! saved i)
+  (set! i (+ i 1))
+  (set! i (+ i 1))
+  (cons saved (cons i (quote ()))))
+(let ((x 1))
+  (set! x (+ x 0.5))
+  (set! x (* x 2))
+  x)
+(let ((counter 0))
+  (define next (lambda () (begin (set! counter (+ counter 1)) counter)))
+  (next)
+  (next)
+  (next))
+(define make-counter
+  (lambda ()
+    (let ((n 0))
+      (lambda () (begin (set! n (+ n 1)) n)))))
+(define c1 (make-counter))
+(define c2 (make-counter))
+(c1)
+(c1)
+(define first (c1))
+(c2)
+(c1)
+first
+(+ (* 2 3) (- 10 (* 4 0.5)))
+(< (+ 1 2) (* 2 2))
+(let ((+ -)) (+ (* 3 3) 1))
+(let ((n 5))
+  (set! n (+ n (car (quote (1)))))
+  n)
+(+ (< 1 2) 3)
@@ -0,0 +1,35 @@
+(define-syntax swap!
+  (syntax-rules ()
+    ((swap! a b) (let ((tmp a)) (begin (set! a b) (set! b tmp))))))
+(define x 1)
+(define y 2)
+(swap! x y)
+x
+y
+
+(define-syntax my-or
+  (syntax-rules ()
+    ((my-or) #f)
+    ((my-or e) e)
+    ((my-or e r ...) (let ((t e)) (if t t (my-or r ...))))))
+(my-or)
+(my-or #f #f 3)
+
+(define-syntax for
+  (syntax-rules (in)
+    ((for v in lst body) (map (lambda (v) body) lst))))
+(for n in (quote (1 2 3)) (* n n))
+
+(define-syntax my-let
+  (syntax-rules ()
+    ((my-let ((n v) ...) body) ((lambda (n ...) body) v ...))))
+(my-let ((a 1) (b 2)) (+ a b))
+
+(let* ((a 1) (b (+ a 1)) (a (* b 10))) a)
+(let* () 5)
+(let ((swap! (lambda (a b) (+ a b)))) (swap! 3 4))
+(quote (swap! 1 2))
+
+(define broken (lambda () (for 1)))
+(my-or 7)
+(broken)
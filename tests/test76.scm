@@ -0,0 +1,36 @@
+(define empty (pmap-empty))
+(define m1 (pmap-set (pmap-set empty "apple" 3) "pear" 5))
+(define m2 (pmap-set m1 "apple" 4))
+(define m3 (pmap-remove m2 "pear"))
+(pmap-ref m1 "apple")
+(pmap-ref m2 "apple")
+(pmap-ref m3 "pear" 0)
+(pmap-count m1)
+(pmap-count m3)
+m2
+(pmap? m3)
+(pmap? (quote ()))
+
+(define fill
+  (lambda (m i n)
+    (if (= i n)
+        m
+        (fill (pmap-set m i (* i i)) (+ i 1) n))))
+(define squares (fill empty 0 2000))
+(define drop-odd
+  (lambda (m i n)
+    (if (> i n)
+        m
+        (drop-odd (pmap-remove m i) (+ i 2) n))))
+(define evens (drop-odd squares 1 2000))
+(pmap-count squares)
+(pmap-count evens)
+(pmap-ref squares 1999)
+(pmap-ref evens 1999 -1)
+(pmap-ref evens 1998)
+(pmap-fold (lambda (k v acc) (+ acc k)) 0 evens)
+
+(pmap-ref (pmap-set empty (quote (1 2)) "list key") (quote (1 2)))
+(pmap-ref (pmap-set empty 1.5 (quote x)) 1.5)
+(pmap-count (pmap-remove empty 1))
+(pmap-ref m3 "pear")
@@ -0,0 +1,12 @@
+(define build
+  (lambda (n acc)
+    (if (= n 0) acc (build (- n 1) (cons n acc)))))
+(define before (heap-dump "/tmp/interpreter-test77.txt"))
+(define kept (build 1000 (quote ())))
+(define after (heap-dump "/tmp/interpreter-test77.txt"))
+(> after before)
+(> (- after before) 16000)
+(define dropped (build 1000 (quote ())))
+(set! dropped 0)
+(< (- (heap-dump "/tmp/interpreter-test77.txt") after) 200)
+(heap-dump 5)
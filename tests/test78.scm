@@ -0,0 +1,8 @@
+(define loop
+  (lambda (n)
+    (if (= n 0) 0 (loop (- n 1)))))
+(loop 28000)
+(define down
+  (lambda (n)
+    (if (> n 0) (down (- n 1)) n)))
+(down 28000)
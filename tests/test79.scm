@@ -0,0 +1,9 @@
+49
+(inc) (inc) (inc) counter
+(define local 5)
+local
+12
+(inc)
+local
+14
+(inc) counter
@@ -0,0 +1,10 @@
+(define inner
+  (lambda (n)
+    (if (= n 0) 0 (inner (- n 1)))))
+(define outer
+  (lambda (n)
+    (if (= n 0) 0 (begin (inner 1000) (outer (- n 1))))))
+"started"
+(inner 1000)
+(outer 100)
+"finished"
@@ -0,0 +1,3 @@
+(define first (memoize car 4))
+(first (quote (1 2)))
+(memoize car 2000000000)
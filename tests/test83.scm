@@ -0,0 +1,15 @@
+49
+(next) (next)
+(remember (cons 1.5 2.5))
+(recall)
+31
+(cons 7.0 8.0)
+(recall)
+(next)
+42
+(remember (quote (1 2)))
+(next)
+undefined
+16
+(recall)
+(next)
@@ -0,0 +1,8 @@
+21
+(vector-ref names 0)
+36
+(cons 1.5 2.5)
+(vector-ref names 1)
+27
+(vector-ref names 0)
+names
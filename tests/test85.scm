@@ -0,0 +1,13 @@
+63
+(send ch (cons 1.5 2.5))
+(receive ch)
+(send ch (cons 3.5 4.5))
+28
+(cons 7.0 8.0)
+(receive ch)
+31
+(spawn (receive ch))
+"waiting"
+25
+(send ch 5)
+(receive ch)
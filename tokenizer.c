@@ -6,13 +6,15 @@
 #include "tokenizer.h"
 #include "talloc.h"
 #include "linkedlist.h"
+#include "context.h"
 
-// Read all of the input from stdin, and return a linked list consisting of the
-// tokens.
-Value *tokenize() {
+// Read all of the input from the given stream, and return a linked list
+// consisting of the tokens.
+Value *tokenize(FILE *input) {
+  AllocSite outerSite = tallocSetSite(SITE_TOKENIZER);
   char charRead;
   Value *list = makeNull();
-  charRead = (char)fgetc(stdin);
+  charRead = (char)fgetc(input);
 
   char *digits = talloc(sizeof(char)*13);
   strcpy(digits, "01234567890.");
@@ -28,18 +30,17 @@ Value *tokenize() {
     //string
     if (charRead == '\"') {
       char *str = talloc(sizeof(char)*300);
-      charRead = (char)fgetc(stdin);
+      charRead = (char)fgetc(input);
       str[0] = '\"';
       int i = 1;
       while (charRead != '\"' && charRead != EOF) {
         str[i] = charRead;
         i++;
-        charRead = (char)fgetc(stdin);
+        charRead = (char)fgetc(input);
       }
       str[i] ='\"';
       str[i+1] = '\0';
-      Value *v = talloc(sizeof(Value));
-      v->type = STR_TYPE;
+      Value *v = makeValue(STR_TYPE);
       v->s = str;
       list = cons(v, list);
     }
@@ -47,30 +48,27 @@ Value *tokenize() {
     //comment
     else if (charRead == ';') {
       while (charRead != '\n' && charRead != EOF) {
-        charRead = (char)fgetc(stdin);
+        charRead = (char)fgetc(input);
       }
-      charRead = (char)ungetc(charRead, stdin);
+      charRead = (char)ungetc(charRead, input);
     }
 
     //open
     else if (charRead == '(') {
-      Value *v = talloc(sizeof(Value));
-      v->type = OPEN_TYPE;
+      Value *v = makeValue(OPEN_TYPE);
       list = cons(v, list);
     }
     
     //close
     else if (charRead == ')') {
-      Value *v = talloc(sizeof(Value));
-      v->type = CLOSE_TYPE;
+      Value *v = makeValue(CLOSE_TYPE);
       list = cons(v, list);
     }
     
     //bool
     else if (charRead == '#') {
-      charRead = (char)fgetc(stdin);
-      Value *v = talloc(sizeof(Value));
-      v->type = BOOL_TYPE;
+      charRead = (char)fgetc(input);
+      Value *v = makeValue(BOOL_TYPE);
 
       //true
       if (charRead == 't') {
@@ -83,7 +81,7 @@ Value *tokenize() {
       }
 
       else {
-        printf("ERROR");
+        fprintf(currentContext->output, "ERROR");
         texit(1);
       }
 
@@ -92,7 +90,7 @@ Value *tokenize() {
 
     //signs
     else if (strchr(signs, charRead) != NULL) {
-      Value *v = talloc(sizeof(Value));
+      Value *v = tallocValue();
       char *sign = talloc(sizeof(char)*300);
       sign[0] = charRead;
 
@@ -101,7 +99,7 @@ Value *tokenize() {
         isPlus = true;
       }
       
-      charRead = (char)fgetc(stdin);
+      charRead = (char)fgetc(input);
       int i = 1;
 
       //symbol
@@ -117,7 +115,7 @@ Value *tokenize() {
         //v->s = sign[0];
         list = cons(v, list);
         if (charRead == ')') {
-          charRead = (char)ungetc(charRead, stdin);
+          charRead = (char)ungetc(charRead, input);
         }
       }
 
@@ -125,11 +123,11 @@ Value *tokenize() {
       else if (strchr(digits, charRead) != NULL) {
         while (strchr(digits, charRead) != NULL) {
           sign[i] = charRead;
-          charRead = (char)fgetc(stdin);
+          charRead = (char)fgetc(input);
           i++;
         }
         sign[i] = '\0';
-        charRead = (char)ungetc(charRead, stdin);
+        charRead = (char)ungetc(charRead, input);
         if (strchr(sign, '.')) {
           v->type = INT_TYPE;
           int newNum = atoi(sign);
@@ -147,17 +145,22 @@ Value *tokenize() {
 
     //numbers
     else if (strchr(digits, charRead) != NULL) {
-      Value *v = talloc(sizeof(Value));
+      Value *v = tallocValue();
       char *num = talloc(sizeof(char)*300);
       int i = 0;
       while (strchr(digits, charRead) != NULL) {
         num[i] = charRead;
-        charRead = (char)fgetc(stdin);
+        charRead = (char)fgetc(input);
         i++;
       }
       num[i] = '\0';
-      charRead = (char)ungetc(charRead, stdin);
-      if (!strchr(num, '.')) {
+      charRead = (char)ungetc(charRead, input);
+      //dots alone, like the ... of syntax-rules, make a symbol
+      if (strspn(num, ".") == (size_t) i) {
+        v->type = SYMBOL_TYPE;
+        v->s = num;
+      }
+      else if (!strchr(num, '.')) {
       //if (strchr(num, '.') == NULL) {
         v->type = INT_TYPE;
         int newNum = atoi(num);
@@ -184,26 +187,26 @@ Value *tokenize() {
       while (strchr(symbols, charRead) != NULL) {
         sym[i] = charRead;
         i++;
-        charRead = (char)fgetc(stdin);
+        charRead = (char)fgetc(input);
       }
-      charRead = (char)ungetc(charRead, stdin);
+      charRead = (char)ungetc(charRead, input);
       sym[i] = '\0';
-      Value *v = talloc(sizeof(Value));
-      v->type = SYMBOL_TYPE;
+      Value *v = makeValue(SYMBOL_TYPE);
       v->s = sym;
 
       list = cons(v, list);
     }
 
     else {
-      printf("ERROR");
+      fprintf(currentContext->output, "ERROR");
       texit(1);
     }
 
-    charRead = (char)fgetc(stdin);
+    charRead = (char)fgetc(input);
   }
   
   Value *revList = reverse(list);
+  tallocSetSite(outerSite);
   return revList;
 }
 
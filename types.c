@@ -0,0 +1,327 @@
+#include <stdbool.h>
+#include <string.h>
+#include "value.h"
+#include "linkedlist.h"
+#include "talloc.h"
+#include "escape.h"
+#include "types.h"
+
+// Two annotations for the evaluator's numeric code, made once the parse
+// tree is final.
+//
+// Every two-operand +, -, *, <, > or = call gets UNBOXED on its head symbol.
+// The evaluator then keeps the numbers passing between the calls nested in
+// one on the C stack, and only boxes the result of the outermost. Whether
+// the operator really is the primitive is still checked when the call is
+// evaluated, since it can be rebound at any time.
+//
+// The inference itself works out which let and let* variables are always
+// fixnums or always flonums. Each variable's type is the join of the types
+// of its initializer and of everything set! assigns to it, where a literal
+// has its own type, arithmetic on two fixnums is a fixnum, arithmetic on a
+// flonum and a number is a flonum, an if has the join of its branches, and
+// anything else (a call, a procedure's parameter, a global) could be
+// anything. Counters and accumulators assign themselves arithmetic on
+// themselves, so the types are found optimistically: every variable starts
+// out with no type, and the definitions are retyped until nothing changes.
+// A variable that may be hidden by a define isn't typed at all.
+//
+// A typed variable that is assigned gets OWN_BOX on its name, its
+// references and its set!s. It's given a box no other value shares, which
+// set! overwrites in place instead of allocating a new one, and reading it
+// anywhere but in arithmetic copies it out. The evaluator still looks at
+// the type in the box before writing into it, so a wrong guess (a primitive
+// rebound to return something else) only costs an allocation.
+
+typedef enum {
+  // nothing is known yet
+  NUM_NONE,
+  NUM_FIXNUM,
+  NUM_FLONUM,
+  // could be anything, numbers or not
+  NUM_ANY
+} NumType;
+
+typedef struct Scope Scope;
+
+// An initializer or set! expression, with the names it sees.
+typedef struct Definition {
+  Value *expr;
+  Scope *scope;
+  struct Definition *next;
+} Definition;
+
+typedef struct Variable {
+  NumType type;
+  bool assigned;
+  // a define inside its scope may hide it
+  bool hidden;
+  Definition *definitions;
+  // its name where it's bound, its references and the targets of its set!s
+  Value *symbols;
+  struct Variable *next;
+} Variable;
+
+// A name bound at some point in the program; variable is NULL unless it's
+// bound by let or let*. Scopes share their tails, so one can be kept for
+// later.
+struct Scope {
+  char *name;
+  Variable *variable;
+  Scope *next;
+};
+
+// Per thread, since separate interpreters may be analysing at once.
+_Thread_local Variable *variables = NULL;
+
+bool isArithmetic(char *name) {
+  return !strcmp(name, "+") || !strcmp(name, "-") || !strcmp(name, "*")
+    || !strcmp(name, "<") || !strcmp(name, ">") || !strcmp(name, "=");
+}
+
+Scope *lookUpScope(Scope *scope, char *name) {
+  while (scope != NULL && strcmp(scope->name, name)) {
+    scope = scope->next;
+  }
+  return scope;
+}
+
+Scope *pushScope(Scope *scope, Value *name, Variable *variable) {
+  Scope *inner = talloc(sizeof(Scope));
+  inner->name = name->s;
+  inner->variable = variable;
+  inner->next = scope;
+  return inner;
+}
+
+Variable *newVariable(Value *name) {
+  Variable *variable = talloc(sizeof(Variable));
+  variable->type = NUM_NONE;
+  variable->assigned = false;
+  variable->hidden = false;
+  variable->definitions = NULL;
+  variable->symbols = cons(name, makeNull());
+  variable->next = variables;
+  variables = variable;
+  return variable;
+}
+
+void addDefinition(Variable *variable, Value *expr, Scope *scope) {
+  Definition *definition = talloc(sizeof(Definition));
+  definition->expr = expr;
+  definition->scope = scope;
+  definition->next = variable->definitions;
+  variable->definitions = definition;
+}
+
+// Whether bindings is a proper list of (symbol init) pairs.
+bool simpleBindings(Value *bindings) {
+  while (typeOf(bindings) == CONS_TYPE) {
+    Value *binding = car(bindings);
+    if (typeOf(binding) != CONS_TYPE || typeOf(car(binding)) != SYMBOL_TYPE
+        || typeOf(cdr(binding)) != CONS_TYPE || typeOf(cdr(cdr(binding))) != NULL_TYPE) {
+      return false;
+    }
+    bindings = cdr(bindings);
+  }
+  return typeOf(bindings) == NULL_TYPE;
+}
+
+// Whether list is a proper list of n elements.
+bool hasLength(Value *list, int n) {
+  while (n > 0 && typeOf(list) == CONS_TYPE) {
+    list = cdr(list);
+    n--;
+  }
+  return n == 0 && typeOf(list) == NULL_TYPE;
+}
+
+void walk(Value *expr, Scope *scope);
+
+void walkEach(Value *list, Scope *scope) {
+  while (typeOf(list) == CONS_TYPE) {
+    walk(car(list), scope);
+    list = cdr(list);
+  }
+}
+
+// Binds the variables of a let (sequentially, for let*) and walks its body.
+void walkLet(Value *expr, Scope *scope, bool sequential) {
+  Scope *inner = scope;
+  for (Value *binding = car(cdr(expr)); typeOf(binding) != NULL_TYPE; binding = cdr(binding)) {
+    Value *name = car(car(binding));
+    Value *init = car(cdr(car(binding)));
+    Scope *initScope = sequential ? inner : scope;
+    walk(init, initScope);
+    Variable *variable = newVariable(name);
+    addDefinition(variable, init, initScope);
+    inner = pushScope(inner, name, variable);
+  }
+  walkEach(cdr(cdr(expr)), inner);
+}
+
+// Records which variable each symbol in expr refers to, what each variable
+// is assigned, and which variables a define may hide, and marks the
+// arithmetic.
+void walk(Value *expr, Scope *scope) {
+  if (typeOf(expr) == SYMBOL_TYPE) {
+    Scope *bound = lookUpScope(scope, expr->s);
+    if (bound != NULL && bound->variable != NULL) {
+      bound->variable->symbols = cons(expr, bound->variable->symbols);
+    }
+    return;
+  }
+  if (typeOf(expr) != CONS_TYPE || isForm(expr, "quote")) {
+    return;
+  }
+
+  Value *args = cdr(expr);
+  if (isForm(expr, "lambda") && typeOf(args) == CONS_TYPE) {
+    Scope *inner = scope;
+    Value *param = car(args);
+    while (typeOf(param) == CONS_TYPE) {
+      if (typeOf(car(param)) == SYMBOL_TYPE) {
+        inner = pushScope(inner, car(param), NULL);
+      }
+      param = cdr(param);
+    }
+    if (typeOf(param) == SYMBOL_TYPE) {
+      inner = pushScope(inner, param, NULL);
+    }
+    walkEach(cdr(args), inner);
+    return;
+  }
+  if ((isForm(expr, "let") || isForm(expr, "let*")) && typeOf(args) == CONS_TYPE
+      && simpleBindings(car(args))) {
+    walkLet(expr, scope, isForm(expr, "let*"));
+    return;
+  }
+  if (isForm(expr, "letrec") && typeOf(args) == CONS_TYPE && simpleBindings(car(args))) {
+    Scope *inner = scope;
+    for (Value *binding = car(args); typeOf(binding) != NULL_TYPE; binding = cdr(binding)) {
+      inner = pushScope(inner, car(car(binding)), NULL);
+    }
+    for (Value *binding = car(args); typeOf(binding) != NULL_TYPE; binding = cdr(binding)) {
+      walk(car(cdr(car(binding))), inner);
+    }
+    walkEach(cdr(args), inner);
+    return;
+  }
+  if (isForm(expr, "define") && typeOf(args) == CONS_TYPE && typeOf(car(args)) == SYMBOL_TYPE) {
+    //the new binding goes in whatever frame the define is evaluated in,
+    //which may be one a variable of the same name is in, or nearer
+    for (Scope *bound = scope; bound != NULL; bound = bound->next) {
+      if (bound->variable != NULL && !strcmp(bound->name, car(args)->s)) {
+        bound->variable->hidden = true;
+      }
+    }
+    walkEach(cdr(args), scope);
+    return;
+  }
+  if (isForm(expr, "set!") && typeOf(args) == CONS_TYPE && typeOf(car(args)) == SYMBOL_TYPE
+      && typeOf(cdr(args)) == CONS_TYPE) {
+    walkEach(cdr(args), scope);
+    Scope *bound = lookUpScope(scope, car(args)->s);
+    if (bound != NULL && bound->variable != NULL) {
+      bound->variable->assigned = true;
+      bound->variable->symbols = cons(car(args), bound->variable->symbols);
+      addDefinition(bound->variable, car(cdr(args)), scope);
+    }
+    return;
+  }
+
+  if (typeOf(car(expr)) == SYMBOL_TYPE && isArithmetic(car(expr)->s) && hasLength(args, 2)) {
+    car(expr)->flags |= UNBOXED;
+  }
+  walkEach(expr, scope);
+}
+
+// The type of either of two expressions.
+NumType join(NumType a, NumType b) {
+  if (a == NUM_NONE) {
+    return b;
+  }
+  if (b == NUM_NONE || a == b) {
+    return a;
+  }
+  return NUM_ANY;
+}
+
+// The type of expr, given the variables' types so far.
+NumType typeOfExpr(Value *expr, Scope *scope) {
+  switch (typeOf(expr)) {
+    case INT_TYPE: {
+      return NUM_FIXNUM;
+    }
+    case DOUBLE_TYPE: {
+      return NUM_FLONUM;
+    }
+    case SYMBOL_TYPE: {
+      Scope *bound = lookUpScope(scope, expr->s);
+      if (bound == NULL || bound->variable == NULL || bound->variable->hidden) {
+        return NUM_ANY;
+      }
+      return bound->variable->type;
+    }
+    case CONS_TYPE: {
+      Value *head = car(expr);
+      Value *args = cdr(expr);
+      if (typeOf(head) != SYMBOL_TYPE) {
+        return NUM_ANY;
+      }
+      if (!strcmp(head->s, "if") && hasLength(args, 3)) {
+        return join(typeOfExpr(car(cdr(args)), scope), typeOfExpr(car(cdr(cdr(args))), scope));
+      }
+      //a locally bound + could be anything
+      bool numeric = !strcmp(head->s, "+") || !strcmp(head->s, "-") || !strcmp(head->s, "*");
+      if (!numeric || !hasLength(args, 2) || lookUpScope(scope, head->s) != NULL) {
+        return NUM_ANY;
+      }
+      NumType left = typeOfExpr(car(args), scope);
+      NumType right = typeOfExpr(car(cdr(args)), scope);
+      if (left == NUM_ANY || right == NUM_ANY) {
+        return NUM_ANY;
+      }
+      if (left == NUM_NONE || right == NUM_NONE) {
+        return NUM_NONE;
+      }
+      return left == NUM_FIXNUM && right == NUM_FIXNUM ? NUM_FIXNUM : NUM_FLONUM;
+    }
+    default: {
+      return NUM_ANY;
+    }
+  }
+}
+
+void inferTypes(Value *tree) {
+  variables = NULL;
+  for (Value *curExpr = tree; typeOf(curExpr) != NULL_TYPE; curExpr = cdr(curExpr)) {
+    walk(car(curExpr), NULL);
+  }
+
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (Variable *variable = variables; variable != NULL; variable = variable->next) {
+      NumType type = NUM_NONE;
+      for (Definition *definition = variable->definitions; definition != NULL;
+           definition = definition->next) {
+        type = join(type, typeOfExpr(definition->expr, definition->scope));
+      }
+      if (type != variable->type) {
+        variable->type = type;
+        changed = true;
+      }
+    }
+  }
+
+  for (Variable *variable = variables; variable != NULL; variable = variable->next) {
+    if (variable->assigned && !variable->hidden
+        && (variable->type == NUM_FIXNUM || variable->type == NUM_FLONUM)) {
+      for (Value *symbol = variable->symbols; typeOf(symbol) != NULL_TYPE; symbol = cdr(symbol)) {
+        car(symbol)->flags |= OWN_BOX;
+      }
+    }
+  }
+  variables = NULL;
+}
@@ -0,0 +1,12 @@
+#include "value.h"
+
+#ifndef _TYPES
+#define _TYPES
+
+// Marks the arithmetic in the parse tree that can be evaluated without
+// boxing intermediate results (UNBOXED), and the let variables that are
+// always fixnums or always flonums and are assigned, so can be updated in
+// place (OWN_BOX).
+void inferTypes(Value *tree);
+
+#endif
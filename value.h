@@ -1,6 +1,8 @@
 #ifndef _VALUE
 #define _VALUE
 
+#include <stdint.h>
+
 typedef enum {
     INT_TYPE, DOUBLE_TYPE, STR_TYPE, CONS_TYPE, NULL_TYPE, PTR_TYPE,
     OPEN_TYPE, CLOSE_TYPE, BOOL_TYPE, SYMBOL_TYPE,
@@ -15,20 +17,61 @@ typedef enum {
     PRIMITIVE_TYPE,
 
     // Type below is new for final portion
-    UNSPECIFIED_TYPE
+    UNSPECIFIED_TYPE,
+
+    // Type below is a procedure wrapped in a result cache by memoize; p points
+    // at its Memo
+    MEMO_TYPE,
+
+    // Type below is the placeholder (future expr) returns; p points at its
+    // Future
+    FUTURE_TYPE,
+
+    // Type below is a channel between coroutines; p points at its Channel
+    CHANNEL_TYPE,
+
+    // Types below are a file port, with p pointing at its Port, and what
+    // reading one returns at the end of the file
+    PORT_TYPE, EOF_TYPE,
+
+    // Type below is a vector; p points at its Vector
+    VECTOR_TYPE,
+
+    // Type below is a persistent map; p points at its Pmap
+    PMAP_TYPE
 } valueType;
 
+// NOTE: must update this, and the names below, whenever more types are added
+#define VALUE_TYPE_COUNT (PMAP_TYPE + 1)
+
+static inline const char *typeName(valueType type) {
+    static const char *const typeNames[VALUE_TYPE_COUNT] = {
+        "INT_TYPE", "DOUBLE_TYPE", "STR_TYPE", "CONS_TYPE", "NULL_TYPE", "PTR_TYPE",
+        "OPEN_TYPE", "CLOSE_TYPE", "BOOL_TYPE", "SYMBOL_TYPE", "OPENBRACKET_TYPE",
+        "CLOSEBRACKET_TYPE", "DOT_TYPE", "SINGLEQUOTE_TYPE", "VOID_TYPE", "CLOSURE_TYPE",
+        "PRIMITIVE_TYPE", "UNSPECIFIED_TYPE", "MEMO_TYPE", "FUTURE_TYPE",
+        "CHANNEL_TYPE", "PORT_TYPE", "EOF_TYPE", "VECTOR_TYPE", "PMAP_TYPE"
+    };
+    return typeNames[type];
+}
+
 struct Value {
     valueType type;
+    // Annotations left on parse-tree symbols by the analysis passes; see the
+    // bits below. Zero means nothing is known.
+    int flags;
     union {
         int i;
         double d;
-        char *s;
+        // A string or symbol's name. A symbol in the parse tree also caches,
+        // once it has been looked up, the global binding it refers to and
+        // the binding epoch that was current then; see findBinding.
+        struct {
+            char *s;
+            struct Value *cell;
+            int epoch;
+        };
         void *p;
-        struct ConsCell {
-            struct Value *car;
-            struct Value *cdr;
-        } c;
         // For purposes of this project a closure is just another type of value,
         // containing everything needed to execute a user-defined function: (1)
         // a list of formal parameter names; (2) a pointer to the function body;
@@ -41,13 +84,70 @@ struct Value {
         } cl;
         
         // A primitive style function; just a pointer to it, with the right
-        // signature (pf = primitive function)
-        struct Value *(*pf)(struct Value *);
+        // signature (pf = primitive function). It gets its arguments as a
+        // count and a contiguous array, not as a list.
+        struct Value *(*pf)(int argc, struct Value **argv);
     };
 };
 
 typedef struct Value Value;
 
+// Set on the head symbol of a let, let*, letrec or lambda (and copied onto
+// the closures a lambda makes) when nothing in its body can capture the
+// frame it creates, so the frame can live in the frame region.
+#define NO_ESCAPE 0x1
+
+// Set on the head symbol of a call to +, -, *, <, > or = with two operands,
+// whose nested arithmetic is then done without boxing the intermediate
+// results.
+#define UNBOXED 0x2
+
+// Set on a let variable's name, its references and its set!s when the
+// variable is always a fixnum or always a flonum and is assigned: its box is
+// its own, and set! overwrites it in place.
+#define OWN_BOX 0x4
+
+// Set on the head symbol of a let, letrec or lambda whose syntax the
+// expander has checked, so the evaluator needn't.
+#define CHECKED 0x8
+
+// Pairs don't carry a type field at all: a pair is just its car and cdr, 16
+// bytes, and lives on a page that holds nothing but pairs. Pointers to pairs
+// are still passed around as Value *, so use car()/cdr()/setCar()/setCdr()
+// rather than touching the fields directly, and typeOf() rather than ->type.
+struct Pair {
+    struct Value *car;
+    struct Value *cdr;
+};
+
+typedef struct Pair Pair;
+
+// Every Value and Pair is carved out of a PAGE_SIZE-aligned page, and the
+// header at the start of the page says what is stored there. A page of pairs
+// is tagged CONS_TYPE; a page of ordinary Values is tagged PTR_TYPE, and each
+// of those Values carries its own type.
+#define PAGE_SIZE 4096
+
+struct PageHeader {
+    valueType type;
+    // the heap the page was taken from
+    struct Heap *heap;
+};
+
+typedef struct PageHeader PageHeader;
+
+static inline PageHeader *pageOf(const void *v) {
+    return (PageHeader *) ((uintptr_t) v & ~((uintptr_t) PAGE_SIZE - 1));
+}
+
+// The type of any value, whether it is a pair or an ordinary Value.
+static inline valueType typeOf(const Value *v) {
+    if (pageOf(v)->type == CONS_TYPE) {
+        return CONS_TYPE;
+    }
+    return v->type;
+}
+
 
 // A frame is a linked list of bindings, and a pointer to another frame.  A
 // binding is a variable name (represented as a string), and a pointer to the
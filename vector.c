@@ -0,0 +1,243 @@
+#include <stdbool.h>
+#include <string.h>
+#include "value.h"
+#include "linkedlist.h"
+#include "talloc.h"
+#include "interpreter.h"
+#include "context.h"
+#include "vector.h"
+
+// Vectors are fixed-length and indexed from 0. vector-fold walks one in C,
+// handing each call its arguments in a buffer on the C stack, as foldl does
+// for lists, so a column of any length can be aggregated without the deep
+// recursion a Scheme loop over its indices would need.
+
+Value *makeVector(VectorKind kind, int length) {
+  Vector *vector = talloc(sizeof(Vector));
+  vector->kind = kind;
+  vector->length = length;
+  vector->strings = NULL;
+  vector->requestCount = currentContext->requestCount;
+  size_t size = length > 0 ? length : 1;
+  switch (kind) {
+    case VECTOR_VALUES:
+      vector->values = talloc(sizeof(Value *) * size);
+      break;
+    case VECTOR_INTS:
+      vector->ints = talloc(sizeof(int) * size);
+      break;
+    case VECTOR_DOUBLES:
+      vector->doubles = talloc(sizeof(double) * size);
+      break;
+    case VECTOR_SLICES:
+      vector->slices = talloc(sizeof(Slice) * size);
+      vector->strings = talloc(sizeof(Value *) * size);
+      memset(vector->strings, 0, sizeof(Value *) * size);
+      break;
+  }
+  Value *result = makeValue(VECTOR_TYPE);
+  result->p = vector;
+  return result;
+}
+
+Value *makeString(const char *text, int length) {
+  char *s = talloc(length + 3);
+  s[0] = '"';
+  memcpy(s + 1, text, length);
+  s[length + 1] = '"';
+  s[length + 2] = '\0';
+  Value *string = makeValue(STR_TYPE);
+  string->s = s;
+  return string;
+}
+
+Value *vectorRef(Vector *vector, int i) {
+  switch (vector->kind) {
+    case VECTOR_VALUES: {
+      return vector->values[i];
+    }
+    case VECTOR_INTS: {
+      Value *number = makeValue(INT_TYPE);
+      number->i = vector->ints[i];
+      return number;
+    }
+    case VECTOR_DOUBLES: {
+      Value *number = makeValue(DOUBLE_TYPE);
+      number->d = vector->doubles[i];
+      return number;
+    }
+    case VECTOR_SLICES: {
+      //a vector from a server's prelude outlives each request, but the
+      //strings made during one are freed with it
+      int requestCount = currentContext->requestCount;
+      if (__atomic_load_n(&vector->requestCount, __ATOMIC_ACQUIRE) != requestCount) {
+        for (int j = 0; j < vector->length; j++) {
+          __atomic_store_n(&vector->strings[j], NULL, __ATOMIC_RELAXED);
+        }
+        __atomic_store_n(&vector->requestCount, requestCount, __ATOMIC_RELEASE);
+      }
+      //strings can't be changed, so each slice only needs one. Futures may
+      //make the same one at once; the first to store it wins
+      Value *string = __atomic_load_n(&vector->strings[i], __ATOMIC_ACQUIRE);
+      if (string == NULL) {
+        Value *made = makeString(vector->slices[i].text, vector->slices[i].length);
+        if (__atomic_compare_exchange_n(&vector->strings[i], &string, made, false,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+          string = made;
+        }
+      }
+      return string;
+    }
+  }
+  return NULL;
+}
+
+void fprintVector(FILE *stream, Vector *vector) {
+  fprintf(stream, "#(");
+  for (int i = 0; i < vector->length; i++) {
+    if (i > 0) {
+      fprintf(stream, " ");
+    }
+    fprintValue(stream, vectorRef(vector, i));
+  }
+  fprintf(stream, ")");
+}
+
+size_t walkVector(void *elements, HeapWalk *walk) {
+  Vector *vector = elements;
+  size_t size = vector->length > 0 ? vector->length : 1;
+  switch (vector->kind) {
+    case VECTOR_VALUES:
+      for (int i = 0; i < vector->length; i++) {
+        heapReach(walk, vector->values[i], "vector");
+      }
+      return sizeof(Vector) + sizeof(Value *) * size;
+    case VECTOR_INTS:
+      return sizeof(Vector) + sizeof(int) * size;
+    case VECTOR_DOUBLES:
+      return sizeof(Vector) + sizeof(double) * size;
+    case VECTOR_SLICES:
+      //the text is in the mapped file, and strings from an earlier server
+      //request have been freed with it
+      if (__atomic_load_n(&vector->requestCount, __ATOMIC_ACQUIRE) == currentContext->requestCount) {
+        for (int i = 0; i < vector->length; i++) {
+          heapReach(walk, __atomic_load_n(&vector->strings[i], __ATOMIC_ACQUIRE), "vector");
+        }
+      }
+      return sizeof(Vector) + (sizeof(Slice) + sizeof(Value *)) * size;
+  }
+  return sizeof(Vector);
+}
+
+Vector *vectorArg(Value *value, char *errorMessage) {
+  if (typeOf(value) != VECTOR_TYPE) {
+    evaluationError(errorMessage);
+  }
+  return value->p;
+}
+
+//(vector a b ...)
+Value *primitiveVector(int argc, Value **argv) {
+  Value *result = makeVector(VECTOR_VALUES, argc);
+  Vector *vector = result->p;
+  for (int i = 0; i < argc; i++) {
+    vector->values[i] = argv[i];
+  }
+  return result;
+}
+
+Value *primitiveListToVector(int argc, Value **argv) {
+  if (argc != 1) {
+    evaluationError("wrong number of args in list->vector");
+  }
+  int count = 0;
+  Value *curVal = argv[0];
+  while (typeOf(curVal) == CONS_TYPE) {
+    count++;
+    curVal = cdr(curVal);
+  }
+  if (typeOf(curVal) != NULL_TYPE) {
+    evaluationError("wrong type arg in list->vector");
+  }
+
+  Value *result = makeVector(VECTOR_VALUES, count);
+  Vector *vector = result->p;
+  curVal = argv[0];
+  for (int i = 0; i < count; i++) {
+    vector->values[i] = car(curVal);
+    curVal = cdr(curVal);
+  }
+  return result;
+}
+
+Value *primitiveIsVector(int argc, Value **argv) {
+  if (argc != 1) {
+    evaluationError("wrong number of args in vector?");
+  }
+  return makeBool(typeOf(argv[0]) == VECTOR_TYPE);
+}
+
+Value *primitiveVectorLength(int argc, Value **argv) {
+  if (argc != 1) {
+    evaluationError("wrong number of args in vector-length");
+  }
+  Vector *vector = vectorArg(argv[0], "wrong type arg in vector-length");
+  Value *length = makeValue(INT_TYPE);
+  length->i = vector->length;
+  return length;
+}
+
+Value *primitiveVectorRef(int argc, Value **argv) {
+  if (argc != 2) {
+    evaluationError("wrong number of args in vector-ref");
+  }
+  Vector *vector = vectorArg(argv[0], "wrong type arg in vector-ref");
+  if (typeOf(argv[1]) != INT_TYPE) {
+    evaluationError("wrong type arg in vector-ref");
+  }
+  if (argv[1]->i < 0 || argv[1]->i >= vector->length) {
+    evaluationError("index out of range in vector-ref");
+  }
+  return vectorRef(vector, argv[1]->i);
+}
+
+Value *primitiveVectorToList(int argc, Value **argv) {
+  if (argc != 1) {
+    evaluationError("wrong number of args in vector->list");
+  }
+  Vector *vector = vectorArg(argv[0], "wrong type arg in vector->list");
+  Value *result = makeNull();
+  for (int i = vector->length - 1; i >= 0; i--) {
+    result = cons(vectorRef(vector, i), result);
+  }
+  return result;
+}
+
+//(vector-fold f init v) calls (f element accumulator) on each element in
+//turn, like foldl
+Value *primitiveVectorFold(int argc, Value **argv) {
+  if (argc != 3) {
+    evaluationError("wrong number of args in vector-fold");
+  }
+  Vector *vector = vectorArg(argv[2], "wrong type arg in vector-fold");
+
+  Value *function = argv[0];
+  Value *accumulator = argv[1];
+  Value *callArgs[2];
+  for (int i = 0; i < vector->length; i++) {
+    callArgs[0] = vectorRef(vector, i);
+    callArgs[1] = accumulator;
+    accumulator = apply(function, 2, callArgs);
+  }
+  return accumulator;
+}
+
+void bindVectorPrimitives(Frame *frame) {
+  bind("vector", primitiveVector, frame);
+  bind("list->vector", primitiveListToVector, frame);
+  bind("vector?", primitiveIsVector, frame);
+  bind("vector-length", primitiveVectorLength, frame);
+  bind("vector-ref", primitiveVectorRef, frame);
+  bind("vector->list", primitiveVectorToList, frame);
+  bind("vector-fold", primitiveVectorFold, frame);
+}
@@ -0,0 +1,60 @@
+#include <stdio.h>
+#include <stddef.h>
+#include "value.h"
+#include "heapdump.h"
+
+#ifndef _VECTOR
+#define _VECTOR
+
+// How a vector stores its elements. Besides ordinary Values, a column read
+// by read-csv keeps its numbers unboxed, or its strings as slices of the
+// file, and only makes a Value for an element when one is asked for.
+typedef enum {
+  VECTOR_VALUES, VECTOR_INTS, VECTOR_DOUBLES, VECTOR_SLICES
+} VectorKind;
+
+// Some text, not NUL-terminated and without quotes, that a string can be
+// made from.
+typedef struct Slice {
+  const char *text;
+  int length;
+} Slice;
+
+typedef struct Vector {
+  VectorKind kind;
+  int length;
+  union {
+    Value **values;
+    int *ints;
+    double *doubles;
+    Slice *slices;
+  };
+  // for VECTOR_SLICES, the strings made from each slice so far, and the
+  // server request they were made in; see vectorRef
+  Value **strings;
+  int requestCount;
+} Vector;
+
+// A vector of length elements of the given kind, with room for them all
+// but nothing filled in.
+Value *makeVector(VectorKind kind, int length);
+
+// A string Value with the given text, quoted the way the tokenizer quotes
+// string literals.
+Value *makeString(const char *text, int length);
+
+// Element i of a vector, which must be in range.
+Value *vectorRef(Vector *vector, int i);
+
+// Print a vector as #(a b c).
+void fprintVector(FILE *stream, Vector *vector);
+
+// Add a vector's elements to a heap dump's walk, and return the bytes its
+// storage takes up.
+size_t walkVector(void *vector, HeapWalk *walk);
+
+// Bind vector, list->vector, vector?, vector-length, vector-ref,
+// vector->list and vector-fold in the given frame.
+void bindVectorPrimitives(Frame *frame);
+
+#endif